@@ -11,34 +11,212 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <cgltf.h>
 #include <steam/steam_api.h>
+#include <atomic>
+#include <coroutine>
+#include <type_traits>
+
+// scoped timers, build with DEEP_PROFILE=0 to compile every DEEP_PROFILE_SCOPE out
+#ifndef DEEP_PROFILE
+#define DEEP_PROFILE 1
+#endif
 
 namespace deep
 {
     bool use_both_monitors = false; // I have 2 Full HD Monitors and want both used for splitscreen
+    bool headless = false; // no window, gpu or audio, only the simulation runs
+    std::atomic<bool> profiling = false; // scopes only read the clock while this is set, the overlay shows with it, jobs read it too
+    bool log_mesh_optimization = false; // set before init, logs the vertex cache results of every mesh that is decoded
 
-    const int MAP_SIZE_X = 35;
-    const int MAP_SIZE_Y = 15;
+    const int MAP_CHUNK_SHIFT = 4;
+    const int MAP_CHUNK_SIZE = 1 << MAP_CHUNK_SHIFT; // tiles per chunk side
     
+    // slot index plus the generation the slot had when the entity was created, stale handles stop resolving once the slot is reused
     struct Entity
     {
-        int id;
-        bool is_active = false;
-        glm::mat4 transform = glm::mat4(1.0f);
+        Uint32 index = 0;
+        Uint32 generation = 0;
+    };
+    const Entity NULL_ENTITY = {};
+
+    struct Position_Component
+    {
+        glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
+        glm::vec3 previous_position = glm::vec3(0.0f, 0.0f, 0.0f); // at the start of the current simulation step, rendering blends towards position
+    };
+
+    struct Velocity_Component
+    {
+        glm::vec2 velocity = glm::vec2(0.0f, 0.0f);
+        float speed = 3.0f;
+    };
+
+    struct Collision_Component
+    {
+        float radius = 0.5f;
+    };
 
-        bool light_component = false;
-        glm::vec3 light_position = glm::vec3(0.0f, 0.0f, 0.0f);
+    struct Light_Component
+    {
+        glm::vec3 ambient = glm::vec3(0.2f, 0.2f, 0.2f);
+        glm::vec3 diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
+        glm::vec3 specular = glm::vec3(1.0f, 1.0f, 1.0f);
+        glm::vec3 constant_linear_quadratic = glm::vec3(1.0f, 0.09f, 0.032f);
+    };
 
-        bool mesh_component = false;
+    struct Render_Component
+    {
+        int mesh_id;
         SDL_GPUBuffer* vertex_buffer;
         SDL_GPUBuffer* index_buffer;
         int index_count;
+        float bounding_radius = 0.0f;
+        glm::mat4 rotation = glm::mat4(1.0f);
+    };
 
-        bool hurt_component = false;
-        float collision_radius = 0.5f;
+    // near enemies think every frame, mid enemies in round robin slices, sleeping enemies not at all
+    enum AI_Tier
+    {
+        AI_Sleeping,
+        AI_Mid,
+        AI_Near
+    };
+
+    struct Enemy_Component
+    {
         float sight = 14.0f;
-        float speed = 3.0f;
 
-        bool exit_component = false;
+        // written by the ai scheduler
+        AI_Tier tier = AI_Sleeping;
+        Uint64 scheduled_frame = 0;
+    };
+
+    struct Exit_Component
+    {
+    };
+
+    struct Ray
+    {
+        glm::vec2 origin = glm::vec2(0.0f, 0.0f);
+        glm::vec2 direction = glm::vec2(1.0f, 0.0f); // unit length
+        float max_distance = 0.0f;
+        float radius = 0.0f; // widens the ray against entities, walls are always hit by the center line
+        Entity ignore = NULL_ENTITY;
+    };
+
+    // entity is NULL_ENTITY when a wall was hit
+    struct Ray_Hit
+    {
+        bool hit = false;
+        float distance = 0.0f;
+        glm::vec2 point = glm::vec2(0.0f, 0.0f);
+        Entity entity = NULL_ENTITY;
+    };
+
+    const int STEERING_MAX_PLAYERS = 2;
+
+    struct Steering_Players
+    {
+        glm::vec2 positions[STEERING_MAX_PLAYERS];
+        int count = 0;
+    };
+
+    enum Steering_Flags
+    {
+        Steering_In_Sight = 1,
+        Steering_Contact = 2
+    };
+
+    // enemies packed into flat arrays, padded to a multiple of 8 lanes so the simd kernels never need a tail loop
+    struct Steering_Batch
+    {
+        int count = 0;
+        std::vector<Entity> entities;
+        std::vector<float> x;
+        std::vector<float> z;
+        std::vector<float> sight;
+        std::vector<float> radius;
+        std::vector<Uint8> nearest_player;
+        std::vector<Uint8> flags;
+    };
+
+    // tile 0 is empty, any other id is one plus the index of a map mesh, room 0 is outside of any room
+    struct Map_Chunk
+    {
+        Uint8 tiles[MAP_CHUNK_SIZE][MAP_CHUNK_SIZE] = {};
+        Uint16 rooms[MAP_CHUNK_SIZE][MAP_CHUNK_SIZE] = {};
+        glm::ivec2 origin = glm::ivec2(0, 0); // first tile of the chunk
+    };
+
+    // tiles of any size, stored as chunks that only exist where something was placed, so empty space
+    // costs one index per chunk and everything that walks the map only visits the occupied chunks.
+    // games fill one on any thread and hand it to bake_level_map
+    struct Tile_Map
+    {
+        int size_x = 0;
+        int size_y = 0;
+        int chunks_x = 0;
+        int chunks_y = 0;
+        std::vector<Sint32> chunk_index; // per chunk cell, -1 while empty
+        std::vector<Map_Chunk> chunks;
+    };
+
+    // flat copy of the simulation, values are read back in the order they were written
+    struct Snapshot
+    {
+        std::vector<Uint8> data;
+        size_t read_offset = 0;
+    };
+
+    const int INPUT_MAX_PLAYERS = 2;
+
+    // everything one simulation step reads from the devices, the game decides what the button bits mean
+    struct Input_Frame
+    {
+        Uint32 buttons = 0;
+        glm::vec2 look[INPUT_MAX_PLAYERS] = { glm::vec2(0.0f, 0.0f), glm::vec2(0.0f, 0.0f) };
+    };
+
+    // entity behaviors are coroutines, a suspended behavior sits on the timer wheel or a wait list and costs nothing until resumed
+    struct Behavior
+    {
+        struct promise_type
+        {
+            Entity entity = NULL_ENTITY;
+
+            Behavior get_return_object() { return Behavior{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { SDL_Log("Behavior of entity %u threw an exception", entity.index); }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+
+        Behavior() = default;
+        explicit Behavior(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+        Behavior(Behavior&& other) noexcept : handle(other.handle) { other.handle = {}; }
+        Behavior(const Behavior&) = delete;
+        ~Behavior() { if(handle) { handle.destroy(); } }
+    };
+
+    enum Behavior_Wait_Kind
+    {
+        Behavior_Running,
+        Behavior_Timer,
+        Behavior_Player_Range,
+        Behavior_Move
+    };
+
+    // co_await one of wait_seconds, wait_until_player_in_range or move_to_tile inside a behavior
+    struct Behavior_Wait
+    {
+        Behavior_Wait_Kind kind = Behavior_Running;
+        float value = 0.0f; // seconds for timers, distance for player range
+        glm::ivec2 tile = glm::ivec2(0, 0);
+
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<Behavior::promise_type> handle);
+        void await_resume() {}
     };
 }
 
@@ -56,6 +234,15 @@ namespace deepcore
             SDL_GPUTexture* shininess_map;
             SDL_GPUSampler* sampler;
             SDL_GPUTexture* scene_depth_texture;
+
+            // one bit per viewport, rebuilt every frame by compute_visibility
+            std::vector<Uint8> render_visibility;
+            std::vector<Uint8> chunk_visibility; // per map chunk
+        };
+
+        struct Frustum
+        {
+            glm::vec4 planes[6];
         };
 
         struct Vertex
@@ -98,6 +285,7 @@ namespace deepcore
         struct Camera
         {
             glm::vec3 position;
+            glm::vec3 previous_position;
             glm::vec3 front;
             glm::vec3 up;
             glm::vec3 right;
@@ -112,34 +300,247 @@ namespace deepcore
             glm::mat4 projection;
         };
 
+        const int MIXER_VOICE_COUNT = 16;
+        const int MIXER_COMMAND_COUNT = 64; // power of two
+        const int MIXER_CHANNELS = 2;
+        const int MIXER_FREQUENCY = 48000; // when the device does not report its own
+        const int MIXER_BUFFER_FRAMES = 512;
+        const int SOUND_POOL_SIZE = 1 << 20; // floats, about 11 seconds of stereo at 48 kHz
+        const int SOUND_POOL_ALIGNMENT = 64;
+
+        const int MUSIC_RING_FRAMES = 16384; // power of two, a third of a second at the mixer rate
+        const int MUSIC_DECODE_FRAMES = 2048; // per read from the converter
+        const int MUSIC_MAX_BLOCK_SIZE = 8192;
+        const Uint16 WAVE_FORMAT_PCM = 0x0001;
+        const Uint16 WAVE_FORMAT_IMA_ADPCM = 0x0011;
+
+        // streamed from disk a block at a time, only the ring and one block are ever in memory however long the track is
+        struct Music {
+            SDL_IOStream *file = nullptr;
+            SDL_AudioStream *converter = nullptr; // decoded s16 at the file rate in, mixer format out
+            Uint16 format = 0;
+            int channels = 0;
+            int block_size = 0;
+            Sint64 data_offset = 0;
+            Sint64 data_size = 0;
+            Sint64 data_read = 0;
+            Sint64 frame_count = 0; // adpcm blocks are padded, the fact chunk has the real length
+            Sint64 frames_read = 0;
+            std::vector<Uint8> block;
+            std::vector<Sint16> decoded;
+            std::vector<float> converted;
+
+            float ring[MUSIC_RING_FRAMES * MIXER_CHANNELS];
+            alignas(64) std::atomic<Uint32> ring_read{0}; // written by the audio callback
+            alignas(64) std::atomic<Uint32> ring_write{0}; // written by the decode job
+            std::atomic<bool> decoding{false};
+        };
+
+        // converted to the mixer format once at load, the samples live in the mixer pool
         struct Sound {
-            Uint8 *wav_data;
-            Uint32 wav_data_len;
-            SDL_AudioStream *stream;
+            Uint32 offset = 0; // in floats, every sound starts on a cache line
+            int frame_count = 0;
+        };
+
+        struct Sound_Command
+        {
+            int sound;
+            float gain;
+            float pan;
+        };
+
+        struct Voice
+        {
+            int sound = -1; // -1 when free
+            int frame = 0;
+            float gain_left = 0.0f;
+            float gain_right = 0.0f;
+            Uint64 started = 0; // the oldest voice is stolen first
+        };
+
+        // one stream on the device for sounds and music, the game thread only pushes commands, voices belong to the audio callback
+        struct Mixer
+        {
+            SDL_AudioStream* stream = nullptr;
+            SDL_AudioSpec spec = { SDL_AUDIO_F32, MIXER_CHANNELS, MIXER_FREQUENCY };
+            float* pool = nullptr; // interleaved stereo of every sound
+            Uint32 pool_used = 0;
+            Sound_Command commands[MIXER_COMMAND_COUNT];
+            alignas(64) std::atomic<Uint32> command_head{0}; // written by the audio callback
+            alignas(64) std::atomic<Uint32> command_tail{0}; // written by the game thread
+            Voice voices[MIXER_VOICE_COUNT];
+            Uint64 voices_started = 0;
+            alignas(16) float buffer[MIXER_BUFFER_FRAMES * MIXER_CHANNELS];
         };
 
         struct Sound_System
         {
             Sound data[10];
-            Sound music;
+            Music music;
             int max_count = 10;
             int count = 0;
             SDL_AudioDeviceID audio_device = 0;
+            Mixer mixer;
+        };
+
+        const int JOB_MAX_WORKERS = 16;
+        const int JOB_DEQUE_SIZE = 512; // power of two
+        const int JOB_MAX_CONTINUATIONS = 8;
+        const int JOB_BACKGROUND_QUEUE_SIZE = 256;
+
+        typedef void (*Job_Function)(void* data, int begin, int end);
+
+        struct Job_Counter;
+
+        struct Job
+        {
+            Job_Function function;
+            void* data;
+            int begin;
+            int end;
+            Job_Counter* counter;
+        };
+
+        // counts unfinished jobs, jobs added with submit_job_after start once it drops to zero
+        struct Job_Counter
+        {
+            SDL_AtomicInt pending;
+            SDL_SpinLock lock;
+            Job continuations[JOB_MAX_CONTINUATIONS];
+            int continuation_count;
         };
 
-        struct Entities
+        // chase-lev deque, the owner pushes and pops at the bottom, other workers steal from the top
+        struct Job_Deque
         {
-            deep::Entity data[100];
-            int max_count = 100;
+            Job jobs[JOB_DEQUE_SIZE];
+            alignas(64) std::atomic<Sint64> top;
+            alignas(64) std::atomic<Sint64> bottom;
+        };
+
+        // long jobs only workers take, so a waiting main thread never picks one up mid frame
+        struct Job_Queue
+        {
+            Job jobs[JOB_BACKGROUND_QUEUE_SIZE];
+            int head = 0;
             int count = 0;
+            SDL_SpinLock lock = 0;
         };
 
-        struct Map_Mesh
+        struct Job_System
         {
-            bool has_mesh = false;
+            SDL_Thread* threads[JOB_MAX_WORKERS];
+            int worker_count = 0;
+            // deque 0 belongs to the main thread, worker n owns deque n
+            Job_Deque deques[JOB_MAX_WORKERS];
+            SDL_Semaphore* wake;
+            SDL_AtomicInt sleeping;
+            SDL_AtomicInt quit;
+
+            // fire and forget jobs that have to be done before the frame renders
+            Job_Counter frame_counter;
+            // jobs that may span many frames, nothing waits for them until their result is needed
+            Job_Counter background_counter;
+            Job_Queue background_queue;
+        };
+
+        const Uint32 NO_COMPONENT = 0xFFFFFFFF;
+
+        // dense component data, sparse maps an entity slot to its dense index
+        template<typename T>
+        struct Component_Pool
+        {
+            std::vector<T> data;
+            std::vector<Uint32> owners;
+            std::vector<Uint32> sparse;
+        };
+
+        // one cell per map tile, every entity with a position is linked into the cell under it,
+        // entities outside the map are kept in the nearest border cell
+        const float SPATIAL_CELL_SIZE = 3.0f;
+
+        struct Spatial_Grid
+        {
+            int size_x = 0; // taken from the map when the first entity is linked after a clear
+            int size_y = 0;
+            std::vector<Uint32> heads; // first slot per cell
+            std::vector<Uint32> cells; // cell per slot
+            std::vector<Uint32> next;
+            std::vector<Uint32> previous;
+        };
+
+        struct Entity_Store
+        {
+            std::vector<Uint32> generations;
+            std::vector<Uint32> free_slots;
+            int count = 0;
+
+            Component_Pool<deep::Position_Component> positions;
+            Component_Pool<deep::Velocity_Component> velocities;
+            Component_Pool<deep::Collision_Component> collisions;
+            Component_Pool<deep::Light_Component> lights;
+            Component_Pool<deep::Render_Component> renders;
+            Component_Pool<deep::Enemy_Component> enemies;
+            Component_Pool<deep::Exit_Component> exits;
+
+            Spatial_Grid grid;
+        };
+
+        enum Asset_State
+        {
+            Asset_Unloaded,
+            Asset_Loading,
+            Asset_Decoded,
+            Asset_Ready,
+            Asset_Failed
+        };
+
+        struct Mesh_Asset
+        {
+            char filename[256];
+            Asset_State state = Asset_Unloaded;
+
+            // filled by a decode job, released after the upload
+            std::vector<Vertex> vertices;
+            std::vector<Uint16> indices;
+
             SDL_GPUBuffer* vertex_buffer;
             SDL_GPUBuffer* index_buffer;
             int index_count;
+            float bounding_radius = 0.0f; // around the model origin
+        };
+
+        struct Mesh_Assets
+        {
+            Mesh_Asset data[64];
+            int max_count = 64;
+            int count = 0;
+        };
+
+        struct Mesh_Request
+        {
+            deep::Entity entity;
+            int mesh_id;
+            glm::vec3 rotation;
+        };
+
+        struct Asset_Streamer
+        {
+            SDL_Mutex* mutex;
+            Job_Counter decode_counter;
+
+            // mesh ids decoded and waiting for the upload at the next frame boundary, guarded by the mutex
+            int upload_queue[64];
+            int upload_count = 0;
+
+            // entities waiting for their mesh, main thread only
+            std::vector<Mesh_Request> requests;
+        };
+
+        struct Map_Mesh
+        {
+            bool has_mesh = false;
+            float bounding_radius = 0.0f;
 
             bool is_collision_top = false;
             bool is_collision_right = false;
@@ -154,1053 +555,5441 @@ namespace deepcore
             int meshes_max_count = 20;
             int meshes_count = 0;
 
-            int map[deep::MAP_SIZE_Y][deep::MAP_SIZE_X] = {};
+            deep::Tile_Map tiles;
+            int version = 0; // bumped on every tile change so derived data knows to rebuild
+        };
+
+        // bits of a baked tile, which of the 8 neighbours block a circle standing in this tile
+        enum Collision_Bits
+        {
+            Collision_Top = 1 << 0,
+            Collision_Right = 1 << 1,
+            Collision_Bottom = 1 << 2,
+            Collision_Left = 1 << 3,
+            Collision_Top_Right = 1 << 4,
+            Collision_Bottom_Right = 1 << 5,
+            Collision_Bottom_Left = 1 << 6,
+            Collision_Top_Left = 1 << 7,
+            Collision_Outside = 1 << 8 // no tile here, nothing blocks
+        };
+
+        // masks of the occupied chunks only, indexed like get_tile_slot, tiles without a slot are outside
+        struct Collision_Grid
+        {
+            std::vector<Uint16> masks;
+            int map_version = -1;
+        };
+
+        const int LOS_RADIUS = 8; // in tiles, past it has_line_of_sight traces the tiles instead
+        const int LOS_WINDOW = LOS_RADIUS * 2 + 1;
+        const int LOS_WORD_COUNT = (LOS_WINDOW * LOS_WINDOW + 63) / 64;
+        const int MAP_CHUNK_TILES = deep::MAP_CHUNK_SIZE * deep::MAP_CHUNK_SIZE;
+
+        // one row per tile of the occupied chunks, indexed like get_tile_slot, bit (dz + LOS_RADIUS) * LOS_WINDOW + dx + LOS_RADIUS
+        // is set when the tile that far away can be seen
+        struct Line_Of_Sight
+        {
+            std::vector<Uint64> visible;
+            int map_version = -1;
+        };
+
+        // tile models stay on the cpu, chunk meshes are merged from them
+        struct Map_Geometry
+        {
+            std::vector<Vertex> vertices;
+            std::vector<Uint16> indices;
+        };
+
+        const float CHUNK_STREAM_DISTANCE = 100.0f; // the camera far plane
+        const float CHUNK_PREFETCH_DISTANCE = 48.0f; // one chunk ahead of where a camera moves
+        const Uint64 CHUNK_GPU_BUDGET = 64 * 1024 * 1024;
+        const int CHUNK_MAX_BUILDS = 8; // per frame, the nearest needed chunks go first and the rest follow on the next frames
+        const int CHUNK_PREFETCH_BUILDS = 1; // per frame, only while the needed chunks leave room
+
+        // every tile of a map chunk merged in world space into one draw, merged chunks pass 65535 vertices so indices are 32 bit
+        struct Chunk_Mesh
+        {
+            bool resident = false;
+            SDL_GPUBuffer* vertex_buffer = nullptr;
+            SDL_GPUBuffer* index_buffer = nullptr;
+            Uint32 index_count = 0;
+            Uint64 bytes = 0;
+            Uint64 last_used = 0; // stream frame a camera last wanted it
+            glm::vec3 center = glm::vec3(0.0f, 0.0f, 0.0f);
+            float radius = 0.0f;
+        };
+
+        // one chunk merged by a worker, uploaded together with the rest of the frame's builds
+        struct Chunk_Build
+        {
+            int chunk = -1;
+            std::vector<Vertex> vertices;
+            std::vector<Uint32> indices;
+        };
+
+        struct Chunk_Request
+        {
+            int chunk;
+            float distance; // to the camera that wants it
+        };
+
+        // gpu memory for the map stays under the budget however big the map is, the least recently wanted chunks go first
+        struct Chunk_Streamer
+        {
+            Map_Geometry geometry[20]; // per map mesh
+            std::vector<Chunk_Mesh> meshes; // per map chunk
+            std::vector<int> resident;
+            std::vector<Chunk_Request> needed;
+            std::vector<int> prefetch;
+            Uint64 budget = CHUNK_GPU_BUDGET;
+            Uint64 resident_bytes = 0;
+            Uint64 frame = 0;
+            int map_version = -1;
+            glm::vec3 previous_position[2] = {};
+            glm::vec2 direction[2] = {};
+
+            Chunk_Build builds[CHUNK_MAX_BUILDS];
+            int build_count = 0;
+        };
+
+        // a level map with everything derived from it, baked off the main thread and copied in by apply_level_map
+        struct Map_Bake
+        {
+            Map map;
+            Collision_Grid collision_grid;
+            Line_Of_Sight line_of_sight;
+        };
+
+        const Uint16 FLOW_UNREACHABLE = 0xFFFF;
+
+        // bfs distance in tiles from every tile to the target tile, next points one step closer
+        struct Flow_Field
+        {
+            glm::ivec2 target_tile = glm::ivec2(-1, -1);
+            glm::vec2 target_position = glm::vec2(0.0f, 0.0f);
+            int map_version = -1;
+            // indexed like get_tile_slot
+            std::vector<Uint16> distance;
+            std::vector<Sint8> next; // direction index, -1 at the target or when unreachable
+            std::vector<glm::ivec2> queue;
+        };
+
+        const Uint64 SIMULATION_STEP_NS = SDL_NS_PER_SECOND / 60;
+        const Uint64 SIMULATION_MAX_FRAME_NS = SDL_NS_PER_SECOND / 4; // longer stalls are dropped instead of replayed as a burst of steps
+
+        struct Simulation_Clock
+        {
+            Uint64 last_ticks = 0;
+            Uint64 accumulator = 0;
+            double time_scale = 1.0;
+            float alpha = 0.0f; // how far rendering is between the previous and the current simulation step
+            Uint64 step_count = 0;
+        };
+
+        const int BEHAVIOR_WHEEL_SIZE = 256; // one slot per simulation step, longer waits go around the wheel
+        const float BEHAVIOR_MAX_PLAYER_RANGE = 32.0f; // bounds the spatial query that wakes player range waits
+
+        struct Behavior_State
+        {
+            std::coroutine_handle<deep::Behavior::promise_type> handle;
+            deep::Behavior_Wait_Kind wait = deep::Behavior_Running;
+            Uint32 wait_id = 0; // bumped on every suspend so stale wheel entries are skipped
+            float range = 0.0f;
+            glm::vec2 target = glm::vec2(0.0f, 0.0f);
+            glm::vec2 velocity = glm::vec2(0.0f, 0.0f); // desired velocity while moving to a tile
+            Uint64 deadline = 0; // tick a move gives up on, in case it is blocked
+        };
+
+        struct Behavior_Wait_Entry
+        {
+            Uint32 slot;
+            Uint32 wait_id;
+            Uint32 rounds; // wheel turns left for timers
+        };
+
+        struct Behavior_Scheduler
+        {
+            std::vector<Behavior_State> states; // indexed by entity slot
+            std::vector<Behavior_Wait_Entry> wheel[BEHAVIOR_WHEEL_SIZE];
+            std::vector<Behavior_Wait_Entry> expiring;
+            std::vector<Behavior_Wait_Entry> moving;
+            std::vector<Uint32> resumable;
+            int range_wait_count = 0;
+            Uint64 tick = 0;
+            float step_time = 1.0f / 60.0f;
+            deep::Steering_Players players{};
+        };
+
+        const Uint32 REPLAY_MAGIC = 0x50525044; // "DPRP"
+        const Uint32 REPLAY_VERSION = 1;
+
+        // header is magic, version, seed and step length, then runs of a repeat count and one input frame
+        struct Replay
+        {
+            SDL_IOStream* stream = nullptr;
+            bool recording = false;
+            bool replaying = false;
+            deep::Input_Frame frame{}; // the current run
+            Uint32 run_length = 0;
+            Uint64 step_count = 0;
+        };
+
+        const Uint32 SNAPSHOT_MAGIC = 0x504E5344; // "DSNP"
+        const Uint32 SNAPSHOT_VERSION = 3;
+
+        const float AI_NEAR_DISTANCE = 16.0f; // a little past enemy sight so chases start on the first frame they see a player
+        const float AI_MID_DISTANCE = 32.0f;
+        const int AI_MID_SLICES = 4;
+
+        struct AI_Scheduler
+        {
+            Uint64 frame = 0;
+            // near and mid enemies, everything else sleeps and is never touched
+            std::vector<deep::Entity> awake;
+            std::vector<deep::Entity> previous_awake;
+            // enemies to steer this frame with their accumulated time
+            std::vector<deep::Entity> scheduled;
+
+            // tile bounds of every room, indexed by room id
+            std::vector<glm::ivec4> room_bounds;
+            int map_version = -1;
+        };
+
+        const int PROFILE_MAX_SCOPES = 64;
+        const int PROFILE_MAX_THREADS = JOB_MAX_WORKERS + 4; // workers, main, audio and spare
+        const int PROFILE_HISTORY = 240; // frames
+
+        // only its own thread adds, end_profile_frame drains it
+        struct alignas(64) Profile_Thread
+        {
+            std::atomic<Uint64> ns[PROFILE_MAX_SCOPES];
+            std::atomic<Uint32> calls[PROFILE_MAX_SCOPES];
+        };
+
+        struct Profiler
+        {
+            Profile_Thread threads[PROFILE_MAX_THREADS];
+            std::atomic<int> thread_count{0};
+            const char* names[PROFILE_MAX_SCOPES];
+            std::atomic<int> scope_count{0};
+            SDL_SpinLock lock = 0;
+
+            // per frame, summed over every thread
+            float scope_ms[PROFILE_MAX_SCOPES][PROFILE_HISTORY];
+            Uint32 scope_calls[PROFILE_MAX_SCOPES];
+            float frame_ms[PROFILE_HISTORY];
+            int frame = 0; // next history slot
+            int frames_recorded = 0;
+            Uint64 last_frame_ns = 0;
         };
     #pragma endregion Data
 
     #pragma region Globals
         Render_Context render_context{};
-        Entities entities{};
+        Job_System job_system{};
+        thread_local int job_worker_index = -1;
+        Profiler profiler{};
+        thread_local int profile_thread = -1;
+        Entity_Store entity_store{};
+        deep::Steering_Batch steering_batch{};
+        Mesh_Assets mesh_assets{};
+        Asset_Streamer asset_streamer{};
         Sound_System sound_system{};
         Camera cameras[2];
         Map map{};
+        Flow_Field flow_fields[2];
+        Collision_Grid collision_grid{};
+        Line_Of_Sight line_of_sight{};
+        Map_Bake map_bake{};
+        Chunk_Streamer chunk_streamer{};
+        AI_Scheduler ai_scheduler{};
+        Simulation_Clock simulation_clock{};
+        Behavior_Scheduler behavior_scheduler{};
+        Replay replay{};
         bool steam_init = false;
         float window_size_w = 0.0f;
         float window_size_h = 0.0f;
 
     #pragma endregion Globals
 
-    #pragma region Assets
-        SDL_Surface* load_image(const char* image_filename, int desired_channels)
+    #pragma region Jobs
+        bool push_job(Job_Deque& deque, const Job& job)
         {
-            char full_path[256];
-            SDL_Surface *result;
-            SDL_PixelFormat format;
-
-            SDL_snprintf(full_path, sizeof(full_path), "ressources/images/%s", image_filename);
-
-            result = SDL_LoadBMP(full_path);
-            if (result == NULL)
+            Sint64 bottom = deque.bottom.load(std::memory_order_relaxed);
+            Sint64 top = deque.top.load(std::memory_order_acquire);
+            if(bottom - top >= JOB_DEQUE_SIZE)
             {
-                SDL_Log("Failed to load BMP: %s", SDL_GetError());
-                return NULL;
+                return false;
             }
+            deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)] = job;
+            std::atomic_thread_fence(std::memory_order_release);
+            deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+            return true;
+        }
 
-            if (desired_channels == 4)
+        bool pop_job(Job_Deque& deque, Job& job)
+        {
+            Sint64 bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+            deque.bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Sint64 top = deque.top.load(std::memory_order_relaxed);
+            if(top > bottom)
             {
-                format = SDL_PIXELFORMAT_ABGR8888;
+                deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+                return false;
             }
-            else
+            job = deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)];
+            if(top == bottom)
             {
-                SDL_assert(!"Unexpected desired_channels");
-                SDL_DestroySurface(result);
-                return NULL;
+                // last job, race the thieves for it
+                bool won = deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+                return won;
             }
-            if (result->format != format)
+            return true;
+        }
+
+        bool steal_job(Job_Deque& deque, Job& job)
+        {
+            Sint64 top = deque.top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Sint64 bottom = deque.bottom.load(std::memory_order_acquire);
+            if(top >= bottom)
             {
-                SDL_Surface *next = SDL_ConvertSurface(result, format);
-                SDL_DestroySurface(result);
-                result = next;
+                return false;
             }
-
-            return result;
+            // the copy is only kept if nobody else took the slot in the meantime
+            job = deque.jobs[top & (JOB_DEQUE_SIZE - 1)];
+            return deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
         }
-    #pragma endregion Assets
 
-    #pragma region Camera
-        void camera_update_vectors(int id)
+        bool push_background_job(const Job& job)
         {
-            glm::vec3 front;
-            front.x = cos(glm::radians(cameras[id].yaw)) * cos(glm::radians(cameras[id].pitch));
-            front.y = sin(glm::radians(cameras[id].pitch));
-            front.z = sin(glm::radians(cameras[id].yaw)) * cos(glm::radians(cameras[id].pitch));
-            cameras[id].front = glm::normalize(front);
-            
-            cameras[id].right = glm::normalize(glm::cross(cameras[id].front, cameras[id].world_up));
-            cameras[id].up    = glm::normalize(glm::cross(cameras[id].right, cameras[id].front));
+            Job_Queue& queue = job_system.background_queue;
+            SDL_LockSpinlock(&queue.lock);
+            bool pushed = queue.count < JOB_BACKGROUND_QUEUE_SIZE;
+            if(pushed)
+            {
+                queue.jobs[(queue.head + queue.count) % JOB_BACKGROUND_QUEUE_SIZE] = job;
+                queue.count += 1;
+            }
+            SDL_UnlockSpinlock(&queue.lock);
+            return pushed;
         }
 
-        void camera_init(int id, glm::vec3 position)
+        bool pop_background_job(Job& job)
         {
-            cameras[id].position = position;
-            cameras[id].world_up = glm::vec3(0.0f, 1.0f, 0.0f);
-            cameras[id].yaw = -90.0f;
-            cameras[id].pitch = 0.0f;
-            camera_update_vectors(id);
-
-            cameras[id].movement_speed = 2.5f;
-            cameras[id].mouse_sensitivity = 0.1f;
+            Job_Queue& queue = job_system.background_queue;
+            SDL_LockSpinlock(&queue.lock);
+            bool popped = queue.count > 0;
+            if(popped)
+            {
+                job = queue.jobs[queue.head];
+                queue.head = (queue.head + 1) % JOB_BACKGROUND_QUEUE_SIZE;
+                queue.count -= 1;
+            }
+            SDL_UnlockSpinlock(&queue.lock);
+            return popped;
+        }
 
-            float size_w = window_size_w;
-            float size_h = window_size_h;
-            if(deep::use_both_monitors)
+        // frame work first, background jobs only on workers
+        bool find_job(Job& job)
+        {
+            int own = job_worker_index;
+            if(pop_job(job_system.deques[own], job))
             {
-                size_w = size_w / 2;
+                return true;
+            }
+            int deque_count = job_system.worker_count + 1;
+            for(int i = 1; i < deque_count; ++i)
+            {
+                if(steal_job(job_system.deques[(own + i) % deque_count], job))
+                {
+                    return true;
+                }
             }
+            return own > 0 && pop_background_job(job);
+        }
 
-            cameras[id].projection = glm::perspective(glm::radians(45.0f), size_w / size_h, 0.1f, 100.0f);
+        void enqueue_job(const Job& job);
+
+        void finish_job(Job_Counter* counter)
+        {
+            if(counter == nullptr)
+            {
+                return;
+            }
+            Job continuations[JOB_MAX_CONTINUATIONS];
+            int continuation_count = 0;
+
+            // decrement under the lock so a waiter can't free the counter while we still touch it
+            SDL_LockSpinlock(&counter->lock);
+            if(SDL_AtomicDecRef(&counter->pending))
+            {
+                continuation_count = counter->continuation_count;
+                SDL_memcpy(continuations, counter->continuations, continuation_count * sizeof(Job));
+                counter->continuation_count = 0;
+            }
+            SDL_UnlockSpinlock(&counter->lock);
+
+            for(int i = 0; i < continuation_count; ++i)
+            {
+                enqueue_job(continuations[i]);
+            }
         }
 
-        glm::vec2 camera_get_position_2d(int id)
+        void run_job(const Job& job)
         {
-            return glm::vec2(cameras[id].position.x, cameras[id].position.z);
+            job.function(job.data, job.begin, job.end);
+            finish_job(job.counter);
         }
 
-        void camera_set_position(int id, glm::vec3 position)
+        // the job is already counted on its counter
+        void enqueue_job(const Job& job)
         {
-            cameras[id].position = position;
+            // threads without a deque, or a full deque, just run the job
+            if(job_worker_index < 0 || job_system.worker_count == 0 || !push_job(job_system.deques[job_worker_index], job))
+            {
+                run_job(job);
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(SDL_GetAtomicInt(&job_system.sleeping) > 0)
+            {
+                SDL_SignalSemaphore(job_system.wake);
+            }
         }
 
-        glm::mat4 camera_get_view_matrix(int id)
+        void submit_job(Job_Function function, void* data, int begin, int end, Job_Counter* counter)
         {
-            return glm::lookAt(cameras[id].position, cameras[id].position + cameras[id].front, cameras[id].up);
+            if(counter)
+            {
+                SDL_AtomicIncRef(&counter->pending);
+            }
+            enqueue_job(Job{ function, data, begin, end, counter });
         }
 
-        bool is_position_blocked(glm::vec3 current_position, glm::vec3 next_position, float radius);
-        void camera_process_keyboard(int id, bool forward, bool back, bool left, bool right, bool up, bool down, float delta_time)
+        // for jobs that take long enough to hitch a frame, the main thread never runs them unless there are no workers
+        void submit_background_job(Job_Function function, void* data, int begin, int end, Job_Counter* counter)
         {
-            if(forward || back || left || right || up || down)
+            if(counter)
             {
-                glm::vec3 movement = glm::vec3(0.0f, 0.0f, 0.0f);
-                if(forward || back || left || right)
+                SDL_AtomicIncRef(&counter->pending);
+            }
+            Job job{ function, data, begin, end, counter };
+            if(job_system.worker_count == 0 || !push_background_job(job))
+            {
+                run_job(job);
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(SDL_GetAtomicInt(&job_system.sleeping) > 0)
+            {
+                SDL_SignalSemaphore(job_system.wake);
+            }
+        }
+
+        // runs other jobs while waiting instead of blocking the thread
+        void wait_for_counter(Job_Counter* counter)
+        {
+            while(SDL_GetAtomicInt(&counter->pending) > 0)
+            {
+                Job job;
+                if(job_worker_index >= 0 && find_job(job))
                 {
-                    if(forward) { movement += cameras[id].front; }
-                    if(back) { movement -= cameras[id].front; }
-                    if(left) { movement -= cameras[id].right; }
-                    if(right) { movement += cameras[id].right; }
-                    movement.y = 0.0f;
-                    if (glm::length(movement) > 0.0001f) {
-                        movement = glm::normalize(movement);
-                    }
+                    run_job(job);
                 }
-
-                if(up) { movement.y += 1.0f; }
-                if(down) { movement.y -= 1.0f; }
-                if (glm::length(movement) > 0.0001 && !(forward || back || left || right)) {
-                    movement = glm::normalize(movement);
+                else
+                {
+                    SDL_CPUPauseInstruction();
                 }
+            }
+            // the last finish_job may still hold the lock
+            SDL_LockSpinlock(&counter->lock);
+            SDL_UnlockSpinlock(&counter->lock);
+        }
 
-                float velocity = cameras[id].movement_speed * delta_time;
-                glm::vec3 desired_position_change = movement * velocity;
+        // starts the job once every job counted on dependency is done
+        void submit_job_after(Job_Counter* dependency, Job_Function function, void* data, int begin, int end, Job_Counter* counter)
+        {
+            if(counter)
+            {
+                SDL_AtomicIncRef(&counter->pending);
+            }
+            Job job{ function, data, begin, end, counter };
 
-                float camera_collision_radius = 0.3f;
+            bool deferred = false;
+            SDL_LockSpinlock(&dependency->lock);
+            if(SDL_GetAtomicInt(&dependency->pending) > 0 && dependency->continuation_count < JOB_MAX_CONTINUATIONS)
+            {
+                dependency->continuations[dependency->continuation_count] = job;
+                dependency->continuation_count += 1;
+                deferred = true;
+            }
+            SDL_UnlockSpinlock(&dependency->lock);
+            if(deferred)
+            {
+                return;
+            }
 
-                glm::vec3 original_position = cameras[id].position;
-                glm::vec3 temp_position = cameras[id].position;
+            wait_for_counter(dependency);
+            enqueue_job(job);
+        }
 
-                temp_position.x = original_position.x + desired_position_change.x;
-                if (!is_position_blocked(cameras[id].position, temp_position, camera_collision_radius))
-                {
-                    cameras[id].position.x = temp_position.x;
-                }
-                else
+        int job_worker_thread(void* data)
+        {
+            job_worker_index = static_cast<int>(reinterpret_cast<intptr_t>(data));
+            while(!SDL_GetAtomicInt(&job_system.quit))
+            {
+                Job job;
+                if(find_job(job))
                 {
-                    temp_position.x = original_position.x;
+                    run_job(job);
+                    continue;
                 }
 
-                temp_position.z = original_position.z + desired_position_change.z;
-                if (!is_position_blocked(cameras[id].position, glm::vec3(cameras[id].position.x, temp_position.y, temp_position.z), camera_collision_radius))
-                {
-                    cameras[id].position.z = temp_position.z;
-                }
-                else
+                // look once more after announcing the sleep so a job pushed in between isn't missed
+                SDL_AtomicIncRef(&job_system.sleeping);
+                if(find_job(job))
                 {
-                    temp_position.z = original_position.z;
+                    SDL_AddAtomicInt(&job_system.sleeping, -1);
+                    run_job(job);
+                    continue;
                 }
-
-                cameras[id].position.y += desired_position_change.y;
+                SDL_WaitSemaphore(job_system.wake);
+                SDL_AddAtomicInt(&job_system.sleeping, -1);
             }
+            return 0;
         }
 
-        void camera_process_mouse_movement(int id, float x_offset, float y_offset, bool constrain_pitch)
+        void start_job_system()
         {
-            x_offset *= cameras[id].mouse_sensitivity;
-            y_offset *= cameras[id].mouse_sensitivity;
-
-            cameras[id].yaw   += x_offset;
-            cameras[id].pitch += y_offset;
+            job_worker_index = 0;
+            job_system.wake = SDL_CreateSemaphore(0);
+            SDL_SetAtomicInt(&job_system.quit, 0);
+            job_system.worker_count = SDL_clamp(SDL_GetNumLogicalCPUCores() - 1, 0, JOB_MAX_WORKERS - 1);
+            for(int i = 1; i <= job_system.worker_count; ++i)
+            {
+                job_system.threads[i] = SDL_CreateThread(job_worker_thread, "deep_worker", reinterpret_cast<void*>(static_cast<intptr_t>(i)));
+            }
+            SDL_Log("Job system started with %d workers", job_system.worker_count);
+        }
 
-            if (constrain_pitch)
+        void stop_job_system()
+        {
+            wait_for_counter(&job_system.frame_counter);
+            wait_for_counter(&job_system.background_counter);
+            SDL_SetAtomicInt(&job_system.quit, 1);
+            for(int i = 1; i <= job_system.worker_count; ++i)
             {
-                if (cameras[id].pitch > 89.0f)
-                    cameras[id].pitch = 89.0f;
-                if (cameras[id].pitch < -89.0f)
-                    cameras[id].pitch = -89.0f;
+                SDL_SignalSemaphore(job_system.wake);
+            }
+            for(int i = 1; i <= job_system.worker_count; ++i)
+            {
+                SDL_WaitThread(job_system.threads[i], NULL);
             }
+            job_system.worker_count = 0;
+            SDL_DestroySemaphore(job_system.wake);
+        }
 
-            camera_update_vectors(id);
-        } 
-    #pragma endregion Camera
+        // fn(begin, end) over [0, count) in chunks of grain, returns when every chunk is done
+        template<typename F>
+        void parallel_for(int count, int grain, F fn)
+        {
+            if(count <= 0)
+            {
+                return;
+            }
+            if(count <= grain || job_system.worker_count == 0 || job_worker_index < 0)
+            {
+                fn(0, count);
+                return;
+            }
+            Job_Counter counter{};
+            Job_Function trampoline = [](void* data, int begin, int end) { (*static_cast<F*>(data))(begin, end); };
+            for(int begin = 0; begin < count; begin += grain)
+            {
+                submit_job(trampoline, &fn, begin, SDL_min(begin + grain, count), &counter);
+            }
+            wait_for_counter(&counter);
+        }
+    #pragma endregion Jobs
 
-    #pragma region Renderer
-        void create_window()
+    #pragma region Profiler
+        // called once per scope from a function local static, ids past PROFILE_MAX_SCOPES are -1 and never record
+        int register_profile_scope(const char* name)
         {
-            // create a window
-            window_size_w = 640.0f;
-            window_size_h = 480.0f;
-            if(deep::use_both_monitors)
+            SDL_LockSpinlock(&profiler.lock);
+            int id = profiler.scope_count.load(std::memory_order_relaxed);
+            if(id < PROFILE_MAX_SCOPES)
             {
-                window_size_w = 1920*2;
-                window_size_h = 1080;
-                render_context.window = SDL_CreateWindow("Deep", window_size_w, window_size_h, SDL_WINDOW_RESIZABLE);
-                SDL_SetWindowPosition(render_context.window, 0, 0);
+                profiler.names[id] = name;
+                profiler.scope_count.store(id + 1, std::memory_order_release);
             }
             else
             {
-                render_context.window = SDL_CreateWindow("Deep", window_size_w, window_size_h, SDL_WINDOW_RESIZABLE);
+                id = -1;
             }
-            
-            
-            // create the device
-            render_context.device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV, true, NULL);
-            SDL_ClaimWindowForGPUDevice(render_context.device, render_context.window);
+            SDL_UnlockSpinlock(&profiler.lock);
+            return id;
         }
 
-        void create_render_pipeline()
+        void record_profile_scope(int id, Uint64 ns)
         {
-        // load the vertex shader code
-            size_t vertex_code_size; 
-            void* vertex_code = SDL_LoadFile("shaders/vertex.spv", &vertex_code_size);
-
-            // create the vertex shader
-            SDL_GPUShaderCreateInfo vertex_info{};
-            vertex_info.code = (Uint8*)vertex_code;
-            vertex_info.code_size = vertex_code_size;
-            vertex_info.entrypoint = "main";
-            vertex_info.format = SDL_GPU_SHADERFORMAT_SPIRV;
-            vertex_info.stage = SDL_GPU_SHADERSTAGE_VERTEX;
-            vertex_info.num_samplers = 0;
-            vertex_info.num_storage_buffers = 0;
-            vertex_info.num_storage_textures = 0;
-            vertex_info.num_uniform_buffers = 1;
+            if(profile_thread < 0)
+            {
+                profile_thread = profiler.thread_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            if(profile_thread >= PROFILE_MAX_THREADS)
+            {
+                return;
+            }
+            Profile_Thread& thread = profiler.threads[profile_thread];
+            thread.ns[id].fetch_add(ns, std::memory_order_relaxed);
+            thread.calls[id].fetch_add(1, std::memory_order_relaxed);
+        }
 
-            SDL_GPUShader* vertex_shader = SDL_CreateGPUShader(render_context.device, &vertex_info);
+        struct Profile_Scope
+        {
+            int id;
+            Uint64 start;
 
-            // free the file
-            SDL_free(vertex_code);
+            Profile_Scope(int scope_id) : id(deep::profiling.load(std::memory_order_relaxed) ? scope_id : -1), start(id >= 0 ? SDL_GetTicksNS() : 0) {}
+            ~Profile_Scope()
+            {
+                if(id >= 0)
+                {
+                    record_profile_scope(id, SDL_GetTicksNS() - start);
+                }
+            }
+        };
 
-            // load the fragment shader code
-            size_t fragment_code_size; 
-            void* fragment_code = SDL_LoadFile("shaders/fragment.spv", &fragment_code_size);
+#if DEEP_PROFILE
+#define DEEP_PROFILE_CONCAT_INNER(a, b) a##b
+#define DEEP_PROFILE_CONCAT(a, b) DEEP_PROFILE_CONCAT_INNER(a, b)
+#define DEEP_PROFILE_SCOPE(name) \
+    static const int DEEP_PROFILE_CONCAT(profile_id_, __LINE__) = deepcore::register_profile_scope(name); \
+    deepcore::Profile_Scope DEEP_PROFILE_CONCAT(profile_scope_, __LINE__)(DEEP_PROFILE_CONCAT(profile_id_, __LINE__))
+#else
+#define DEEP_PROFILE_SCOPE(name)
+#endif
+
+#if DEEP_PROFILE
+        // moves what every thread recorded since the last call into the history, one call per rendered frame
+        void end_profile_frame()
+        {
+            Uint64 now = SDL_GetTicksNS();
+            Uint64 previous = profiler.last_frame_ns;
+            profiler.last_frame_ns = now;
+            if(!deep::profiling.load(std::memory_order_relaxed) || previous == 0)
+            {
+                return;
+            }
+            int slot = profiler.frame;
+            profiler.frame_ms[slot] = (now - previous) / 1000000.0f;
+            int thread_count = SDL_min(profiler.thread_count.load(std::memory_order_relaxed), PROFILE_MAX_THREADS);
+            int scope_count = profiler.scope_count.load(std::memory_order_acquire);
+            for(int scope = 0; scope < scope_count; ++scope)
+            {
+                Uint64 ns = 0;
+                Uint32 calls = 0;
+                for(int thread = 0; thread < thread_count; ++thread)
+                {
+                    ns += profiler.threads[thread].ns[scope].exchange(0, std::memory_order_relaxed);
+                    calls += profiler.threads[thread].calls[scope].exchange(0, std::memory_order_relaxed);
+                }
+                profiler.scope_ms[scope][slot] = ns / 1000000.0f;
+                profiler.scope_calls[scope] = calls;
+            }
+            profiler.frame = (slot + 1) % PROFILE_HISTORY;
+            profiler.frames_recorded = SDL_min(profiler.frames_recorded + 1, PROFILE_HISTORY);
+        }
 
-            // create the fragment shader
-            SDL_GPUShaderCreateInfo fragment_info{};
-            fragment_info.code = (Uint8*)fragment_code;
-            fragment_info.code_size = fragment_code_size;
-            fragment_info.entrypoint = "main";
-            fragment_info.format = SDL_GPU_SHADERFORMAT_SPIRV;
-            fragment_info.stage = SDL_GPU_SHADERSTAGE_FRAGMENT;
-            fragment_info.num_samplers = 3;
-            fragment_info.num_storage_buffers = 0;
-            fragment_info.num_storage_textures = 0;
-            fragment_info.num_uniform_buffers = 1;
+        struct Profile_Stats
+        {
+            float min;
+            float average;
+            float p99;
+        };
 
-            SDL_GPUShader* fragment_shader = SDL_CreateGPUShader(render_context.device, &fragment_info);
+        int compare_floats(const void* a, const void* b)
+        {
+            float x = *static_cast<const float*>(a);
+            float y = *static_cast<const float*>(b);
+            return (x > y) - (x < y);
+        }
 
-            // free the file
-            SDL_free(fragment_code);
+        Profile_Stats get_profile_stats(const float* history, int count)
+        {
+            float sorted[PROFILE_HISTORY];
+            SDL_memcpy(sorted, history, count * sizeof(float));
+            SDL_qsort(sorted, count, sizeof(float), compare_floats);
+            float total = 0.0f;
+            for(int i = 0; i < count; ++i)
+            {
+                total += sorted[i];
+            }
+            int p99 = SDL_max((count * 99 + 99) / 100 - 1, 0);
+            return { sorted[0], total / count, sorted[p99] };
+        }
 
-            // create the graphics pipeline
-            SDL_GPUGraphicsPipelineCreateInfo pipeline_info{};
-            pipeline_info.vertex_shader = vertex_shader;
-            pipeline_info.fragment_shader = fragment_shader;
-            pipeline_info.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST;
+        // frame time graph and one row per scope, times are per frame summed over threads so jobs can add up past the frame
+        void draw_profiler()
+        {
+            int count = profiler.frames_recorded;
+            int offset = count == PROFILE_HISTORY ? profiler.frame : 0;
+            ImGui::Begin("Profiler");
+            if(count == 0)
+            {
+                ImGui::Text("Collecting...");
+                ImGui::End();
+                return;
+            }
+            Profile_Stats frame = get_profile_stats(profiler.frame_ms, count);
+            char overlay[64];
+            SDL_snprintf(overlay, sizeof(overlay), "frame min %.2f avg %.2f p99 %.2f ms", frame.min, frame.average, frame.p99);
+            ImGui::PlotLines("##frame", profiler.frame_ms, count, offset, overlay, 0.0f, frame.p99 * 1.5f, ImVec2(0.0f, 80.0f));
 
-            // describe the vertex buffers
-            SDL_GPUVertexBufferDescription vertex_buffer_description[1];
-            vertex_buffer_description[0].slot = 0;
-            vertex_buffer_description[0].input_rate = SDL_GPU_VERTEXINPUTRATE_VERTEX;
-            vertex_buffer_description[0].instance_step_rate = 0;
-            vertex_buffer_description[0].pitch = sizeof(Vertex);
+            if(ImGui::BeginTable("scopes", 6))
+            {
+                ImGui::TableSetupColumn("scope");
+                ImGui::TableSetupColumn("calls");
+                ImGui::TableSetupColumn("min ms");
+                ImGui::TableSetupColumn("avg ms");
+                ImGui::TableSetupColumn("p99 ms");
+                ImGui::TableSetupColumn("history");
+                ImGui::TableHeadersRow();
+                int scope_count = profiler.scope_count.load(std::memory_order_acquire);
+                for(int scope = 0; scope < scope_count; ++scope)
+                {
+                    Profile_Stats stats = get_profile_stats(profiler.scope_ms[scope], count);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", profiler.names[scope]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", profiler.scope_calls[scope]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", stats.min);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", stats.average);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", stats.p99);
+                    ImGui::TableNextColumn();
+                    ImGui::PushID(scope);
+                    ImGui::PlotLines("##history", profiler.scope_ms[scope], count, offset, nullptr, 0.0f, frame.p99, ImVec2(120.0f, 16.0f));
+                    ImGui::PopID();
+                }
+                ImGui::EndTable();
+            }
+            ImGui::End();
+        }
+#endif
+    #pragma endregion Profiler
 
-            pipeline_info.vertex_input_state.num_vertex_buffers = 1;
-            pipeline_info.vertex_input_state.vertex_buffer_descriptions = vertex_buffer_description;
+    #pragma region Tiles
+        void init_tile_map(deep::Tile_Map& tiles, int size_x, int size_y)
+        {
+            tiles.size_x = SDL_max(size_x, 0);
+            tiles.size_y = SDL_max(size_y, 0);
+            tiles.chunks_x = (tiles.size_x + deep::MAP_CHUNK_SIZE - 1) >> deep::MAP_CHUNK_SHIFT;
+            tiles.chunks_y = (tiles.size_y + deep::MAP_CHUNK_SIZE - 1) >> deep::MAP_CHUNK_SHIFT;
+            tiles.chunk_index.assign(tiles.chunks_x * tiles.chunks_y, -1);
+            tiles.chunks.clear();
+        }
 
-            // describe the vertex attribute
-            SDL_GPUVertexAttribute vertex_attributes[3];
+        inline bool is_inside_tile_map(const deep::Tile_Map& tiles, int x, int z)
+        {
+            return x >= 0 && x < tiles.size_x && z >= 0 && z < tiles.size_y;
+        }
 
-            // a_position
-            vertex_attributes[0].buffer_slot = 0;
-            vertex_attributes[0].location = 0;
-            vertex_attributes[0].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3;
-            vertex_attributes[0].offset = 0;
+        // index of the tile in per tile arrays sized chunks.size() * MAP_CHUNK_TILES, -1 outside of the occupied chunks
+        inline int get_tile_slot(const deep::Tile_Map& tiles, int x, int z)
+        {
+            if(!is_inside_tile_map(tiles, x, z))
+            {
+                return -1;
+            }
+            Sint32 chunk = tiles.chunk_index[(z >> deep::MAP_CHUNK_SHIFT) * tiles.chunks_x + (x >> deep::MAP_CHUNK_SHIFT)];
+            if(chunk < 0)
+            {
+                return -1;
+            }
+            return chunk * MAP_CHUNK_TILES + (z & (deep::MAP_CHUNK_SIZE - 1)) * deep::MAP_CHUNK_SIZE + (x & (deep::MAP_CHUNK_SIZE - 1));
+        }
 
-            // a_texcoord
-            vertex_attributes[1].buffer_slot = 0;
-            vertex_attributes[1].location = 1;
-            vertex_attributes[1].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2;
-            vertex_attributes[1].offset = sizeof(float) * 3;
+        // tile of a slot, with the chunk it is in and its position on the map
+        inline int get_slot_tile(const deep::Tile_Map& tiles, int slot, glm::ivec2& position)
+        {
+            const deep::Map_Chunk& chunk = tiles.chunks[slot / MAP_CHUNK_TILES];
+            int local_x = slot & (deep::MAP_CHUNK_SIZE - 1);
+            int local_z = (slot % MAP_CHUNK_TILES) >> deep::MAP_CHUNK_SHIFT;
+            position = chunk.origin + glm::ivec2(local_x, local_z);
+            return chunk.tiles[local_z][local_x];
+        }
 
-            // a_normal
-            vertex_attributes[2].buffer_slot = 0;
-            vertex_attributes[2].location = 2;
-            vertex_attributes[2].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3;
-            vertex_attributes[2].offset = sizeof(float) * 5;
+        inline int get_tile(const deep::Tile_Map& tiles, int x, int z)
+        {
+            int slot = get_tile_slot(tiles, x, z);
+            return slot < 0 ? 0 : tiles.chunks[slot / MAP_CHUNK_TILES].tiles[z & (deep::MAP_CHUNK_SIZE - 1)][x & (deep::MAP_CHUNK_SIZE - 1)];
+        }
 
-            pipeline_info.vertex_input_state.num_vertex_attributes = 3;
-            pipeline_info.vertex_input_state.vertex_attributes = vertex_attributes;
+        inline int get_tile_room(const deep::Tile_Map& tiles, int x, int z)
+        {
+            int slot = get_tile_slot(tiles, x, z);
+            return slot < 0 ? 0 : tiles.chunks[slot / MAP_CHUNK_TILES].rooms[z & (deep::MAP_CHUNK_SIZE - 1)][x & (deep::MAP_CHUNK_SIZE - 1)];
+        }
 
-            // describe the color target
-            SDL_GPUColorTargetDescription color_target_description[1];
-            color_target_description[0] = {};
-            color_target_description[0].blend_state.enable_blend = true;
-            color_target_description[0].blend_state.color_blend_op = SDL_GPU_BLENDOP_ADD;
-            color_target_description[0].blend_state.alpha_blend_op = SDL_GPU_BLENDOP_ADD;
-            color_target_description[0].blend_state.src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
-            color_target_description[0].blend_state.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
-            color_target_description[0].blend_state.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
-            color_target_description[0].blend_state.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
-            color_target_description[0].format = SDL_GetGPUSwapchainTextureFormat(render_context.device, render_context.window);
-
-            pipeline_info.target_info.num_color_targets = 1;
-            pipeline_info.target_info.color_target_descriptions = color_target_description;
-
-            // Cull Mode
-            pipeline_info.rasterizer_state.cull_mode = SDL_GPU_CULLMODE_BACK;
-            //pipeline_info.rasterizer_state.front_face = SDL_GPU_FRONTFACE_CLOCKWISE;
+        // allocates the chunk on the first write, nullptr outside of the map
+        deep::Map_Chunk* get_tile_chunk(deep::Tile_Map& tiles, int x, int z)
+        {
+            if(!is_inside_tile_map(tiles, x, z))
+            {
+                return nullptr;
+            }
+            Sint32& chunk = tiles.chunk_index[(z >> deep::MAP_CHUNK_SHIFT) * tiles.chunks_x + (x >> deep::MAP_CHUNK_SHIFT)];
+            if(chunk < 0)
+            {
+                chunk = static_cast<Sint32>(tiles.chunks.size());
+                tiles.chunks.emplace_back();
+                tiles.chunks.back().origin = glm::ivec2(x & ~(deep::MAP_CHUNK_SIZE - 1), z & ~(deep::MAP_CHUNK_SIZE - 1));
+            }
+            return &tiles.chunks[chunk];
+        }
 
-            // Depth Testing
-            pipeline_info.depth_stencil_state.enable_depth_test = true;
-            pipeline_info.depth_stencil_state.enable_depth_write = true;
-            pipeline_info.depth_stencil_state.compare_op = SDL_GPUCompareOp::SDL_GPU_COMPAREOP_LESS;
-            pipeline_info.target_info.has_depth_stencil_target = true;
-            pipeline_info.target_info.depth_stencil_format = SDL_GPU_TEXTUREFORMAT_D24_UNORM;
+        bool set_tile(deep::Tile_Map& tiles, int x, int z, int tile)
+        {
+            if(tile < 0 || tile > 0xFF || (tile == 0 && get_tile_slot(tiles, x, z) < 0))
+            {
+                return false;
+            }
+            deep::Map_Chunk* chunk = get_tile_chunk(tiles, x, z);
+            if(chunk == nullptr)
+            {
+                return false;
+            }
+            chunk->tiles[z & (deep::MAP_CHUNK_SIZE - 1)][x & (deep::MAP_CHUNK_SIZE - 1)] = static_cast<Uint8>(tile);
+            return true;
+        }
 
-            // create the pipeline
-            render_context.graphics_pipeline = SDL_CreateGPUGraphicsPipeline(render_context.device, &pipeline_info);
+        bool set_tile_room(deep::Tile_Map& tiles, int x, int z, int room)
+        {
+            if(room < 0 || room > 0xFFFF || (room == 0 && get_tile_slot(tiles, x, z) < 0))
+            {
+                return false;
+            }
+            deep::Map_Chunk* chunk = get_tile_chunk(tiles, x, z);
+            if(chunk == nullptr)
+            {
+                return false;
+            }
+            chunk->rooms[z & (deep::MAP_CHUNK_SIZE - 1)][x & (deep::MAP_CHUNK_SIZE - 1)] = static_cast<Uint16>(room);
+            return true;
+        }
+    #pragma endregion Tiles
 
-            // we don't need to store the shaders after creating the pipeline
-            SDL_ReleaseGPUShader(render_context.device, vertex_shader);
-            SDL_ReleaseGPUShader(render_context.device, fragment_shader);
+    #pragma region Entities
+        bool is_entity_alive(deep::Entity entity)
+        {
+            return entity.generation != 0 && entity.index < entity_store.generations.size() && entity_store.generations[entity.index] == entity.generation;
         }
 
-        void create_depth_buffer()
+        deep::Entity entity_from_slot(Uint32 slot)
         {
-            int scene_width, scene_height;
-            SDL_GetWindowSizeInPixels(render_context.window, &scene_width, &scene_height);
+            return deep::Entity{ slot, entity_store.generations[slot] };
+        }
 
-            SDL_GPUTextureCreateInfo texture_create_info{};
-            texture_create_info.type = SDL_GPU_TEXTURETYPE_2D;
-            texture_create_info.width = scene_width;
-            texture_create_info.height = scene_height;
-            texture_create_info.layer_count_or_depth = 1;
-            texture_create_info.num_levels = 1;
-            texture_create_info.sample_count = SDL_GPU_SAMPLECOUNT_1;
-            texture_create_info.format = SDL_GPU_TEXTUREFORMAT_D24_UNORM;
-            texture_create_info.usage = SDL_GPU_TEXTUREUSAGE_DEPTH_STENCIL_TARGET;
-            render_context.scene_depth_texture = SDL_CreateGPUTexture(render_context.device, &texture_create_info);
+        template<typename T>
+        bool has_component(const Component_Pool<T>& pool, Uint32 slot)
+        {
+            return slot < pool.sparse.size() && pool.sparse[slot] != NO_COMPONENT;
         }
 
-        void init_sound()
+        template<typename T>
+        T* get_component(Component_Pool<T>& pool, deep::Entity entity)
         {
-            sound_system.audio_device = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
-            if (sound_system.audio_device == 0) {
-                SDL_Log("Couldn't open audio device: %s", SDL_GetError());
+            if(!is_entity_alive(entity) || !has_component(pool, entity.index))
+            {
+                return nullptr;
             }
+            return &pool.data[pool.sparse[entity.index]];
         }
 
-        void setup_imgui()
+        // replaces the component if the entity already has one
+        template<typename T>
+        T* add_component(Component_Pool<T>& pool, deep::Entity entity, const T& value)
         {
-            float main_scale = SDL_GetDisplayContentScale(SDL_GetPrimaryDisplay());
-
-            // Setup Dear ImGui context
-            IMGUI_CHECKVERSION();
-            ImGui::CreateContext();
-            ImGuiIO& io = ImGui::GetIO(); (void)io;
-            //io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
-            //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
-
-            // Setup Dear ImGui style
-            ImGui::StyleColorsDark();
-            //ImGui::StyleColorsLight();
-
-            // Setup scaling
-            ImGuiStyle& style = ImGui::GetStyle();
-            style.ScaleAllSizes(main_scale);        // Bake a fixed style scale. (until we have a solution for dynamic style scaling, changing this requires resetting Style + calling this again)
-            style.FontScaleDpi = main_scale;        // Set initial font scale. (using io.ConfigDpiScaleFonts=true makes this unnecessary. We leave both here for documentation purpose)
+            if(!is_entity_alive(entity))
+            {
+                return nullptr;
+            }
+            if(has_component(pool, entity.index))
+            {
+                T* component = &pool.data[pool.sparse[entity.index]];
+                *component = value;
+                return component;
+            }
+            if(pool.sparse.size() <= entity.index)
+            {
+                pool.sparse.resize(entity_store.generations.size(), NO_COMPONENT);
+            }
+            pool.sparse[entity.index] = pool.data.size();
+            pool.data.push_back(value);
+            pool.owners.push_back(entity.index);
+            return &pool.data.back();
+        }
 
-            // Setup Platform/Renderer backends
-            ImGui_ImplSDL3_InitForSDLGPU(render_context.window);
-            ImGui_ImplSDLGPU3_InitInfo init_info = {};
-            init_info.Device = render_context.device;
-            init_info.ColorTargetFormat = SDL_GetGPUSwapchainTextureFormat(render_context.device, render_context.window);
-            init_info.MSAASamples = SDL_GPU_SAMPLECOUNT_1;
-            ImGui_ImplSDLGPU3_Init(&init_info);
+        // swaps the last component into the hole so the dense array stays packed
+        template<typename T>
+        void remove_component(Component_Pool<T>& pool, Uint32 slot)
+        {
+            if(!has_component(pool, slot))
+            {
+                return;
+            }
+            Uint32 dense = pool.sparse[slot];
+            Uint32 last = pool.data.size() - 1;
+            if(dense != last)
+            {
+                pool.data[dense] = pool.data[last];
+                pool.owners[dense] = pool.owners[last];
+                pool.sparse[pool.owners[dense]] = dense;
+            }
+            pool.data.pop_back();
+            pool.owners.pop_back();
+            pool.sparse[slot] = NO_COMPONENT;
+        }
 
-            // Start the Dear ImGui frame
-            ImGui_ImplSDLGPU3_NewFrame();
-            ImGui_ImplSDL3_NewFrame();
-            ImGui::NewFrame();
+        template<typename T>
+        void clear_components(Component_Pool<T>& pool)
+        {
+            pool.data.clear();
+            pool.owners.clear();
+            pool.sparse.assign(pool.sparse.size(), NO_COMPONENT);
         }
 
-        SDL_GPUTexture* load_texture(const char *filename)
+        // walks the dense array of the first pool and only visits entities that have all the other components too,
+        // pass the smallest pool first, the pools must not change size while iterating
+        template<typename F, typename First, typename... Rest>
+        void query(F fn, Component_Pool<First>& first, Component_Pool<Rest>&... rest)
         {
-            SDL_Surface *image_data = load_image(filename, 4);
-                if (image_data == NULL)
+            for(size_t i = 0; i < first.data.size(); ++i)
+            {
+                Uint32 slot = first.owners[i];
+                if((has_component(rest, slot) && ...))
                 {
-                    SDL_Log("Could not load image data!");
-                    // FIXME handle image not found
-                }          
-
-            SDL_GPUTextureCreateInfo texture_create_info{};
-            texture_create_info.type = SDL_GPU_TEXTURETYPE_2D;
-            texture_create_info.format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
-            texture_create_info.width = image_data->w;
-            texture_create_info.height = image_data->h;
-            texture_create_info.layer_count_or_depth = 1;
-            texture_create_info.num_levels = 1;
-            texture_create_info.usage = SDL_GPU_TEXTUREUSAGE_SAMPLER;
-            SDL_GPUTexture* texture = SDL_CreateGPUTexture(render_context.device, &texture_create_info);
-
-            SDL_GPUTransferBufferCreateInfo transfer_buffer_create_info{};
-            transfer_buffer_create_info.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
-            transfer_buffer_create_info.size = image_data->w * image_data->h * 4;
-            SDL_GPUTransferBuffer* texture_transfer_buffer = SDL_CreateGPUTransferBuffer(
-                render_context.device,
-                &transfer_buffer_create_info
-            );
+                    fn(entity_from_slot(slot), first.data[i], rest.data[rest.sparse[slot]]...);
+                }
+            }
+        }
 
-            auto texture_transfer_pointer = SDL_MapGPUTransferBuffer(
-                render_context.device,
-                texture_transfer_buffer,
-                false
-            );
-            SDL_memcpy(texture_transfer_pointer, image_data->pixels, image_data->w * image_data->h * 4);
-            SDL_UnmapGPUTransferBuffer(render_context.device, texture_transfer_buffer);
+        glm::ivec2 get_spatial_cell_coordinates(glm::vec2 position)
+        {
+            int x = static_cast<int>(SDL_floorf(position.x / SPATIAL_CELL_SIZE));
+            int y = static_cast<int>(SDL_floorf(position.y / SPATIAL_CELL_SIZE));
+            const Spatial_Grid& grid = entity_store.grid;
+            return glm::ivec2(SDL_clamp(x, 0, grid.size_x - 1), SDL_clamp(y, 0, grid.size_y - 1));
+        }
 
-            // start a copy pass
-            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
-            SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(command_buffer);
+        void unlink_spatial_cell(Uint32 slot)
+        {
+            Spatial_Grid& grid = entity_store.grid;
+            if(slot >= grid.cells.size() || grid.cells[slot] == NO_COMPONENT)
+            {
+                return;
+            }
+            Uint32 next = grid.next[slot];
+            Uint32 previous = grid.previous[slot];
+            if(previous != NO_COMPONENT)
+            {
+                grid.next[previous] = next;
+            }
+            else
+            {
+                grid.heads[grid.cells[slot]] = next;
+            }
+            if(next != NO_COMPONENT)
+            {
+                grid.previous[next] = previous;
+            }
+            grid.cells[slot] = NO_COMPONENT;
+        }
 
-            SDL_GPUTextureTransferInfo texture_transfer_info{};
-            texture_transfer_info.transfer_buffer = texture_transfer_buffer;
-            texture_transfer_info.offset = 0; /* Zeros out the rest */
-            SDL_GPUTextureRegion texture_region{};
-            texture_region.texture = texture;
-            texture_region.w = image_data->w;
-            texture_region.h = image_data->h;
-            texture_region.d = 1;
-            SDL_UploadToGPUTexture(
-                copy_pass,
-                &texture_transfer_info,
-                &texture_region,
-                false
-            );
+        // relinks the slot only when the position crossed into another cell
+        void update_spatial_cell(Uint32 slot, glm::vec3 position)
+        {
+            Spatial_Grid& grid = entity_store.grid;
+            if(grid.heads.empty())
+            {
+                grid.size_x = SDL_max(map.tiles.size_x, 1);
+                grid.size_y = SDL_max(map.tiles.size_y, 1);
+                grid.heads.assign(grid.size_x * grid.size_y, NO_COMPONENT);
+            }
+            if(grid.cells.size() <= slot)
+            {
+                grid.cells.resize(entity_store.generations.size(), NO_COMPONENT);
+                grid.next.resize(entity_store.generations.size(), NO_COMPONENT);
+                grid.previous.resize(entity_store.generations.size(), NO_COMPONENT);
+            }
 
-            SDL_EndGPUCopyPass(copy_pass);
-            SDL_SubmitGPUCommandBuffer(command_buffer);
-            SDL_DestroySurface(image_data);
-            SDL_ReleaseGPUTransferBuffer(render_context.device, texture_transfer_buffer);
+            glm::ivec2 coordinates = get_spatial_cell_coordinates(glm::vec2(position.x, position.z));
+            Uint32 cell = coordinates.y * grid.size_x + coordinates.x;
+            if(grid.cells[slot] == cell)
+            {
+                return;
+            }
+            unlink_spatial_cell(slot);
 
-            return texture;
+            grid.cells[slot] = cell;
+            grid.previous[slot] = NO_COMPONENT;
+            grid.next[slot] = grid.heads[cell];
+            if(grid.heads[cell] != NO_COMPONENT)
+            {
+                grid.previous[grid.heads[cell]] = slot;
+            }
+            grid.heads[cell] = slot;
         }
-        void load_textures()
-        {
-            SDL_GPUSamplerCreateInfo sampler_create_info{};
-            sampler_create_info.min_filter = SDL_GPU_FILTER_NEAREST;
-            sampler_create_info.mag_filter = SDL_GPU_FILTER_NEAREST;
-            sampler_create_info.mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_NEAREST;
-            sampler_create_info.address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-            sampler_create_info.address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-            sampler_create_info.address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-            render_context.sampler = SDL_CreateGPUSampler(render_context.device, &sampler_create_info);
 
-            render_context.diffuse_map = load_texture("diffuse.bmp");
-            render_context.specular_map = load_texture("specular.bmp");
-            render_context.shininess_map = load_texture("shininess.bmp");
+        // fn(deep::Entity, deep::Position_Component&) for every entity whose xz position lies inside the rectangle,
+        // fn must not move, create or destroy entities
+        template<typename F>
+        void for_each_entity_in_rect(glm::vec2 min, glm::vec2 max, F fn)
+        {
+            Spatial_Grid& grid = entity_store.grid;
+            if(grid.heads.empty())
+            {
+                return;
+            }
+            glm::ivec2 min_cell = get_spatial_cell_coordinates(min);
+            glm::ivec2 max_cell = get_spatial_cell_coordinates(max);
+            for(int y = min_cell.y; y <= max_cell.y; ++y)
+            {
+                for(int x = min_cell.x; x <= max_cell.x; ++x)
+                {
+                    for(Uint32 slot = grid.heads[y * grid.size_x + x]; slot != NO_COMPONENT; slot = grid.next[slot])
+                    {
+                        deep::Position_Component& position = entity_store.positions.data[entity_store.positions.sparse[slot]];
+                        if(position.position.x >= min.x && position.position.x <= max.x && position.position.z >= min.y && position.position.z <= max.y)
+                        {
+                            fn(entity_from_slot(slot), position);
+                        }
+                    }
+                }
+            }
         }
 
-        void create_render_data(deep::Entity& render_data, std::vector<Vertex>& vertices, std::vector<Uint16>& indices)
+        template<typename F>
+        void for_each_entity_in_radius(glm::vec2 center, float radius, F fn)
         {
-            // create the vertex buffer
-            SDL_GPUBufferCreateInfo vertex_buffer_info{};
-            vertex_buffer_info.size = vertices.size() * sizeof(Vertex);
-            vertex_buffer_info.usage = SDL_GPU_BUFFERUSAGE_VERTEX;
-            render_data.vertex_buffer = SDL_CreateGPUBuffer(render_context.device, &vertex_buffer_info);
-
-            // create the index buffer
-            SDL_GPUBufferCreateInfo index_buffer_info{};
-            index_buffer_info.size = indices.size() * sizeof(Uint16);
-            index_buffer_info.usage = SDL_GPU_BUFFERUSAGE_INDEX;
-            render_data.index_buffer = SDL_CreateGPUBuffer(render_context.device, &index_buffer_info);
-
-            // create a transfer buffer to upload to the vertex buffer
-            SDL_GPUTransferBufferCreateInfo transfer_info{};
-            transfer_info.size = vertices.size() * sizeof(Vertex) + indices.size() * sizeof(Uint16);
-            transfer_info.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
-            SDL_GPUTransferBuffer* buffer_transfer_buffer = SDL_CreateGPUTransferBuffer(render_context.device, &transfer_info);
-
-            // fill the transfer buffer
-            Vertex* transfer_data = (Vertex*)SDL_MapGPUTransferBuffer(render_context.device, buffer_transfer_buffer, false);
-            SDL_memcpy(transfer_data, vertices.data(), vertices.size() * sizeof(Vertex));
-            Uint16* index_data = (Uint16*) &transfer_data[vertices.size()];
-            SDL_memcpy(index_data, indices.data(), indices.size() * sizeof(Uint16));
+            float radius_squared = radius * radius;
+            for_each_entity_in_rect(center - glm::vec2(radius), center + glm::vec2(radius), [&](deep::Entity entity, deep::Position_Component& position)
+            {
+                glm::vec2 offset = glm::vec2(position.position.x, position.position.z) - center;
+                if(glm::dot(offset, offset) <= radius_squared)
+                {
+                    fn(entity, position);
+                }
+            });
+        }
 
-            SDL_UnmapGPUTransferBuffer(render_context.device, buffer_transfer_buffer);
+        deep::Entity create_entity()
+        {
+            Uint32 slot;
+            if(!entity_store.free_slots.empty())
+            {
+                slot = entity_store.free_slots.back();
+                entity_store.free_slots.pop_back();
+            }
+            else
+            {
+                slot = entity_store.generations.size();
+                entity_store.generations.push_back(1);
+            }
+            entity_store.count += 1;
+            return entity_from_slot(slot);
+        }
 
-            // start a copy pass
-            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
-            SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(command_buffer);
+        void clear_behavior(Uint32 slot);
+        void clear_all_behaviors();
 
-            // upload the vertex buffer
-            SDL_GPUTransferBufferLocation vertex_buffer_location{};
-            vertex_buffer_location.transfer_buffer = buffer_transfer_buffer;
-            vertex_buffer_location.offset = 0;
-            SDL_GPUBufferRegion vertex_region{};
-            vertex_region.buffer = render_data.vertex_buffer;
-            vertex_region.size = vertices.size() * sizeof(Vertex);
-            vertex_region.offset = 0;
-            SDL_UploadToGPUBuffer(copy_pass, &vertex_buffer_location, &vertex_region, false);
-
-            // upload the index buffer
-            SDL_GPUTransferBufferLocation index_buffer_location{};
-            index_buffer_location.transfer_buffer = buffer_transfer_buffer;
-            index_buffer_location.offset = vertices.size() * sizeof(Vertex);
-            SDL_GPUBufferRegion index_region{};
-            index_region.buffer = render_data.index_buffer;
-            index_region.size = indices.size() * sizeof(Uint16);
-            index_region.offset = 0;
-            SDL_UploadToGPUBuffer(copy_pass, &index_buffer_location, &index_region, false);
+        void destroy_entity(deep::Entity entity)
+        {
+            if(!is_entity_alive(entity))
+            {
+                return;
+            }
+            Uint32 slot = entity.index;
+            clear_behavior(slot);
+            unlink_spatial_cell(slot);
+            remove_component(entity_store.positions, slot);
+            remove_component(entity_store.velocities, slot);
+            remove_component(entity_store.collisions, slot);
+            remove_component(entity_store.lights, slot);
+            remove_component(entity_store.renders, slot);
+            remove_component(entity_store.enemies, slot);
+            remove_component(entity_store.exits, slot);
+
+            entity_store.generations[slot] += 1;
+            entity_store.free_slots.push_back(slot);
+            entity_store.count -= 1;
+        }
 
-            // end the copy pass
-            SDL_EndGPUCopyPass(copy_pass);
-            SDL_SubmitGPUCommandBuffer(command_buffer);
-            SDL_ReleaseGPUTransferBuffer(render_context.device, buffer_transfer_buffer);
+        void destroy_all_entities()
+        {
+            clear_all_behaviors();
+            clear_components(entity_store.positions);
+            clear_components(entity_store.velocities);
+            clear_components(entity_store.collisions);
+            clear_components(entity_store.lights);
+            clear_components(entity_store.renders);
+            clear_components(entity_store.enemies);
+            clear_components(entity_store.exits);
+            // the next scene may have another map size, the grid is sized again when its first entity is linked
+            entity_store.grid.heads.clear();
+            entity_store.grid.cells.assign(entity_store.grid.cells.size(), NO_COMPONENT);
+
+            // bump every generation so no handle from the old scene resolves anymore
+            entity_store.free_slots.clear();
+            for(Uint32 slot = entity_store.generations.size(); slot > 0; --slot)
+            {
+                entity_store.generations[slot - 1] += 1;
+                entity_store.free_slots.push_back(slot - 1);
+            }
+            entity_store.count = 0;
+        }
 
-            render_data.index_count = indices.size();
-            render_data.transform = glm::mat4(1.0f);
+        glm::vec3 get_entity_position(deep::Entity entity)
+        {
+            deep::Position_Component* position = get_component(entity_store.positions, entity);
+            return position ? position->position : glm::vec3(0.0f, 0.0f, 0.0f);
         }
-        void destroy_render_data(deep::Entity& render_data){
-            // release buffers
-            SDL_ReleaseGPUBuffer(render_context.device, render_data.vertex_buffer);
-            SDL_ReleaseGPUBuffer(render_context.device, render_data.index_buffer);
+
+        void set_entity_position(deep::Entity entity, glm::vec3 position)
+        {
+            deep::Position_Component* component = get_component(entity_store.positions, entity);
+            if(component)
+            {
+                component->position = position;
+            }
+            else if(!add_component(entity_store.positions, entity, deep::Position_Component{ position, position }))
+            {
+                return;
+            }
+            update_spatial_cell(entity.index, position);
         }
+    #pragma endregion Entities
 
-        void load_gltf(const char *model_filename, deep::Entity& render_data)
+    #pragma region AI Scheduling
+        int get_room(glm::vec2 position)
         {
-            cgltf_options options = {};
-            cgltf_data* data = NULL;
-            cgltf_result result = cgltf_parse_file(&options, model_filename, &data);
+            int x = (int)SDL_floorf(position.x / 3.0f);
+            int z = (int)SDL_floorf(position.y / 3.0f);
+            return get_tile_room(map.tiles, x, z);
+        }
 
-            if (result == cgltf_result_success)
+        void ensure_room_bounds()
+        {
+            if(ai_scheduler.map_version == map.version)
             {
-                result = cgltf_load_buffers(&options, data, model_filename);
-                if (result == cgltf_result_success)
-                {
-                    if(data->meshes_count > 0)
+                return;
+            }
+            ai_scheduler.map_version = map.version;
+            ai_scheduler.room_bounds.clear();
+            for(const deep::Map_Chunk& chunk : map.tiles.chunks)
+            {
+                for(int local_z = 0; local_z < deep::MAP_CHUNK_SIZE; local_z++)
+                {
+                    for(int local_x = 0; local_x < deep::MAP_CHUNK_SIZE; local_x++)
                     {
-                        cgltf_mesh* mesh = &data->meshes[0];
+                        int room = chunk.rooms[local_z][local_x];
+                        if(room == 0)
+                        {
+                            continue;
+                        }
+                        int x = chunk.origin.x + local_x;
+                        int z = chunk.origin.y + local_z;
+                        if(room >= (int)ai_scheduler.room_bounds.size())
+                        {
+                            ai_scheduler.room_bounds.resize(room + 1, glm::ivec4(map.tiles.size_x, map.tiles.size_y, -1, -1));
+                        }
+                        glm::ivec4& bounds = ai_scheduler.room_bounds[room];
+                        bounds = glm::ivec4(SDL_min(bounds.x, x), SDL_min(bounds.y, z), SDL_max(bounds.z, x), SDL_max(bounds.w, z));
+                    }
+                }
+            }
+        }
 
-                        for(int i = 0; i < mesh->primitives_count; i++)
+        void wake_enemy(deep::Entity entity, deep::AI_Tier tier)
+        {
+            deep::Enemy_Component* enemy = get_component(entity_store.enemies, entity);
+            // the near pass runs first, so the first tier an enemy gets in a frame is the highest
+            if(enemy == nullptr || enemy->scheduled_frame == ai_scheduler.frame)
+            {
+                return;
+            }
+            enemy->scheduled_frame = ai_scheduler.frame;
+            enemy->tier = tier;
+            ai_scheduler.awake.push_back(entity);
+        }
+
+        // only walks the spatial cells around the players and last frame's awake list, so the cost follows what is near the players
+        void schedule_ai(const deep::Steering_Players& players)
+        {
+            ensure_room_bounds();
+            ai_scheduler.frame += 1;
+            std::swap(ai_scheduler.awake, ai_scheduler.previous_awake);
+            ai_scheduler.awake.clear();
+            ai_scheduler.scheduled.clear();
+
+            for(int player_id = 0; player_id < players.count; player_id++)
+            {
+                glm::vec2 player_position = players.positions[player_id];
+                for_each_entity_in_radius(player_position, AI_NEAR_DISTANCE, [&](deep::Entity entity, deep::Position_Component& position)
+                {
+                    wake_enemy(entity, deep::AI_Near);
+                });
+
+                // a player walking into a room wakes the whole room, even the corners past the near distance
+                int room = get_room(player_position);
+                if(room != 0 && room < (int)ai_scheduler.room_bounds.size())
+                {
+                    glm::ivec4 bounds = ai_scheduler.room_bounds[room];
+                    glm::vec2 min = glm::vec2(bounds.x * 3.0f, bounds.y * 3.0f);
+                    glm::vec2 max = glm::vec2(bounds.z * 3.0f + 3.0f, bounds.w * 3.0f + 3.0f);
+                    for_each_entity_in_rect(min, max, [&](deep::Entity entity, deep::Position_Component& position)
+                    {
+                        if(get_room(glm::vec2(position.position.x, position.position.z)) == room)
                         {
-                            cgltf_primitive* primitive = &mesh->primitives[i];
-                            if(primitive->type == cgltf_primitive_type_triangles)
-                            {
-                                std::vector<Vertex> vertices;
-                                std::vector<Uint16> indices;
+                            wake_enemy(entity, deep::AI_Near);
+                        }
+                    });
+                }
+            }
+            for(int player_id = 0; player_id < players.count; player_id++)
+            {
+                for_each_entity_in_radius(players.positions[player_id], AI_MID_DISTANCE, [&](deep::Entity entity, deep::Position_Component& position)
+                {
+                    wake_enemy(entity, deep::AI_Mid);
+                });
+            }
 
-                                Uint16 current_vertex_offset = vertices.size();
+            // enemies no player is close to any more stop where they are until something wakes them again
+            for(deep::Entity entity : ai_scheduler.previous_awake)
+            {
+                deep::Enemy_Component* enemy = get_component(entity_store.enemies, entity);
+                if(enemy == nullptr || enemy->scheduled_frame == ai_scheduler.frame)
+                {
+                    continue;
+                }
+                enemy->tier = deep::AI_Sleeping;
+                deep::Velocity_Component* velocity = get_component(entity_store.velocities, entity);
+                if(velocity)
+                {
+                    velocity->velocity = glm::vec2(0.0f, 0.0f);
+                }
+            }
 
-                                const cgltf_accessor* pos_accessor = NULL;
-                                const cgltf_accessor* normal_accessor = NULL;
-                                const cgltf_accessor* texcoord_accessor = NULL;
+            // mid enemies keep moving with their last velocity between slices, integrate_velocities still runs for them every frame
+            for(deep::Entity entity : ai_scheduler.awake)
+            {
+                deep::Enemy_Component* enemy = get_component(entity_store.enemies, entity);
+                if(enemy->tier == deep::AI_Near || (entity.index + ai_scheduler.frame) % AI_MID_SLICES == 0)
+                {
+                    ai_scheduler.scheduled.push_back(entity);
+                }
+            }
+        }
+    #pragma endregion AI Scheduling
 
-                                for (size_t j = 0; j < primitive->attributes_count; ++j) {
-                                    const cgltf_attribute* attribute = &primitive->attributes[j];
-                                    if (attribute->type == cgltf_attribute_type_position) {
-                                        pos_accessor = attribute->data;
-                                    } else if (attribute->type == cgltf_attribute_type_normal) {
-                                        normal_accessor = attribute->data;
-                                    } else if (attribute->type == cgltf_attribute_type_texcoord) { // TEXCOORD_0
-                                        texcoord_accessor = attribute->data;
-                                    }
-                                    // Add more attribute types (e.g., TANGENT, COLOR_0) as needed
-                                }
+    #pragma region Behaviors
+        void clear_behavior(Uint32 slot)
+        {
+            if(slot >= behavior_scheduler.states.size())
+            {
+                return;
+            }
+            Behavior_State& state = behavior_scheduler.states[slot];
+            if(state.handle)
+            {
+                state.handle.destroy();
+                state.handle = {};
+            }
+            if(state.wait == deep::Behavior_Player_Range)
+            {
+                behavior_scheduler.range_wait_count -= 1;
+            }
+            state.wait = deep::Behavior_Running;
+            state.wait_id += 1;
+            state.velocity = glm::vec2(0.0f, 0.0f);
+        }
 
-                                if (pos_accessor) {
-                                    vertices.reserve(vertices.size() + pos_accessor->count);
+        void clear_all_behaviors()
+        {
+            for(Uint32 slot = 0; slot < behavior_scheduler.states.size(); slot++)
+            {
+                clear_behavior(slot);
+            }
+            for(std::vector<Behavior_Wait_Entry>& timers : behavior_scheduler.wheel)
+            {
+                timers.clear();
+            }
+            behavior_scheduler.moving.clear();
+            behavior_scheduler.range_wait_count = 0;
+        }
 
-                                    for (cgltf_size k = 0; k < pos_accessor->count; ++k) {
-                                        Vertex v = {};
+        void resume_behavior(Uint32 slot)
+        {
+            Behavior_State& state = behavior_scheduler.states[slot];
+            if(state.wait == deep::Behavior_Player_Range)
+            {
+                behavior_scheduler.range_wait_count -= 1;
+            }
+            state.wait = deep::Behavior_Running;
+            state.velocity = glm::vec2(0.0f, 0.0f);
+            std::coroutine_handle<deep::Behavior::promise_type> handle = state.handle;
+            handle.resume();
+            // resuming can grow states when the behavior creates entities
+            if(handle.done())
+            {
+                handle.destroy();
+                behavior_scheduler.states[slot].handle = {};
+            }
+        }
 
-                                        cgltf_accessor_read_float(pos_accessor, k, v.position, 3);
+        void start_behavior(deep::Entity entity, deep::Behavior behavior)
+        {
+            if(!is_entity_alive(entity) || !behavior.handle)
+            {
+                return;
+            }
+            if(entity.index >= behavior_scheduler.states.size())
+            {
+                behavior_scheduler.states.resize(entity.index + 1);
+            }
+            clear_behavior(entity.index);
+            behavior.handle.promise().entity = entity;
+            behavior_scheduler.states[entity.index].handle = behavior.handle;
+            behavior.handle = {};
+            resume_behavior(entity.index);
+        }
 
-                                        if (normal_accessor) {
-                                            cgltf_accessor_read_float(normal_accessor, k, v.normal, 3);
-                                        } else {
-                                            v.normal[0] = 0.0f; v.normal[1] = 0.0f; v.normal[2] = 0.0f;
-                                        }
+        bool is_player_in_range(glm::vec2 position, float range)
+        {
+            for(int player_id = 0; player_id < behavior_scheduler.players.count; player_id++)
+            {
+                glm::vec2 offset = behavior_scheduler.players.positions[player_id] - position;
+                if(glm::dot(offset, offset) <= range * range)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
 
-                                        if (texcoord_accessor) {
-                                            cgltf_accessor_read_float(texcoord_accessor, k, v.texcoord, 2);
-                                        } else {
-                                            v.texcoord[0] = 0.0f; v.texcoord[1] = 0.0f;
-                                        }
-                                        vertices.push_back(v);
-                                    }
-                                } else {
-                                    SDL_Log("Warning: Primitive found without position data.\n");
-                                    continue;
-                                }
+        // returns false when the wait is already over and the behavior should keep running
+        bool suspend_behavior(deep::Entity entity, const deep::Behavior_Wait& wait)
+        {
+            Behavior_State& state = behavior_scheduler.states[entity.index];
+            state.wait_id += 1;
+            glm::vec3 position = get_entity_position(entity);
+            glm::vec2 position_2d = glm::vec2(position.x, position.z);
+            switch(wait.kind)
+            {
+                case deep::Behavior_Timer:
+                {
+                    Uint32 ticks = SDL_max((Uint32)SDL_ceilf(wait.value / behavior_scheduler.step_time), 1u);
+                    Uint64 slot = (behavior_scheduler.tick + ticks) % BEHAVIOR_WHEEL_SIZE;
+                    behavior_scheduler.wheel[slot].push_back(Behavior_Wait_Entry{ entity.index, state.wait_id, (ticks - 1) / BEHAVIOR_WHEEL_SIZE });
+                    break;
+                }
+                case deep::Behavior_Player_Range:
+                {
+                    state.range = SDL_min(wait.value, BEHAVIOR_MAX_PLAYER_RANGE);
+                    if(is_player_in_range(position_2d, state.range))
+                    {
+                        return false;
+                    }
+                    behavior_scheduler.range_wait_count += 1;
+                    break;
+                }
+                case deep::Behavior_Move:
+                {
+                    state.target = glm::vec2(wait.tile.x * 3.0f + 1.5f, wait.tile.y * 3.0f + 1.5f);
+                    deep::Velocity_Component* velocity = get_component(entity_store.velocities, entity);
+                    float speed = velocity ? velocity->speed : 3.0f;
+                    // twice the straight line time, a blocked move gives up instead of waiting forever
+                    float seconds = glm::length(state.target - position_2d) / speed * 2.0f + 1.0f;
+                    state.deadline = behavior_scheduler.tick + (Uint64)SDL_ceilf(seconds / behavior_scheduler.step_time);
+                    behavior_scheduler.moving.push_back(Behavior_Wait_Entry{ entity.index, state.wait_id, 0 });
+                    break;
+                }
+                default:
+                    return false;
+            }
+            state.wait = wait.kind;
+            return true;
+        }
 
+        // one wheel tick per simulation step, only the expiring slot, arriving movers and players' surroundings are visited
+        void update_behaviors(const deep::Steering_Players& players, float delta_time)
+        {
+            behavior_scheduler.players = players;
+            behavior_scheduler.step_time = delta_time;
+            behavior_scheduler.tick += 1;
+            behavior_scheduler.resumable.clear();
+
+            std::vector<Behavior_Wait_Entry>& timers = behavior_scheduler.wheel[behavior_scheduler.tick % BEHAVIOR_WHEEL_SIZE];
+            std::swap(timers, behavior_scheduler.expiring);
+            timers.clear();
+            for(Behavior_Wait_Entry& timer : behavior_scheduler.expiring)
+            {
+                if(timer.rounds > 0)
+                {
+                    timer.rounds -= 1;
+                    timers.push_back(timer);
+                    continue;
+                }
+                Behavior_State& state = behavior_scheduler.states[timer.slot];
+                if(state.wait == deep::Behavior_Timer && state.wait_id == timer.wait_id)
+                {
+                    behavior_scheduler.resumable.push_back(timer.slot);
+                }
+            }
 
-                                if (primitive->indices != NULL) {
-                                    const cgltf_accessor* indices_accessor = primitive->indices;
+            for(int i = 0; i < (int)behavior_scheduler.moving.size(); )
+            {
+                Uint32 slot = behavior_scheduler.moving[i].slot;
+                Behavior_State& state = behavior_scheduler.states[slot];
+                if(state.wait != deep::Behavior_Move || state.wait_id != behavior_scheduler.moving[i].wait_id)
+                {
+                    behavior_scheduler.moving[i] = behavior_scheduler.moving.back();
+                    behavior_scheduler.moving.pop_back();
+                    continue;
+                }
+                deep::Entity entity = entity_from_slot(slot);
+                glm::vec3 position = get_entity_position(entity);
+                glm::vec2 offset = state.target - glm::vec2(position.x, position.z);
+                float distance = glm::length(offset);
+                deep::Velocity_Component* velocity = get_component(entity_store.velocities, entity);
+                float speed = velocity ? velocity->speed : 3.0f;
+                if(distance <= speed * delta_time || behavior_scheduler.tick >= state.deadline)
+                {
+                    behavior_scheduler.resumable.push_back(slot);
+                    behavior_scheduler.moving[i] = behavior_scheduler.moving.back();
+                    behavior_scheduler.moving.pop_back();
+                    continue;
+                }
+                state.velocity = offset / distance * speed;
+                i++;
+            }
+
+            if(behavior_scheduler.range_wait_count > 0)
+            {
+                for(int player_id = 0; player_id < players.count; player_id++)
+                {
+                    for_each_entity_in_radius(players.positions[player_id], BEHAVIOR_MAX_PLAYER_RANGE, [&](deep::Entity entity, deep::Position_Component& position)
+                    {
+                        if(entity.index >= behavior_scheduler.states.size())
+                        {
+                            return;
+                        }
+                        Behavior_State& state = behavior_scheduler.states[entity.index];
+                        glm::vec2 offset = players.positions[player_id] - glm::vec2(position.position.x, position.position.z);
+                        if(state.wait == deep::Behavior_Player_Range && glm::dot(offset, offset) <= state.range * state.range)
+                        {
+                            // running stops the second player from queuing it again
+                            state.wait = deep::Behavior_Running;
+                            behavior_scheduler.range_wait_count -= 1;
+                            behavior_scheduler.resumable.push_back(entity.index);
+                        }
+                    });
+                }
+            }
+
+            for(Uint32 slot : behavior_scheduler.resumable)
+            {
+                if(behavior_scheduler.states[slot].handle)
+                {
+                    resume_behavior(slot);
+                }
+            }
+        }
+
+        glm::vec2 get_behavior_velocity(deep::Entity entity)
+        {
+            if(!is_entity_alive(entity) || entity.index >= behavior_scheduler.states.size())
+            {
+                return glm::vec2(0.0f, 0.0f);
+            }
+            return behavior_scheduler.states[entity.index].velocity;
+        }
+    #pragma endregion Behaviors
+
+    #pragma region Steering
+        const float STEERING_FAR_DISTANCE_SQUARED = 9999.0f * 9999.0f;
+
+        typedef void (*Steering_Kernel)(deep::Steering_Batch& batch, const deep::Steering_Players& players, int begin, int end);
+
+        void gather_steering_batch(deep::Steering_Batch& batch)
+        {
+            int count = ai_scheduler.scheduled.size();
+            int padded_count = (count + 7) & ~7;
+            batch.count = 0;
+            batch.entities.resize(padded_count);
+            batch.x.assign(padded_count, 0.0f);
+            batch.z.assign(padded_count, 0.0f);
+            batch.sight.assign(padded_count, 0.0f);
+            batch.radius.assign(padded_count, 0.0f);
+            batch.nearest_player.resize(padded_count);
+            batch.flags.resize(padded_count);
+
+            for(int s = 0; s < count; s++)
+            {
+                deep::Entity entity = ai_scheduler.scheduled[s];
+                deep::Position_Component* position = get_component(entity_store.positions, entity);
+                deep::Collision_Component* collision = get_component(entity_store.collisions, entity);
+                if(position == nullptr || collision == nullptr)
+                {
+                    continue;
+                }
+                int i = batch.count++;
+                batch.entities[i] = entity;
+                batch.x[i] = position->position.x;
+                batch.z[i] = position->position.z;
+                batch.sight[i] = get_component(entity_store.enemies, entity)->sight;
+                batch.radius[i] = collision->radius;
+            }
+        }
+
+        // reference implementation, the simd kernels below must produce the same results lane for lane
+        void steer_batch_scalar(deep::Steering_Batch& batch, const deep::Steering_Players& players, int begin, int end)
+        {
+            for(int i = begin; i < end; ++i)
+            {
+                float radius_squared = batch.radius[i] * batch.radius[i];
+                float best_distance_squared = STEERING_FAR_DISTANCE_SQUARED;
+                int best_player = 0;
+                Uint8 flags = 0;
+                for(int player = 0; player < players.count; ++player)
+                {
+                    float delta_x = players.positions[player].x - batch.x[i];
+                    float delta_z = players.positions[player].y - batch.z[i];
+                    float distance_squared = delta_x * delta_x + delta_z * delta_z;
+                    if(distance_squared < radius_squared)
+                    {
+                        flags |= deep::Steering_Contact;
+                    }
+                    if(distance_squared < best_distance_squared)
+                    {
+                        best_distance_squared = distance_squared;
+                        best_player = player;
+                    }
+                }
+
+                if(best_distance_squared < batch.sight[i] * batch.sight[i])
+                {
+                    flags |= deep::Steering_In_Sight;
+                }
+                batch.nearest_player[i] = best_player;
+                batch.flags[i] = flags;
+            }
+        }
+
+        void write_steering_lanes(deep::Steering_Batch& batch, int first, int lane_count, int sight_bits, int contact_bits, const float* nearest_player)
+        {
+            for(int lane = 0; lane < lane_count; ++lane)
+            {
+                Uint8 flags = 0;
+                flags |= (sight_bits >> lane & 1) ? deep::Steering_In_Sight : 0;
+                flags |= (contact_bits >> lane & 1) ? deep::Steering_Contact : 0;
+                batch.flags[first + lane] = flags;
+                batch.nearest_player[first + lane] = static_cast<Uint8>(nearest_player[lane]);
+            }
+        }
+
+#ifdef SDL_SSE2_INTRINSICS
+        // blend without sse4.1, picks a where the mask is set
+        inline __m128 select_sse2(__m128 mask, __m128 a, __m128 b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+
+        // 4 enemies per iteration, begin must be a multiple of 4
+        SDL_TARGETING("sse2") void steer_batch_sse2(deep::Steering_Batch& batch, const deep::Steering_Players& players, int begin, int end)
+        {
+            __m128 zero = _mm_setzero_ps();
+            for(int i = begin; i < end; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(&batch.x[i]);
+                __m128 z = _mm_loadu_ps(&batch.z[i]);
+                __m128 radius = _mm_loadu_ps(&batch.radius[i]);
+                __m128 sight = _mm_loadu_ps(&batch.sight[i]);
+                __m128 radius_squared = _mm_mul_ps(radius, radius);
+
+                __m128 best_distance_squared = _mm_set1_ps(STEERING_FAR_DISTANCE_SQUARED);
+                __m128 best_player = zero;
+                __m128 contact = zero;
+                for(int player = 0; player < players.count; ++player)
+                {
+                    __m128 delta_x = _mm_sub_ps(_mm_set1_ps(players.positions[player].x), x);
+                    __m128 delta_z = _mm_sub_ps(_mm_set1_ps(players.positions[player].y), z);
+                    __m128 distance_squared = _mm_add_ps(_mm_mul_ps(delta_x, delta_x), _mm_mul_ps(delta_z, delta_z));
+                    contact = _mm_or_ps(contact, _mm_cmplt_ps(distance_squared, radius_squared));
+                    __m128 closer = _mm_cmplt_ps(distance_squared, best_distance_squared);
+                    best_distance_squared = select_sse2(closer, distance_squared, best_distance_squared);
+                    best_player = select_sse2(closer, _mm_set1_ps(static_cast<float>(player)), best_player);
+                }
+
+                __m128 in_sight = _mm_cmplt_ps(best_distance_squared, _mm_mul_ps(sight, sight));
+
+                float nearest_player[4];
+                _mm_storeu_ps(nearest_player, best_player);
+                write_steering_lanes(batch, i, 4, _mm_movemask_ps(in_sight), _mm_movemask_ps(contact), nearest_player);
+            }
+        }
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+        // 8 enemies per iteration, begin must be a multiple of 8
+        SDL_TARGETING("avx2") void steer_batch_avx2(deep::Steering_Batch& batch, const deep::Steering_Players& players, int begin, int end)
+        {
+            __m256 zero = _mm256_setzero_ps();
+            for(int i = begin; i < end; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(&batch.x[i]);
+                __m256 z = _mm256_loadu_ps(&batch.z[i]);
+                __m256 radius = _mm256_loadu_ps(&batch.radius[i]);
+                __m256 sight = _mm256_loadu_ps(&batch.sight[i]);
+                __m256 radius_squared = _mm256_mul_ps(radius, radius);
+
+                __m256 best_distance_squared = _mm256_set1_ps(STEERING_FAR_DISTANCE_SQUARED);
+                __m256 best_player = zero;
+                __m256 contact = zero;
+                for(int player = 0; player < players.count; ++player)
+                {
+                    __m256 delta_x = _mm256_sub_ps(_mm256_set1_ps(players.positions[player].x), x);
+                    __m256 delta_z = _mm256_sub_ps(_mm256_set1_ps(players.positions[player].y), z);
+                    __m256 distance_squared = _mm256_add_ps(_mm256_mul_ps(delta_x, delta_x), _mm256_mul_ps(delta_z, delta_z));
+                    contact = _mm256_or_ps(contact, _mm256_cmp_ps(distance_squared, radius_squared, _CMP_LT_OQ));
+                    __m256 closer = _mm256_cmp_ps(distance_squared, best_distance_squared, _CMP_LT_OQ);
+                    best_distance_squared = _mm256_blendv_ps(best_distance_squared, distance_squared, closer);
+                    best_player = _mm256_blendv_ps(best_player, _mm256_set1_ps(static_cast<float>(player)), closer);
+                }
+
+                __m256 in_sight = _mm256_cmp_ps(best_distance_squared, _mm256_mul_ps(sight, sight), _CMP_LT_OQ);
+
+                float nearest_player[8];
+                _mm256_storeu_ps(nearest_player, best_player);
+                write_steering_lanes(batch, i, 8, _mm256_movemask_ps(in_sight), _mm256_movemask_ps(contact), nearest_player);
+            }
+        }
+#endif
+
+#ifndef NDEBUG
+        // runs a kernel next to the scalar reference on random batches, padding lanes included
+        bool check_steering_kernel(Steering_Kernel kernel)
+        {
+            Uint64 state = 1;
+            deep::Steering_Batch reference;
+            deep::Steering_Batch batch;
+            for(int round = 0; round < 64; ++round)
+            {
+                deep::Steering_Players players{};
+                players.count = 1 + SDL_rand_r(&state, deep::STEERING_MAX_PLAYERS);
+                for(int player = 0; player < players.count; ++player)
+                {
+                    players.positions[player] = glm::vec2(SDL_randf_r(&state) * 40.0f - 20.0f, SDL_randf_r(&state) * 40.0f - 20.0f);
+                }
+
+                int count = 1 + SDL_rand_r(&state, 100);
+                int padded_count = (count + 7) & ~7;
+                reference.count = count;
+                reference.x.assign(padded_count, 0.0f);
+                reference.z.assign(padded_count, 0.0f);
+                reference.sight.assign(padded_count, 0.0f);
+                reference.radius.assign(padded_count, 0.0f);
+                reference.nearest_player.assign(padded_count, 0);
+                reference.flags.assign(padded_count, 0);
+                for(int i = 0; i < count; ++i)
+                {
+                    reference.x[i] = SDL_randf_r(&state) * 40.0f - 20.0f;
+                    reference.z[i] = SDL_randf_r(&state) * 40.0f - 20.0f;
+                    reference.sight[i] = SDL_randf_r(&state) * 20.0f;
+                    reference.radius[i] = SDL_randf_r(&state) * 2.0f;
+                }
+                batch = reference;
+
+                steer_batch_scalar(reference, players, 0, padded_count);
+                kernel(batch, players, 0, padded_count);
+                for(int i = 0; i < padded_count; ++i)
+                {
+                    if(batch.flags[i] != reference.flags[i] || batch.nearest_player[i] != reference.nearest_player[i])
+                    {
+                        SDL_Log("Steering kernel mismatch at lane %d of %d: flags %d, expected %d, nearest player %d, expected %d", i, padded_count, batch.flags[i], reference.flags[i], batch.nearest_player[i], reference.nearest_player[i]);
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+#endif
+
+        Steering_Kernel get_steering_kernel()
+        {
+            static Steering_Kernel kernel = nullptr;
+            if(kernel == nullptr)
+            {
+                kernel = steer_batch_scalar;
+#ifdef SDL_SSE2_INTRINSICS
+                if(SDL_HasSSE2())
+                {
+                    kernel = steer_batch_sse2;
+                }
+#endif
+#ifdef SDL_AVX2_INTRINSICS
+                if(SDL_HasAVX2())
+                {
+                    kernel = steer_batch_avx2;
+                }
+#endif
+#ifndef NDEBUG
+                if(!check_steering_kernel(kernel))
+                {
+                    SDL_assert(!"Simd steering kernel disagrees with the scalar one");
+                    kernel = steer_batch_scalar;
+                }
+#endif
+            }
+            return kernel;
+        }
+
+        void ensure_line_of_sight();
+        // runs over the padded lane count, lanes past batch.count are zero and never read back
+        deep::Steering_Batch& steer_enemies(const deep::Steering_Players& players)
+        {
+            DEEP_PROFILE_SCOPE("steer_enemies");
+            // perception checks in the game update query the table from jobs
+            ensure_line_of_sight();
+            schedule_ai(players);
+            gather_steering_batch(steering_batch);
+            Steering_Kernel kernel = get_steering_kernel();
+            // chunks of 8 lanes keep every kernel on its vector width
+            parallel_for(steering_batch.x.size() / 8, 64, [&](int begin, int end)
+            {
+                kernel(steering_batch, players, begin * 8, end * 8);
+            });
+            return steering_batch;
+        }
+    #pragma endregion Steering
+
+    #pragma region Assets
+        SDL_Surface* load_image(const char* image_filename, int desired_channels)
+        {
+            char full_path[256];
+            SDL_Surface *result;
+            SDL_PixelFormat format;
+
+            SDL_snprintf(full_path, sizeof(full_path), "ressources/images/%s", image_filename);
+
+            result = SDL_LoadBMP(full_path);
+            if (result == NULL)
+            {
+                SDL_Log("Failed to load BMP: %s", SDL_GetError());
+                return NULL;
+            }
+
+            if (desired_channels == 4)
+            {
+                format = SDL_PIXELFORMAT_ABGR8888;
+            }
+            else
+            {
+                SDL_assert(!"Unexpected desired_channels");
+                SDL_DestroySurface(result);
+                return NULL;
+            }
+            if (result->format != format)
+            {
+                SDL_Surface *next = SDL_ConvertSurface(result, format);
+                SDL_DestroySurface(result);
+                result = next;
+            }
+
+            return result;
+        }
+    #pragma endregion Assets
+
+    #pragma region Collision
+        Uint16 get_tile_walls(const Map& source, int x, int z)
+        {
+            int tile = get_tile(source.tiles, x, z);
+            if(tile == 0)
+            {
+                return 0;
+            }
+            const Map_Mesh& mesh = source.meshes[tile - 1];
+            return (mesh.is_collision_top ? Collision_Top : 0) | (mesh.is_collision_right ? Collision_Right : 0) |
+                (mesh.is_collision_bottom ? Collision_Bottom : 0) | (mesh.is_collision_left ? Collision_Left : 0);
+        }
+
+        // walls come from the tile itself, open tiles also get blocked by the wall ends of their diagonal neighbours
+        // only the occupied chunks are baked, memory and time follow the chunk count instead of the map area
+        void bake_collision_grid(const Map& source, Collision_Grid& grid)
+        {
+            grid.masks.assign(source.tiles.chunks.size() * MAP_CHUNK_TILES, Collision_Outside);
+            for(int chunk_id = 0; chunk_id < (int)source.tiles.chunks.size(); ++chunk_id)
+            {
+                const deep::Map_Chunk& chunk = source.tiles.chunks[chunk_id];
+                for(int local_z = 0; local_z < deep::MAP_CHUNK_SIZE; ++local_z)
+                {
+                    for(int local_x = 0; local_x < deep::MAP_CHUNK_SIZE; ++local_x)
+                    {
+                        int tile = chunk.tiles[local_z][local_x];
+                        if(tile == 0)
+                        {
+                            continue;
+                        }
+                        int x = chunk.origin.x + local_x;
+                        int z = chunk.origin.y + local_z;
+                        Uint16 mask = get_tile_walls(source, x, z);
+                        if(!source.meshes[tile - 1].has_any_collision)
+                        {
+                            mask |= (get_tile_walls(source, x + 1, z - 1) & (Collision_Bottom | Collision_Left)) ? Collision_Top_Right : 0;
+                            mask |= (get_tile_walls(source, x + 1, z + 1) & (Collision_Top | Collision_Left)) ? Collision_Bottom_Right : 0;
+                            mask |= (get_tile_walls(source, x - 1, z + 1) & (Collision_Top | Collision_Right)) ? Collision_Bottom_Left : 0;
+                            mask |= (get_tile_walls(source, x - 1, z - 1) & (Collision_Right | Collision_Bottom)) ? Collision_Top_Left : 0;
+                        }
+                        grid.masks[chunk_id * MAP_CHUNK_TILES + local_z * deep::MAP_CHUNK_SIZE + local_x] = mask;
+                    }
+                }
+            }
+            grid.map_version = source.version;
+        }
+
+        // squared distance along one axis from p to the unit block starting at block_min
+        inline float block_distance_squared(float p, float block_min)
+        {
+            float d = p - SDL_clamp(p, block_min, block_min + 1.0f);
+            return d * d;
+        }
+
+        // true when a circle moved from current to next would overlap a wall of the tile current stands in,
+        // positions are in world units, leaving the map always blocks
+        bool is_circle_blocked(glm::vec2 current, glm::vec2 next, float radius)
+        {
+            int current_x = static_cast<int>(SDL_floorf(current.x / 3.0f));
+            int current_z = static_cast<int>(SDL_floorf(current.y / 3.0f));
+            int size_x = map.tiles.size_x;
+            int size_y = map.tiles.size_y;
+            int slot = get_tile_slot(map.tiles, current_x, current_z);
+            Uint16 mask = slot < 0 ? Collision_Outside : collision_grid.masks[slot];
+
+            glm::vec2 p = next / 3.0f; // grid is 3 units
+            float r = radius / 3.0f;
+            float r_squared = r * r;
+
+            bool outside_map = (SDL_floorf(p.x - r) < 0.0f) | (SDL_ceilf(p.x + r) >= size_x) |
+                (SDL_floorf(p.y - r) < 0.0f) | (SDL_ceilf(p.y + r) >= size_y);
+
+            float left = block_distance_squared(p.x, current_x - 1.0f);
+            float center_x = block_distance_squared(p.x, (float)current_x);
+            float right = block_distance_squared(p.x, current_x + 1.0f);
+            float top = block_distance_squared(p.y, current_z - 1.0f);
+            float center_z = block_distance_squared(p.y, (float)current_z);
+            float bottom = block_distance_squared(p.y, current_z + 1.0f);
+
+            Uint16 touching = ((center_x + top < r_squared) ? Collision_Top : 0) |
+                ((right + center_z < r_squared) ? Collision_Right : 0) |
+                ((center_x + bottom < r_squared) ? Collision_Bottom : 0) |
+                ((left + center_z < r_squared) ? Collision_Left : 0) |
+                ((right + top < r_squared) ? Collision_Top_Right : 0) |
+                ((right + bottom < r_squared) ? Collision_Bottom_Right : 0) |
+                ((left + bottom < r_squared) ? Collision_Bottom_Left : 0) |
+                ((left + top < r_squared) ? Collision_Top_Left : 0);
+
+            return ((mask & Collision_Outside) == 0) & (outside_map | ((touching & mask) != 0));
+        }
+
+        void ensure_collision_grid()
+        {
+            if(collision_grid.map_version != map.version)
+            {
+                bake_collision_grid(map, collision_grid);
+            }
+        }
+
+        // moves along x first and then along z so the circle slides along walls instead of sticking to them
+        glm::vec2 slide_circle(glm::vec2 current, glm::vec2 desired, float radius)
+        {
+            glm::vec2 result = current;
+            glm::vec2 step_x = glm::vec2(desired.x, current.y);
+            result.x = is_circle_blocked(current, step_x, radius) ? current.x : desired.x;
+            glm::vec2 step_z = glm::vec2(result.x, desired.y);
+            result.y = is_circle_blocked(result, step_z, radius) ? current.y : desired.y;
+            return result;
+        }
+
+        glm::vec2 resolve_circle_move(glm::vec2 current, glm::vec2 desired, float radius)
+        {
+            DEEP_PROFILE_SCOPE("resolve_circle_move");
+            ensure_collision_grid();
+            return slide_circle(current, desired, radius);
+        }
+
+        // call ensure_collision_grid first when splitting a batch across jobs
+        void resolve_circle_moves(const glm::vec2* current, const glm::vec2* desired, const float* radii, glm::vec2* resolved, int count)
+        {
+            DEEP_PROFILE_SCOPE("resolve_circle_moves");
+            for(int i = 0; i < count; ++i)
+            {
+                resolved[i] = slide_circle(current[i], desired[i], radii[i]);
+            }
+        }
+    #pragma endregion Collision
+
+    #pragma region Camera
+        void camera_update_vectors(int id)
+        {
+            glm::vec3 front;
+            front.x = cos(glm::radians(cameras[id].yaw)) * cos(glm::radians(cameras[id].pitch));
+            front.y = sin(glm::radians(cameras[id].pitch));
+            front.z = sin(glm::radians(cameras[id].yaw)) * cos(glm::radians(cameras[id].pitch));
+            cameras[id].front = glm::normalize(front);
+            
+            cameras[id].right = glm::normalize(glm::cross(cameras[id].front, cameras[id].world_up));
+            cameras[id].up    = glm::normalize(glm::cross(cameras[id].right, cameras[id].front));
+        }
+
+        void camera_init(int id, glm::vec3 position)
+        {
+            cameras[id].position = position;
+            cameras[id].previous_position = position;
+            cameras[id].world_up = glm::vec3(0.0f, 1.0f, 0.0f);
+            cameras[id].yaw = -90.0f;
+            cameras[id].pitch = 0.0f;
+            camera_update_vectors(id);
+
+            cameras[id].movement_speed = 2.5f;
+            cameras[id].mouse_sensitivity = 0.1f;
+
+            float size_w = window_size_w;
+            float size_h = window_size_h;
+            if(deep::use_both_monitors)
+            {
+                size_w = size_w / 2;
+            }
+
+            cameras[id].projection = glm::perspective(glm::radians(45.0f), size_w / size_h, 0.1f, 100.0f);
+        }
+
+        glm::vec2 camera_get_position_2d(int id)
+        {
+            return glm::vec2(cameras[id].position.x, cameras[id].position.z);
+        }
+
+        glm::vec2 camera_get_direction_2d(int id)
+        {
+            glm::vec2 direction = glm::vec2(cameras[id].front.x, cameras[id].front.z);
+            float length = glm::length(direction);
+            return length > 0.0f ? direction / length : glm::vec2(0.0f, -1.0f);
+        }
+
+        // teleports, nothing is blended from the old position
+        void camera_set_position(int id, glm::vec3 position)
+        {
+            cameras[id].position = position;
+            cameras[id].previous_position = position;
+        }
+
+        glm::vec3 camera_get_render_position(int id)
+        {
+            return glm::mix(cameras[id].previous_position, cameras[id].position, simulation_clock.alpha);
+        }
+
+        glm::mat4 camera_get_view_matrix(int id)
+        {
+            glm::vec3 position = camera_get_render_position(id);
+            return glm::lookAt(position, position + cameras[id].front, cameras[id].up);
+        }
+
+        void camera_process_keyboard(int id, bool forward, bool back, bool left, bool right, bool up, bool down, float delta_time)
+        {
+            if(forward || back || left || right || up || down)
+            {
+                glm::vec3 movement = glm::vec3(0.0f, 0.0f, 0.0f);
+                if(forward || back || left || right)
+                {
+                    if(forward) { movement += cameras[id].front; }
+                    if(back) { movement -= cameras[id].front; }
+                    if(left) { movement -= cameras[id].right; }
+                    if(right) { movement += cameras[id].right; }
+                    movement.y = 0.0f;
+                    if (glm::length(movement) > 0.0001f) {
+                        movement = glm::normalize(movement);
+                    }
+                }
+
+                if(up) { movement.y += 1.0f; }
+                if(down) { movement.y -= 1.0f; }
+                if (glm::length(movement) > 0.0001 && !(forward || back || left || right)) {
+                    movement = glm::normalize(movement);
+                }
+
+                float velocity = cameras[id].movement_speed * delta_time;
+                glm::vec3 desired_position_change = movement * velocity;
+
+                float camera_collision_radius = 0.3f;
+
+                glm::vec2 current = glm::vec2(cameras[id].position.x, cameras[id].position.z);
+                glm::vec2 desired = current + glm::vec2(desired_position_change.x, desired_position_change.z);
+                glm::vec2 resolved = resolve_circle_move(current, desired, camera_collision_radius);
+                cameras[id].position.x = resolved.x;
+                cameras[id].position.z = resolved.y;
+
+                cameras[id].position.y += desired_position_change.y;
+            }
+        }
+
+        void camera_process_mouse_movement(int id, float x_offset, float y_offset, bool constrain_pitch)
+        {
+            x_offset *= cameras[id].mouse_sensitivity;
+            y_offset *= cameras[id].mouse_sensitivity;
+
+            cameras[id].yaw   += x_offset;
+            cameras[id].pitch += y_offset;
+
+            if (constrain_pitch)
+            {
+                if (cameras[id].pitch > 89.0f)
+                    cameras[id].pitch = 89.0f;
+                if (cameras[id].pitch < -89.0f)
+                    cameras[id].pitch = -89.0f;
+            }
+
+            camera_update_vectors(id);
+        } 
+    #pragma endregion Camera
+
+    #pragma region Mesh Optimization
+        struct Mesh_Optimization_Report
+        {
+            int vertex_count;
+            int triangle_count;
+            int cluster_count;
+            float acmr_before;
+            float acmr_after;
+        };
+
+        const int VERTEX_CACHE_SIZE = 32;       // cache modelled while ordering triangles
+        const int VERTEX_FIFO_SIZE = 16;        // cache modelled for acmr and cluster boundaries
+
+        // average cache miss ratio, vertex shader invocations per triangle with a fifo post-transform cache
+        float calculate_acmr(const std::vector<Uint16>& indices, int vertex_count)
+        {
+            int triangle_count = indices.size() / 3;
+            if(triangle_count == 0)
+            {
+                return 0.0f;
+            }
+
+            std::vector<int> cache_timestamps(vertex_count, -VERTEX_FIFO_SIZE - 1);
+            int timestamp = 0;
+            int misses = 0;
+            for(size_t i = 0; i < indices.size(); ++i)
+            {
+                Uint16 index = indices[i];
+                if(timestamp - cache_timestamps[index] > VERTEX_FIFO_SIZE)
+                {
+                    cache_timestamps[index] = timestamp;
+                    timestamp += 1;
+                    misses += 1;
+                }
+            }
+            return (float)misses / triangle_count;
+        }
+
+        float vertex_cache_score(int cache_position, int remaining_triangles)
+        {
+            if(remaining_triangles == 0)
+            {
+                return -1.0f;
+            }
+
+            float score = 0.0f;
+            if(cache_position >= 0)
+            {
+                if(cache_position < 3)
+                {
+                    // the last triangle's vertices get a fixed score so strips are not favoured over fans
+                    score = 0.75f;
+                }
+                else
+                {
+                    score = SDL_powf(1.0f - (cache_position - 3) * (1.0f / (VERTEX_CACHE_SIZE - 3)), 1.5f);
+                }
+            }
+            // prefer vertices with few remaining triangles so they leave the cache for good
+            score += 2.0f * SDL_powf((float)remaining_triangles, -0.5f);
+            return score;
+        }
+
+        // Forsyth's linear-speed vertex cache optimisation
+        void optimize_vertex_cache(std::vector<Uint16>& indices, int vertex_count)
+        {
+            int triangle_count = indices.size() / 3;
+            if(triangle_count == 0)
+            {
+                return;
+            }
+
+            // vertex to triangle adjacency
+            std::vector<int> remaining(vertex_count, 0);
+            for(int i = 0; i < triangle_count * 3; ++i)
+            {
+                remaining[indices[i]] += 1;
+            }
+            std::vector<int> adjacency_offsets(vertex_count + 1, 0);
+            for(int v = 0; v < vertex_count; ++v)
+            {
+                adjacency_offsets[v + 1] = adjacency_offsets[v] + remaining[v];
+            }
+            std::vector<int> adjacency(triangle_count * 3);
+            std::vector<int> fill = adjacency_offsets;
+            for(int t = 0; t < triangle_count; ++t)
+            {
+                for(int k = 0; k < 3; ++k)
+                {
+                    adjacency[fill[indices[t * 3 + k]]++] = t;
+                }
+            }
+
+            std::vector<int> cache_position(vertex_count, -1);
+            std::vector<float> vertex_score(vertex_count);
+            for(int v = 0; v < vertex_count; ++v)
+            {
+                vertex_score[v] = vertex_cache_score(-1, remaining[v]);
+            }
+            std::vector<float> triangle_score(triangle_count);
+            std::vector<bool> emitted(triangle_count, false);
+            int best_triangle = 0;
+            for(int t = 0; t < triangle_count; ++t)
+            {
+                triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+                if(triangle_score[t] > triangle_score[best_triangle])
+                {
+                    best_triangle = t;
+                }
+            }
+
+            int cache[VERTEX_CACHE_SIZE + 3];
+            int cache_count = 0;
+            int restart_cursor = 0; // everything before it is emitted
+            std::vector<Uint16> result;
+            result.reserve(triangle_count * 3);
+
+            for(int emitted_count = 0; emitted_count < triangle_count; ++emitted_count)
+            {
+                if(best_triangle == -1)
+                {
+                    // nothing in the cache is connected to the rest, start over at the first remaining triangle in input order,
+                    // the cursor only moves forward so restarts cost O(triangle_count) in total
+                    while(emitted[restart_cursor])
+                    {
+                        restart_cursor += 1;
+                    }
+                    best_triangle = restart_cursor;
+                }
+
+                int t = best_triangle;
+                emitted[t] = true;
+                int triangle[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+                result.push_back(triangle[0]);
+                result.push_back(triangle[1]);
+                result.push_back(triangle[2]);
+
+                // remove the triangle from the adjacency of its vertices
+                for(int k = 0; k < 3; ++k)
+                {
+                    int v = triangle[k];
+                    int begin = adjacency_offsets[v];
+                    int end = begin + remaining[v];
+                    for(int a = begin; a < end; ++a)
+                    {
+                        if(adjacency[a] == t)
+                        {
+                            adjacency[a] = adjacency[end - 1];
+                            break;
+                        }
+                    }
+                    remaining[v] -= 1;
+                }
+
+                // move the triangle's vertices to the front of the lru cache
+                int new_cache[VERTEX_CACHE_SIZE + 3];
+                int new_cache_count = 0;
+                for(int k = 0; k < 3; ++k)
+                {
+                    new_cache[new_cache_count++] = triangle[k];
+                }
+                for(int c = 0; c < cache_count; ++c)
+                {
+                    int v = cache[c];
+                    if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+                    {
+                        new_cache[new_cache_count++] = v;
+                    }
+                }
+
+                for(int c = 0; c < new_cache_count; ++c)
+                {
+                    int v = new_cache[c];
+                    cache_position[v] = c < VERTEX_CACHE_SIZE ? c : -1;
+                    vertex_score[v] = vertex_cache_score(cache_position[v], remaining[v]);
+                }
+
+                // only triangles touching the cache changed their score
+                best_triangle = -1;
+                float best_score = -1.0f;
+                for(int c = 0; c < new_cache_count; ++c)
+                {
+                    int v = new_cache[c];
+                    for(int a = adjacency_offsets[v]; a < adjacency_offsets[v] + remaining[v]; ++a)
+                    {
+                        int other = adjacency[a];
+                        triangle_score[other] = vertex_score[indices[other * 3]] + vertex_score[indices[other * 3 + 1]] + vertex_score[indices[other * 3 + 2]];
+                        if(triangle_score[other] > best_score)
+                        {
+                            best_score = triangle_score[other];
+                            best_triangle = other;
+                        }
+                    }
+                }
+
+                cache_count = new_cache_count < VERTEX_CACHE_SIZE ? new_cache_count : VERTEX_CACHE_SIZE;
+                SDL_memcpy(cache, new_cache, cache_count * sizeof(int));
+            }
+
+            indices.swap(result);
+        }
+
+        // splits the cache optimised order into clusters at cache restarts and draws outward facing clusters first
+        int optimize_overdraw(std::vector<Uint16>& indices, const std::vector<Vertex>& vertices)
+        {
+            int triangle_count = indices.size() / 3;
+            if(triangle_count == 0)
+            {
+                return 0;
+            }
+
+            // a triangle that misses the cache with all three vertices is a hard boundary, reordering there is free
+            std::vector<int> cluster_starts;
+            std::vector<int> cache_timestamps(vertices.size(), -VERTEX_FIFO_SIZE - 1);
+            int timestamp = 0;
+            for(int t = 0; t < triangle_count; ++t)
+            {
+                int misses = 0;
+                for(int k = 0; k < 3; ++k)
+                {
+                    Uint16 index = indices[t * 3 + k];
+                    if(timestamp - cache_timestamps[index] > VERTEX_FIFO_SIZE)
+                    {
+                        cache_timestamps[index] = timestamp;
+                        timestamp += 1;
+                        misses += 1;
+                    }
+                }
+                if(t == 0 || misses == 3)
+                {
+                    cluster_starts.push_back(t);
+                }
+            }
+            int cluster_count = cluster_starts.size();
+            cluster_starts.push_back(triangle_count);
+
+            glm::vec3 mesh_center = glm::vec3(0.0f, 0.0f, 0.0f);
+            for(size_t v = 0; v < vertices.size(); ++v)
+            {
+                mesh_center += glm::vec3(vertices[v].position[0], vertices[v].position[1], vertices[v].position[2]);
+            }
+            mesh_center /= (float)vertices.size();
+
+            // sort key is how far the cluster faces away from the mesh center
+            std::vector<float> cluster_keys(cluster_count);
+            for(int c = 0; c < cluster_count; ++c)
+            {
+                glm::vec3 center = glm::vec3(0.0f, 0.0f, 0.0f);
+                glm::vec3 normal = glm::vec3(0.0f, 0.0f, 0.0f);
+                float area = 0.0f;
+                for(int t = cluster_starts[c]; t < cluster_starts[c + 1]; ++t)
+                {
+                    const float* p0 = vertices[indices[t * 3]].position;
+                    const float* p1 = vertices[indices[t * 3 + 1]].position;
+                    const float* p2 = vertices[indices[t * 3 + 2]].position;
+                    glm::vec3 a = glm::vec3(p0[0], p0[1], p0[2]);
+                    glm::vec3 b = glm::vec3(p1[0], p1[1], p1[2]);
+                    glm::vec3 d = glm::vec3(p2[0], p2[1], p2[2]);
+                    glm::vec3 face_normal = glm::cross(b - a, d - a);
+                    float face_area = glm::length(face_normal);
+                    center += (a + b + d) * (face_area / 3.0f);
+                    normal += face_normal;
+                    area += face_area;
+                }
+                if(area > 0.0f)
+                {
+                    center /= area;
+                }
+                float normal_length = glm::length(normal);
+                cluster_keys[c] = normal_length > 0.0f ? glm::dot(center - mesh_center, normal / normal_length) : 0.0f;
+            }
+
+            std::vector<int> cluster_order(cluster_count);
+            for(int c = 0; c < cluster_count; ++c)
+            {
+                cluster_order[c] = c;
+            }
+            std::stable_sort(cluster_order.begin(), cluster_order.end(), [&](int a, int b) { return cluster_keys[a] > cluster_keys[b]; });
+
+            std::vector<Uint16> result;
+            result.reserve(indices.size());
+            for(int c = 0; c < cluster_count; ++c)
+            {
+                int cluster = cluster_order[c];
+                result.insert(result.end(), indices.begin() + cluster_starts[cluster] * 3, indices.begin() + cluster_starts[cluster + 1] * 3);
+            }
+            indices.swap(result);
+            return cluster_count;
+        }
+
+        // stores vertices in the order the index buffer first uses them, unused vertices are dropped
+        void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<Uint16>& indices)
+        {
+            std::vector<int> remap(vertices.size(), -1);
+            std::vector<Vertex> result;
+            result.reserve(vertices.size());
+            for(size_t i = 0; i < indices.size(); ++i)
+            {
+                Uint16 index = indices[i];
+                if(remap[index] == -1)
+                {
+                    remap[index] = result.size();
+                    result.push_back(vertices[index]);
+                }
+                indices[i] = remap[index];
+            }
+            vertices.swap(result);
+        }
+
+        // pure cpu work, safe on loader threads and in offline tools
+        Mesh_Optimization_Report optimize_mesh(std::vector<Vertex>& vertices, std::vector<Uint16>& indices)
+        {
+            Mesh_Optimization_Report report{};
+            report.vertex_count = vertices.size();
+            report.triangle_count = indices.size() / 3;
+            report.acmr_before = calculate_acmr(indices, vertices.size());
+
+            optimize_vertex_cache(indices, vertices.size());
+            report.cluster_count = optimize_overdraw(indices, vertices);
+            optimize_vertex_fetch(vertices, indices);
+
+            report.acmr_after = calculate_acmr(indices, vertices.size());
+            return report;
+        }
+    #pragma endregion Mesh Optimization
+
+    #pragma region Texture Compression
+        enum Texture_Encoding
+        {
+            Texture_Encoding_RGBA8,
+            Texture_Encoding_BC1,       // rgb, 8 bytes per 4x4 block
+            Texture_Encoding_BC4,       // single channel, 8 bytes per 4x4 block
+            Texture_Encoding_BC7        // rgba, 16 bytes per 4x4 block
+        };
+
+        struct Texture_Level
+        {
+            int width;
+            int height;
+            std::vector<Uint8> data;
+        };
+
+        const int TEXTURE_MAX_ERROR = 8; // largest per channel difference a compressed texel may have before we keep rgba8
+
+        // level 0 is a tightly packed copy of the rgba8 pixels, every further level is a 2x2 box filter of the previous one
+        std::vector<Texture_Level> build_mip_chain(const Uint8* pixels, int width, int height, int pitch, bool mipmapped)
+        {
+            std::vector<Texture_Level> levels(1);
+            levels[0].width = width;
+            levels[0].height = height;
+            levels[0].data.resize(width * height * 4);
+            for(int y = 0; y < height; ++y)
+            {
+                SDL_memcpy(&levels[0].data[y * width * 4], pixels + y * pitch, width * 4);
+            }
+
+            while(mipmapped && (levels.back().width > 1 || levels.back().height > 1))
+            {
+                const Texture_Level& source = levels.back();
+                Texture_Level level;
+                level.width = source.width > 1 ? source.width / 2 : 1;
+                level.height = source.height > 1 ? source.height / 2 : 1;
+                level.data.resize(level.width * level.height * 4);
+                for(int y = 0; y < level.height; ++y)
+                {
+                    for(int x = 0; x < level.width; ++x)
+                    {
+                        int x0 = SDL_min(x * 2, source.width - 1);
+                        int x1 = SDL_min(x * 2 + 1, source.width - 1);
+                        int y0 = SDL_min(y * 2, source.height - 1);
+                        int y1 = SDL_min(y * 2 + 1, source.height - 1);
+                        for(int c = 0; c < 4; ++c)
+                        {
+                            int sum = source.data[(y0 * source.width + x0) * 4 + c] + source.data[(y0 * source.width + x1) * 4 + c]
+                                    + source.data[(y1 * source.width + x0) * 4 + c] + source.data[(y1 * source.width + x1) * 4 + c];
+                            level.data[(y * level.width + x) * 4 + c] = (Uint8)((sum + 2) / 4);
+                        }
+                    }
+                }
+                levels.push_back(level);
+            }
+            return levels;
+        }
+
+        // principal axis of the block colors, used to pick endpoints that span the block
+        glm::vec4 block_principal_axis(const Uint8* texels, int channels, glm::vec4& mean)
+        {
+            mean = glm::vec4(0.0f);
+            for(int i = 0; i < 16; ++i)
+            {
+                for(int c = 0; c < channels; ++c)
+                {
+                    mean[c] += texels[i * 4 + c] / 16.0f;
+                }
+            }
+
+            float covariance[4][4] = {};
+            for(int i = 0; i < 16; ++i)
+            {
+                float d[4] = {};
+                for(int c = 0; c < channels; ++c)
+                {
+                    d[c] = texels[i * 4 + c] - mean[c];
+                }
+                for(int a = 0; a < channels; ++a)
+                {
+                    for(int b = 0; b < channels; ++b)
+                    {
+                        covariance[a][b] += d[a] * d[b];
+                    }
+                }
+            }
+
+            // power iteration
+            glm::vec4 axis = glm::vec4(1.0f, 1.0f, 1.0f, channels == 4 ? 1.0f : 0.0f);
+            for(int iteration = 0; iteration < 8; ++iteration)
+            {
+                glm::vec4 next = glm::vec4(0.0f);
+                for(int a = 0; a < channels; ++a)
+                {
+                    for(int b = 0; b < channels; ++b)
+                    {
+                        next[a] += covariance[a][b] * axis[b];
+                    }
+                }
+                float length = glm::length(next);
+                if(length < 0.0001f)
+                {
+                    break;
+                }
+                axis = next / length;
+            }
+            return axis;
+        }
+
+        void block_endpoints(const Uint8* texels, int channels, glm::vec4& low, glm::vec4& high)
+        {
+            glm::vec4 mean;
+            glm::vec4 axis = block_principal_axis(texels, channels, mean);
+            float min_t = 0.0f;
+            float max_t = 0.0f;
+            for(int i = 0; i < 16; ++i)
+            {
+                float t = 0.0f;
+                for(int c = 0; c < channels; ++c)
+                {
+                    t += (texels[i * 4 + c] - mean[c]) * axis[c];
+                }
+                min_t = SDL_min(min_t, t);
+                max_t = SDL_max(max_t, t);
+            }
+            low = mean + axis * min_t;
+            high = mean + axis * max_t;
+        }
+
+        int color_distance(const Uint8* a, const int* b, int channels)
+        {
+            int distance = 0;
+            for(int c = 0; c < channels; ++c)
+            {
+                int d = a[c] - b[c];
+                distance += d * d;
+            }
+            return distance;
+        }
+
+        // picks the nearest palette entry for every texel, returns the largest per channel error
+        int choose_indices(const Uint8* texels, const int palette[][4], int palette_count, int channels, int* indices)
+        {
+            int max_error = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                int best = 0;
+                int best_distance = color_distance(&texels[i * 4], palette[0], channels);
+                for(int p = 1; p < palette_count; ++p)
+                {
+                    int distance = color_distance(&texels[i * 4], palette[p], channels);
+                    if(distance < best_distance)
+                    {
+                        best = p;
+                        best_distance = distance;
+                    }
+                }
+                indices[i] = best;
+                for(int c = 0; c < channels; ++c)
+                {
+                    max_error = SDL_max(max_error, SDL_abs(texels[i * 4 + c] - palette[best][c]));
+                }
+            }
+            return max_error;
+        }
+
+        int encode_bc1_block(const Uint8* texels, Uint8* out)
+        {
+            glm::vec4 low, high;
+            block_endpoints(texels, 3, low, high);
+
+            // rgb565 endpoints, color0 > color1 selects the opaque four color mode
+            Uint16 color0 = ((int)glm::clamp(high.x * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f) << 11) | ((int)glm::clamp(high.y * 63.0f / 255.0f + 0.5f, 0.0f, 63.0f) << 5) | (int)glm::clamp(high.z * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+            Uint16 color1 = ((int)glm::clamp(low.x * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f) << 11) | ((int)glm::clamp(low.y * 63.0f / 255.0f + 0.5f, 0.0f, 63.0f) << 5) | (int)glm::clamp(low.z * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+            if(color0 < color1)
+            {
+                Uint16 swap = color0;
+                color0 = color1;
+                color1 = swap;
+            }
+
+            int palette[4][4] = {};
+            Uint16 colors[2] = { color0, color1 };
+            for(int e = 0; e < 2; ++e)
+            {
+                int r = (colors[e] >> 11) & 31;
+                int g = (colors[e] >> 5) & 63;
+                int b = colors[e] & 31;
+                palette[e][0] = (r << 3) | (r >> 2);
+                palette[e][1] = (g << 2) | (g >> 4);
+                palette[e][2] = (b << 3) | (b >> 2);
+                palette[e][3] = 255;
+            }
+            int palette_count = 2;
+            if(color0 > color1)
+            {
+                for(int c = 0; c < 3; ++c)
+                {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                palette_count = 4;
+            }
+
+            int indices[16];
+            int max_error = choose_indices(texels, palette, palette_count, 3, indices);
+
+            Uint32 index_bits = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                index_bits |= (Uint32)indices[i] << (i * 2);
+            }
+            out[0] = color0 & 0xFF;
+            out[1] = color0 >> 8;
+            out[2] = color1 & 0xFF;
+            out[3] = color1 >> 8;
+            for(int i = 0; i < 4; ++i)
+            {
+                out[4 + i] = (index_bits >> (i * 8)) & 0xFF;
+            }
+            return max_error;
+        }
+
+        int encode_bc4_block(const Uint8* texels, Uint8* out)
+        {
+            int red0 = 0;
+            int red1 = 255;
+            for(int i = 0; i < 16; ++i)
+            {
+                red0 = SDL_max(red0, (int)texels[i * 4]);
+                red1 = SDL_min(red1, (int)texels[i * 4]);
+            }
+
+            // red0 > red1 selects the eight value mode
+            int palette[8][4] = {};
+            palette[0][0] = red0;
+            palette[1][0] = red1;
+            for(int p = 1; p < 7; ++p)
+            {
+                palette[p + 1][0] = ((7 - p) * red0 + p * red1 + 3) / 7;
+            }
+
+            int indices[16];
+            int max_error = choose_indices(texels, palette, red0 > red1 ? 8 : 1, 1, indices);
+
+            Uint64 index_bits = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                index_bits |= (Uint64)indices[i] << (i * 3);
+            }
+            out[0] = red0;
+            out[1] = red1;
+            for(int i = 0; i < 6; ++i)
+            {
+                out[2 + i] = (index_bits >> (i * 8)) & 0xFF;
+            }
+            return max_error;
+        }
+
+        void write_block_bits(Uint8* out, int& position, Uint32 value, int count)
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                out[position >> 3] |= ((value >> i) & 1) << (position & 7);
+                position += 1;
+            }
+        }
+
+        // mode 6: one subset, rgba 7.7.7.7 endpoints with a p-bit each and 4 bit indices
+        int encode_bc7_block(const Uint8* texels, Uint8* out)
+        {
+            glm::vec4 endpoints[2];
+            block_endpoints(texels, 4, endpoints[0], endpoints[1]);
+
+            // quantize to 7 bits plus the p-bit that gives the smaller error
+            int quantized[2][4];
+            int p_bits[2];
+            for(int e = 0; e < 2; ++e)
+            {
+                float best_error = 1e30f;
+                for(int p = 0; p < 2; ++p)
+                {
+                    float error = 0.0f;
+                    int candidate[4];
+                    for(int c = 0; c < 4; ++c)
+                    {
+                        candidate[c] = (int)glm::clamp((endpoints[e][c] - p) / 2.0f + 0.5f, 0.0f, 127.0f);
+                        float d = ((candidate[c] << 1) | p) - endpoints[e][c];
+                        error += d * d;
+                    }
+                    if(error < best_error)
+                    {
+                        best_error = error;
+                        p_bits[e] = p;
+                        SDL_memcpy(quantized[e], candidate, sizeof(candidate));
+                    }
+                }
+            }
+
+            const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+            int palette[16][4];
+            for(int p = 0; p < 16; ++p)
+            {
+                for(int c = 0; c < 4; ++c)
+                {
+                    int a = (quantized[0][c] << 1) | p_bits[0];
+                    int b = (quantized[1][c] << 1) | p_bits[1];
+                    palette[p][c] = ((64 - weights[p]) * a + weights[p] * b + 32) >> 6;
+                }
+            }
+
+            int indices[16];
+            int max_error = choose_indices(texels, palette, 16, 4, indices);
+
+            // the most significant index bit of the first texel is implied zero
+            if(indices[0] & 8)
+            {
+                for(int c = 0; c < 4; ++c)
+                {
+                    int swap = quantized[0][c];
+                    quantized[0][c] = quantized[1][c];
+                    quantized[1][c] = swap;
+                }
+                int swap = p_bits[0];
+                p_bits[0] = p_bits[1];
+                p_bits[1] = swap;
+                for(int i = 0; i < 16; ++i)
+                {
+                    indices[i] = 15 - indices[i];
+                }
+            }
+
+            SDL_memset(out, 0, 16);
+            int position = 0;
+            write_block_bits(out, position, 1 << 6, 7);
+            for(int c = 0; c < 4; ++c)
+            {
+                write_block_bits(out, position, quantized[0][c], 7);
+                write_block_bits(out, position, quantized[1][c], 7);
+            }
+            write_block_bits(out, position, p_bits[0], 1);
+            write_block_bits(out, position, p_bits[1], 1);
+            write_block_bits(out, position, indices[0], 3);
+            for(int i = 1; i < 16; ++i)
+            {
+                write_block_bits(out, position, indices[i], 4);
+            }
+            return max_error;
+        }
+
+        int get_block_size(Texture_Encoding encoding)
+        {
+            return encoding == Texture_Encoding_BC7 ? 16 : 8;
+        }
+
+        // compresses every level in place, levels smaller than a block are padded by repeating the edge texels
+        int compress_texture(std::vector<Texture_Level>& levels, Texture_Encoding encoding)
+        {
+            int max_error = 0;
+            int block_size = get_block_size(encoding);
+            for(size_t l = 0; l < levels.size(); ++l)
+            {
+                Texture_Level& level = levels[l];
+                int blocks_x = (level.width + 3) / 4;
+                int blocks_y = (level.height + 3) / 4;
+                std::vector<Uint8> compressed(blocks_x * blocks_y * block_size);
+
+                for(int by = 0; by < blocks_y; ++by)
+                {
+                    for(int bx = 0; bx < blocks_x; ++bx)
+                    {
+                        Uint8 texels[16 * 4];
+                        for(int y = 0; y < 4; ++y)
+                        {
+                            for(int x = 0; x < 4; ++x)
+                            {
+                                int source_x = SDL_min(bx * 4 + x, level.width - 1);
+                                int source_y = SDL_min(by * 4 + y, level.height - 1);
+                                SDL_memcpy(&texels[(y * 4 + x) * 4], &level.data[(source_y * level.width + source_x) * 4], 4);
+                            }
+                        }
+
+                        Uint8* out = &compressed[(by * blocks_x + bx) * block_size];
+                        int error = 0;
+                        switch(encoding)
+                        {
+                            case Texture_Encoding_BC1: error = encode_bc1_block(texels, out); break;
+                            case Texture_Encoding_BC4: error = encode_bc4_block(texels, out); break;
+                            case Texture_Encoding_BC7: error = encode_bc7_block(texels, out); break;
+                            default: break;
+                        }
+                        max_error = SDL_max(max_error, error);
+                    }
+                }
+                level.data.swap(compressed);
+            }
+            return max_error;
+        }
+
+        SDL_GPUTextureFormat get_texture_format(Texture_Encoding encoding)
+        {
+            switch(encoding)
+            {
+                case Texture_Encoding_BC1: return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM;
+                case Texture_Encoding_BC4: return SDL_GPU_TEXTUREFORMAT_BC4_R_UNORM;
+                case Texture_Encoding_BC7: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM;
+                default: return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
+            }
+        }
+    #pragma endregion Texture Compression
+
+    #pragma region Chunk Streaming
+        void release_chunk_mesh(int chunk)
+        {
+            Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+            if(mesh.vertex_buffer)
+            {
+                SDL_ReleaseGPUBuffer(render_context.device, mesh.vertex_buffer);
+                SDL_ReleaseGPUBuffer(render_context.device, mesh.index_buffer);
+            }
+            chunk_streamer.resident_bytes -= mesh.bytes;
+            mesh = Chunk_Mesh{};
+        }
+
+        void release_all_chunk_meshes()
+        {
+            for(int chunk : chunk_streamer.resident)
+            {
+                release_chunk_mesh(chunk);
+            }
+            chunk_streamer.resident.clear();
+        }
+
+        // least recently wanted first, chunks a camera wants this frame are never evicted
+        bool evict_chunk_mesh()
+        {
+            int oldest = -1;
+            for(int i = 0; i < (int)chunk_streamer.resident.size(); ++i)
+            {
+                Uint64 last_used = chunk_streamer.meshes[chunk_streamer.resident[i]].last_used;
+                if(last_used < chunk_streamer.frame && (oldest == -1 || last_used < chunk_streamer.meshes[chunk_streamer.resident[oldest]].last_used))
+                {
+                    oldest = i;
+                }
+            }
+            if(oldest == -1)
+            {
+                return false;
+            }
+            release_chunk_mesh(chunk_streamer.resident[oldest]);
+            chunk_streamer.resident[oldest] = chunk_streamer.resident.back();
+            chunk_streamer.resident.pop_back();
+            return true;
+        }
+
+        // marks the chunk resident right away, its buffers are filled by upload_chunk_builds before anything draws
+        void queue_chunk_build(int chunk)
+        {
+            Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+            mesh.resident = true;
+            mesh.last_used = chunk_streamer.frame;
+            chunk_streamer.resident.push_back(chunk);
+            chunk_streamer.builds[chunk_streamer.build_count].chunk = chunk;
+            chunk_streamer.build_count += 1;
+        }
+
+        // only reads the tiles and the map geometry, safe to call from a job
+        void merge_chunk_geometry(Chunk_Build& build)
+        {
+            const deep::Map_Chunk& tiles = map.tiles.chunks[build.chunk];
+            std::vector<Vertex>& vertices = build.vertices;
+            std::vector<Uint32>& indices = build.indices;
+            vertices.clear();
+            indices.clear();
+            for(int local_z = 0; local_z < deep::MAP_CHUNK_SIZE; ++local_z)
+            {
+                for(int local_x = 0; local_x < deep::MAP_CHUNK_SIZE; ++local_x)
+                {
+                    int tile = tiles.tiles[local_z][local_x];
+                    if(tile == 0)
+                    {
+                        continue;
+                    }
+                    const Map_Geometry& geometry = chunk_streamer.geometry[tile - 1];
+                    float offset_x = (tiles.origin.x + local_x) * 3.0f + 1.5f;
+                    float offset_z = (tiles.origin.y + local_z) * 3.0f + 1.5f;
+                    Uint32 base = vertices.size();
+                    for(Vertex vertex : geometry.vertices)
+                    {
+                        vertex.position[0] += offset_x;
+                        vertex.position[2] += offset_z;
+                        vertices.push_back(vertex);
+                    }
+                    for(Uint16 index : geometry.indices)
+                    {
+                        indices.push_back(base + index);
+                    }
+                }
+            }
+        }
+
+        // every chunk merged this frame goes through one transfer buffer and one copy pass, like upload_meshes
+        void upload_chunk_builds()
+        {
+            Uint32 transfer_size = 0;
+            for(int i = 0; i < chunk_streamer.build_count; ++i)
+            {
+                Chunk_Build& build = chunk_streamer.builds[i];
+                if(build.indices.empty())
+                {
+                    continue;
+                }
+                Chunk_Mesh& mesh = chunk_streamer.meshes[build.chunk];
+                glm::vec3 bounds_min = glm::vec3(build.vertices[0].position[0], build.vertices[0].position[1], build.vertices[0].position[2]);
+                glm::vec3 bounds_max = bounds_min;
+                for(const Vertex& vertex : build.vertices)
+                {
+                    glm::vec3 position = glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]);
+                    bounds_min = glm::min(bounds_min, position);
+                    bounds_max = glm::max(bounds_max, position);
+                }
+                mesh.center = (bounds_min + bounds_max) * 0.5f;
+                mesh.radius = glm::length(bounds_max - mesh.center);
+
+                Uint32 vertex_size = build.vertices.size() * sizeof(Vertex);
+                Uint32 index_size = build.indices.size() * sizeof(Uint32);
+                SDL_GPUBufferCreateInfo vertex_buffer_info{};
+                vertex_buffer_info.size = vertex_size;
+                vertex_buffer_info.usage = SDL_GPU_BUFFERUSAGE_VERTEX;
+                mesh.vertex_buffer = SDL_CreateGPUBuffer(render_context.device, &vertex_buffer_info);
+                SDL_GPUBufferCreateInfo index_buffer_info{};
+                index_buffer_info.size = index_size;
+                index_buffer_info.usage = SDL_GPU_BUFFERUSAGE_INDEX;
+                mesh.index_buffer = SDL_CreateGPUBuffer(render_context.device, &index_buffer_info);
+                mesh.index_count = build.indices.size();
+                mesh.bytes = vertex_size + index_size;
+                chunk_streamer.resident_bytes += mesh.bytes;
+                transfer_size += mesh.bytes;
+            }
+            if(transfer_size == 0)
+            {
+                return;
+            }
+
+            SDL_GPUTransferBufferCreateInfo transfer_info{};
+            transfer_info.size = transfer_size;
+            transfer_info.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
+            SDL_GPUTransferBuffer* transfer_buffer = SDL_CreateGPUTransferBuffer(render_context.device, &transfer_info);
+            Uint8* transfer_data = (Uint8*)SDL_MapGPUTransferBuffer(render_context.device, transfer_buffer, false);
+            Uint32 offset = 0;
+            for(int i = 0; i < chunk_streamer.build_count; ++i)
+            {
+                Chunk_Build& build = chunk_streamer.builds[i];
+                SDL_memcpy(transfer_data + offset, build.vertices.data(), build.vertices.size() * sizeof(Vertex));
+                offset += build.vertices.size() * sizeof(Vertex);
+                SDL_memcpy(transfer_data + offset, build.indices.data(), build.indices.size() * sizeof(Uint32));
+                offset += build.indices.size() * sizeof(Uint32);
+            }
+            SDL_UnmapGPUTransferBuffer(render_context.device, transfer_buffer);
+
+            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
+            SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(command_buffer);
+            offset = 0;
+            for(int i = 0; i < chunk_streamer.build_count; ++i)
+            {
+                Chunk_Build& build = chunk_streamer.builds[i];
+                if(build.indices.empty())
+                {
+                    continue;
+                }
+                Chunk_Mesh& mesh = chunk_streamer.meshes[build.chunk];
+                SDL_GPUTransferBufferLocation vertex_location{};
+                vertex_location.transfer_buffer = transfer_buffer;
+                vertex_location.offset = offset;
+                SDL_GPUBufferRegion vertex_region{};
+                vertex_region.buffer = mesh.vertex_buffer;
+                vertex_region.size = build.vertices.size() * sizeof(Vertex);
+                SDL_UploadToGPUBuffer(copy_pass, &vertex_location, &vertex_region, false);
+                offset += vertex_region.size;
+
+                SDL_GPUTransferBufferLocation index_location{};
+                index_location.transfer_buffer = transfer_buffer;
+                index_location.offset = offset;
+                SDL_GPUBufferRegion index_region{};
+                index_region.buffer = mesh.index_buffer;
+                index_region.size = build.indices.size() * sizeof(Uint32);
+                SDL_UploadToGPUBuffer(copy_pass, &index_location, &index_region, false);
+                offset += index_region.size;
+            }
+            SDL_EndGPUCopyPass(copy_pass);
+            SDL_SubmitGPUCommandBuffer(command_buffer);
+            SDL_ReleaseGPUTransferBuffer(render_context.device, transfer_buffer);
+        }
+
+        int compare_chunk_requests(const void* a, const void* b)
+        {
+            float x = static_cast<const Chunk_Request*>(a)->distance;
+            float y = static_cast<const Chunk_Request*>(b)->distance;
+            return (x > y) - (x < y);
+        }
+
+        // chunks within distance of center on the xz plane, needed ones that aren't resident yet are collected for building, the rest are queued for prefetching
+        void want_chunks_near(glm::vec2 center, float distance, bool needed)
+        {
+            const deep::Tile_Map& tiles = map.tiles;
+            const float CHUNK_WORLD_SIZE = deep::MAP_CHUNK_SIZE * 3.0f;
+            int min_x = SDL_max(static_cast<int>(SDL_floorf((center.x - distance) / CHUNK_WORLD_SIZE)), 0);
+            int min_z = SDL_max(static_cast<int>(SDL_floorf((center.y - distance) / CHUNK_WORLD_SIZE)), 0);
+            int max_x = SDL_min(static_cast<int>(SDL_floorf((center.x + distance) / CHUNK_WORLD_SIZE)), tiles.chunks_x - 1);
+            int max_z = SDL_min(static_cast<int>(SDL_floorf((center.y + distance) / CHUNK_WORLD_SIZE)), tiles.chunks_y - 1);
+            for(int z = min_z; z <= max_z; ++z)
+            {
+                for(int x = min_x; x <= max_x; ++x)
+                {
+                    int chunk = tiles.chunk_index[z * tiles.chunks_x + x];
+                    if(chunk < 0)
+                    {
+                        continue;
+                    }
+                    glm::vec2 chunk_min = glm::vec2(x, z) * CHUNK_WORLD_SIZE;
+                    glm::vec2 nearest = glm::clamp(center, chunk_min, chunk_min + CHUNK_WORLD_SIZE);
+                    float chunk_distance = glm::length(center - nearest);
+                    if(chunk_distance > distance)
+                    {
+                        continue;
+                    }
+                    Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+                    if(needed)
+                    {
+                        // another camera may have collected it already this frame
+                        if(!mesh.resident && mesh.last_used != chunk_streamer.frame)
+                        {
+                            chunk_streamer.needed.push_back({ chunk, chunk_distance });
+                        }
+                        mesh.last_used = chunk_streamer.frame;
+                    }
+                    else if(mesh.last_used != chunk_streamer.frame)
+                    {
+                        chunk_streamer.prefetch.push_back(chunk);
+                    }
+                }
+            }
+        }
+
+        // keeps the chunks around every camera resident and builds a few more ahead of where they move, then evicts down to the budget.
+        // builds are capped per frame, merged on the workers and uploaded in one copy pass
+        void stream_chunks(int viewport_count)
+        {
+            DEEP_PROFILE_SCOPE("stream_chunks");
+            if(chunk_streamer.map_version != map.version)
+            {
+                release_all_chunk_meshes();
+                chunk_streamer.meshes.assign(map.tiles.chunks.size(), Chunk_Mesh{});
+                chunk_streamer.map_version = map.version;
+            }
+            chunk_streamer.frame += 1;
+            chunk_streamer.needed.clear();
+            chunk_streamer.prefetch.clear();
+            chunk_streamer.build_count = 0;
+
+            for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+            {
+                glm::vec3 position = camera_get_render_position(vp_id);
+                glm::vec2 moved = glm::vec2(position.x - chunk_streamer.previous_position[vp_id].x, position.z - chunk_streamer.previous_position[vp_id].z);
+                // standing still keeps the last direction, turning around is what needs the prefetch
+                if(glm::length(moved) > 0.01f)
+                {
+                    chunk_streamer.direction[vp_id] = glm::normalize(moved);
+                }
+                chunk_streamer.previous_position[vp_id] = position;
+                want_chunks_near(glm::vec2(position.x, position.z), CHUNK_STREAM_DISTANCE, true);
+            }
+
+            // a new map wants every chunk at once, the ones under the cameras come first
+            SDL_qsort(chunk_streamer.needed.data(), chunk_streamer.needed.size(), sizeof(Chunk_Request), compare_chunk_requests);
+            for(const Chunk_Request& request : chunk_streamer.needed)
+            {
+                if(chunk_streamer.build_count == CHUNK_MAX_BUILDS)
+                {
+                    break;
+                }
+                queue_chunk_build(request.chunk);
+            }
+
+            for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+            {
+                glm::vec3 position = chunk_streamer.previous_position[vp_id];
+                want_chunks_near(glm::vec2(position.x, position.z) + chunk_streamer.direction[vp_id] * CHUNK_PREFETCH_DISTANCE, CHUNK_STREAM_DISTANCE, false);
+            }
+
+            int prefetch_builds = 0;
+            for(int chunk : chunk_streamer.prefetch)
+            {
+                Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+                if(mesh.resident)
+                {
+                    mesh.last_used = chunk_streamer.frame;
+                    continue;
+                }
+                if(prefetch_builds == CHUNK_PREFETCH_BUILDS || chunk_streamer.build_count == CHUNK_MAX_BUILDS || (chunk_streamer.resident_bytes >= chunk_streamer.budget && !evict_chunk_mesh()))
+                {
+                    continue;
+                }
+                queue_chunk_build(chunk);
+                prefetch_builds += 1;
+            }
+
+            parallel_for(chunk_streamer.build_count, 1, [](int begin, int end)
+            {
+                for(int i = begin; i < end; ++i)
+                {
+                    merge_chunk_geometry(chunk_streamer.builds[i]);
+                }
+            });
+            upload_chunk_builds();
+
+            while(chunk_streamer.resident_bytes > chunk_streamer.budget && evict_chunk_mesh())
+            {
+            }
+        }
+
+        bool is_chunk_resident(glm::vec3 position)
+        {
+            int slot = get_tile_slot(map.tiles, static_cast<int>(SDL_floorf(position.x / 3.0f)), static_cast<int>(SDL_floorf(position.z / 3.0f)));
+            return slot >= 0 && slot / MAP_CHUNK_TILES < (int)chunk_streamer.meshes.size() && chunk_streamer.meshes[slot / MAP_CHUNK_TILES].resident;
+        }
+    #pragma endregion Chunk Streaming
+
+    #pragma region Renderer
+        void create_window()
+        {
+            // create a window
+            window_size_w = 640.0f;
+            window_size_h = 480.0f;
+            if(deep::use_both_monitors)
+            {
+                window_size_w = 1920*2;
+                window_size_h = 1080;
+                render_context.window = SDL_CreateWindow("Deep", window_size_w, window_size_h, SDL_WINDOW_RESIZABLE);
+                SDL_SetWindowPosition(render_context.window, 0, 0);
+            }
+            else
+            {
+                render_context.window = SDL_CreateWindow("Deep", window_size_w, window_size_h, SDL_WINDOW_RESIZABLE);
+            }
+            
+            
+            // create the device
+            render_context.device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV, true, NULL);
+            SDL_ClaimWindowForGPUDevice(render_context.device, render_context.window);
+        }
+
+        void create_render_pipeline()
+        {
+        // load the vertex shader code
+            size_t vertex_code_size; 
+            void* vertex_code = SDL_LoadFile("shaders/vertex.spv", &vertex_code_size);
+
+            // create the vertex shader
+            SDL_GPUShaderCreateInfo vertex_info{};
+            vertex_info.code = (Uint8*)vertex_code;
+            vertex_info.code_size = vertex_code_size;
+            vertex_info.entrypoint = "main";
+            vertex_info.format = SDL_GPU_SHADERFORMAT_SPIRV;
+            vertex_info.stage = SDL_GPU_SHADERSTAGE_VERTEX;
+            vertex_info.num_samplers = 0;
+            vertex_info.num_storage_buffers = 0;
+            vertex_info.num_storage_textures = 0;
+            vertex_info.num_uniform_buffers = 1;
+
+            SDL_GPUShader* vertex_shader = SDL_CreateGPUShader(render_context.device, &vertex_info);
+
+            // free the file
+            SDL_free(vertex_code);
+
+            // load the fragment shader code
+            size_t fragment_code_size; 
+            void* fragment_code = SDL_LoadFile("shaders/fragment.spv", &fragment_code_size);
+
+            // create the fragment shader
+            SDL_GPUShaderCreateInfo fragment_info{};
+            fragment_info.code = (Uint8*)fragment_code;
+            fragment_info.code_size = fragment_code_size;
+            fragment_info.entrypoint = "main";
+            fragment_info.format = SDL_GPU_SHADERFORMAT_SPIRV;
+            fragment_info.stage = SDL_GPU_SHADERSTAGE_FRAGMENT;
+            fragment_info.num_samplers = 3;
+            fragment_info.num_storage_buffers = 0;
+            fragment_info.num_storage_textures = 0;
+            fragment_info.num_uniform_buffers = 1;
+
+            SDL_GPUShader* fragment_shader = SDL_CreateGPUShader(render_context.device, &fragment_info);
+
+            // free the file
+            SDL_free(fragment_code);
+
+            // create the graphics pipeline
+            SDL_GPUGraphicsPipelineCreateInfo pipeline_info{};
+            pipeline_info.vertex_shader = vertex_shader;
+            pipeline_info.fragment_shader = fragment_shader;
+            pipeline_info.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST;
+
+            // describe the vertex buffers
+            SDL_GPUVertexBufferDescription vertex_buffer_description[1];
+            vertex_buffer_description[0].slot = 0;
+            vertex_buffer_description[0].input_rate = SDL_GPU_VERTEXINPUTRATE_VERTEX;
+            vertex_buffer_description[0].instance_step_rate = 0;
+            vertex_buffer_description[0].pitch = sizeof(Vertex);
+
+            pipeline_info.vertex_input_state.num_vertex_buffers = 1;
+            pipeline_info.vertex_input_state.vertex_buffer_descriptions = vertex_buffer_description;
+
+            // describe the vertex attribute
+            SDL_GPUVertexAttribute vertex_attributes[3];
+
+            // a_position
+            vertex_attributes[0].buffer_slot = 0;
+            vertex_attributes[0].location = 0;
+            vertex_attributes[0].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3;
+            vertex_attributes[0].offset = 0;
+
+            // a_texcoord
+            vertex_attributes[1].buffer_slot = 0;
+            vertex_attributes[1].location = 1;
+            vertex_attributes[1].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2;
+            vertex_attributes[1].offset = sizeof(float) * 3;
+
+            // a_normal
+            vertex_attributes[2].buffer_slot = 0;
+            vertex_attributes[2].location = 2;
+            vertex_attributes[2].format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3;
+            vertex_attributes[2].offset = sizeof(float) * 5;
+
+            pipeline_info.vertex_input_state.num_vertex_attributes = 3;
+            pipeline_info.vertex_input_state.vertex_attributes = vertex_attributes;
+
+            // describe the color target
+            SDL_GPUColorTargetDescription color_target_description[1];
+            color_target_description[0] = {};
+            color_target_description[0].blend_state.enable_blend = true;
+            color_target_description[0].blend_state.color_blend_op = SDL_GPU_BLENDOP_ADD;
+            color_target_description[0].blend_state.alpha_blend_op = SDL_GPU_BLENDOP_ADD;
+            color_target_description[0].blend_state.src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
+            color_target_description[0].blend_state.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            color_target_description[0].blend_state.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
+            color_target_description[0].blend_state.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            color_target_description[0].format = SDL_GetGPUSwapchainTextureFormat(render_context.device, render_context.window);
+
+            pipeline_info.target_info.num_color_targets = 1;
+            pipeline_info.target_info.color_target_descriptions = color_target_description;
+
+            // Cull Mode
+            pipeline_info.rasterizer_state.cull_mode = SDL_GPU_CULLMODE_BACK;
+            //pipeline_info.rasterizer_state.front_face = SDL_GPU_FRONTFACE_CLOCKWISE;
+
+            // Depth Testing
+            pipeline_info.depth_stencil_state.enable_depth_test = true;
+            pipeline_info.depth_stencil_state.enable_depth_write = true;
+            pipeline_info.depth_stencil_state.compare_op = SDL_GPUCompareOp::SDL_GPU_COMPAREOP_LESS;
+            pipeline_info.target_info.has_depth_stencil_target = true;
+            pipeline_info.target_info.depth_stencil_format = SDL_GPU_TEXTUREFORMAT_D24_UNORM;
+
+            // create the pipeline
+            render_context.graphics_pipeline = SDL_CreateGPUGraphicsPipeline(render_context.device, &pipeline_info);
+
+            // we don't need to store the shaders after creating the pipeline
+            SDL_ReleaseGPUShader(render_context.device, vertex_shader);
+            SDL_ReleaseGPUShader(render_context.device, fragment_shader);
+        }
+
+        void create_depth_buffer()
+        {
+            int scene_width, scene_height;
+            SDL_GetWindowSizeInPixels(render_context.window, &scene_width, &scene_height);
+
+            SDL_GPUTextureCreateInfo texture_create_info{};
+            texture_create_info.type = SDL_GPU_TEXTURETYPE_2D;
+            texture_create_info.width = scene_width;
+            texture_create_info.height = scene_height;
+            texture_create_info.layer_count_or_depth = 1;
+            texture_create_info.num_levels = 1;
+            texture_create_info.sample_count = SDL_GPU_SAMPLECOUNT_1;
+            texture_create_info.format = SDL_GPU_TEXTUREFORMAT_D24_UNORM;
+            texture_create_info.usage = SDL_GPU_TEXTUREUSAGE_DEPTH_STENCIL_TARGET;
+            render_context.scene_depth_texture = SDL_CreateGPUTexture(render_context.device, &texture_create_info);
+        }
+
+        void init_sound()
+        {
+            sound_system.audio_device = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
+            if (sound_system.audio_device == 0) {
+                SDL_Log("Couldn't open audio device: %s", SDL_GetError());
+            }
+        }
+
+        void setup_imgui()
+        {
+            float main_scale = SDL_GetDisplayContentScale(SDL_GetPrimaryDisplay());
+
+            // Setup Dear ImGui context
+            IMGUI_CHECKVERSION();
+            ImGui::CreateContext();
+            ImGuiIO& io = ImGui::GetIO(); (void)io;
+            //io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
+            //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+
+            // Setup Dear ImGui style
+            ImGui::StyleColorsDark();
+            //ImGui::StyleColorsLight();
+
+            // Setup scaling
+            ImGuiStyle& style = ImGui::GetStyle();
+            style.ScaleAllSizes(main_scale);        // Bake a fixed style scale. (until we have a solution for dynamic style scaling, changing this requires resetting Style + calling this again)
+            style.FontScaleDpi = main_scale;        // Set initial font scale. (using io.ConfigDpiScaleFonts=true makes this unnecessary. We leave both here for documentation purpose)
+
+            // Setup Platform/Renderer backends
+            ImGui_ImplSDL3_InitForSDLGPU(render_context.window);
+            ImGui_ImplSDLGPU3_InitInfo init_info = {};
+            init_info.Device = render_context.device;
+            init_info.ColorTargetFormat = SDL_GetGPUSwapchainTextureFormat(render_context.device, render_context.window);
+            init_info.MSAASamples = SDL_GPU_SAMPLECOUNT_1;
+            ImGui_ImplSDLGPU3_Init(&init_info);
+
+            // Start the Dear ImGui frame
+            ImGui_ImplSDLGPU3_NewFrame();
+            ImGui_ImplSDL3_NewFrame();
+            ImGui::NewFrame();
+        }
+
+        SDL_GPUTexture* load_texture(const char *filename, Texture_Encoding encoding, bool mipmapped)
+        {
+            SDL_Surface *image_data = load_image(filename, 4);
+                if (image_data == NULL)
+                {
+                    SDL_Log("Could not load image data!");
+                    // FIXME handle image not found
+                }          
+
+            std::vector<Texture_Level> levels = build_mip_chain((Uint8*)image_data->pixels, image_data->w, image_data->h, image_data->pitch, mipmapped);
+            SDL_DestroySurface(image_data);
+
+            // use the block compressed format only where the device samples it and the encoder keeps the texels close enough
+            SDL_GPUTextureFormat format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
+            if(encoding != Texture_Encoding_RGBA8)
+            {
+                SDL_GPUTextureFormat compressed_format = get_texture_format(encoding);
+                if(!SDL_GPUTextureSupportsFormat(render_context.device, compressed_format, SDL_GPU_TEXTURETYPE_2D, SDL_GPU_TEXTUREUSAGE_SAMPLER))
+                {
+                    SDL_Log("Block compression not supported, %s stays RGBA8", filename);
+                }
+                else if(levels[0].width % 4 != 0 || levels[0].height % 4 != 0)
+                {
+                    SDL_Log("%s is not a multiple of 4 texels, stays RGBA8", filename);
+                }
+                else
+                {
+                    std::vector<Texture_Level> compressed = levels;
+                    int max_error = compress_texture(compressed, encoding);
+                    if(max_error > TEXTURE_MAX_ERROR)
+                    {
+                        SDL_Log("%s loses too much in block compression (error %d), stays RGBA8", filename, max_error);
+                    }
+                    else
+                    {
+                        levels.swap(compressed);
+                        format = compressed_format;
+                    }
+                }
+            }
+
+            SDL_GPUTextureCreateInfo texture_create_info{};
+            texture_create_info.type = SDL_GPU_TEXTURETYPE_2D;
+            texture_create_info.format = format;
+            texture_create_info.width = levels[0].width;
+            texture_create_info.height = levels[0].height;
+            texture_create_info.layer_count_or_depth = 1;
+            texture_create_info.num_levels = levels.size();
+            texture_create_info.usage = SDL_GPU_TEXTUREUSAGE_SAMPLER;
+            SDL_GPUTexture* texture = SDL_CreateGPUTexture(render_context.device, &texture_create_info);
+
+            Uint32 transfer_size = 0;
+            for(size_t l = 0; l < levels.size(); ++l)
+            {
+                transfer_size += levels[l].data.size();
+            }
+
+            SDL_GPUTransferBufferCreateInfo transfer_buffer_create_info{};
+            transfer_buffer_create_info.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
+            transfer_buffer_create_info.size = transfer_size;
+            SDL_GPUTransferBuffer* texture_transfer_buffer = SDL_CreateGPUTransferBuffer(
+                render_context.device,
+                &transfer_buffer_create_info
+            );
+
+            Uint8* texture_transfer_pointer = (Uint8*)SDL_MapGPUTransferBuffer(
+                render_context.device,
+                texture_transfer_buffer,
+                false
+            );
+            Uint32 offset = 0;
+            for(size_t l = 0; l < levels.size(); ++l)
+            {
+                SDL_memcpy(texture_transfer_pointer + offset, levels[l].data.data(), levels[l].data.size());
+                offset += levels[l].data.size();
+            }
+            SDL_UnmapGPUTransferBuffer(render_context.device, texture_transfer_buffer);
+
+            // start a copy pass
+            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
+            SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(command_buffer);
+
+            offset = 0;
+            for(size_t l = 0; l < levels.size(); ++l)
+            {
+                SDL_GPUTextureTransferInfo texture_transfer_info{};
+                texture_transfer_info.transfer_buffer = texture_transfer_buffer;
+                texture_transfer_info.offset = offset; /* Zeros out the rest */
+                SDL_GPUTextureRegion texture_region{};
+                texture_region.texture = texture;
+                texture_region.mip_level = l;
+                texture_region.w = levels[l].width;
+                texture_region.h = levels[l].height;
+                texture_region.d = 1;
+                SDL_UploadToGPUTexture(
+                    copy_pass,
+                    &texture_transfer_info,
+                    &texture_region,
+                    false
+                );
+                offset += levels[l].data.size();
+            }
+
+            SDL_EndGPUCopyPass(copy_pass);
+            SDL_SubmitGPUCommandBuffer(command_buffer);
+            SDL_ReleaseGPUTransferBuffer(render_context.device, texture_transfer_buffer);
+
+            return texture;
+        }
+        void load_textures()
+        {
+            SDL_GPUSamplerCreateInfo sampler_create_info{};
+            sampler_create_info.min_filter = SDL_GPU_FILTER_NEAREST;
+            sampler_create_info.mag_filter = SDL_GPU_FILTER_NEAREST;
+            sampler_create_info.mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_NEAREST;
+            sampler_create_info.address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+            sampler_create_info.address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+            sampler_create_info.address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+            sampler_create_info.max_lod = 1000.0f;
+            render_context.sampler = SDL_CreateGPUSampler(render_context.device, &sampler_create_info);
+
+            // the maps are palette atlases addressed per texel, so no mip chain that would blend neighbouring entries
+            render_context.diffuse_map = load_texture("diffuse.bmp", Texture_Encoding_BC7, false);
+            render_context.specular_map = load_texture("specular.bmp", Texture_Encoding_BC1, false);
+            render_context.shininess_map = load_texture("shininess.bmp", Texture_Encoding_BC4, false);
+        }
+
+        void upload_meshes(Mesh_Asset** meshes, int count)
+        {
+            if(count == 0)
+            {
+                return;
+            }
+
+            // create the vertex and index buffers and size one transfer buffer for the whole batch
+            Uint32 transfer_size = 0;
+            for(int i = 0; i < count; ++i)
+            {
+                Mesh_Asset& mesh = *meshes[i];
+
+                SDL_GPUBufferCreateInfo vertex_buffer_info{};
+                vertex_buffer_info.size = mesh.vertices.size() * sizeof(Vertex);
+                vertex_buffer_info.usage = SDL_GPU_BUFFERUSAGE_VERTEX;
+                mesh.vertex_buffer = SDL_CreateGPUBuffer(render_context.device, &vertex_buffer_info);
+
+                SDL_GPUBufferCreateInfo index_buffer_info{};
+                index_buffer_info.size = mesh.indices.size() * sizeof(Uint16);
+                index_buffer_info.usage = SDL_GPU_BUFFERUSAGE_INDEX;
+                mesh.index_buffer = SDL_CreateGPUBuffer(render_context.device, &index_buffer_info);
+
+                transfer_size += mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(Uint16);
+            }
+
+            SDL_GPUTransferBufferCreateInfo transfer_info{};
+            transfer_info.size = transfer_size;
+            transfer_info.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
+            SDL_GPUTransferBuffer* buffer_transfer_buffer = SDL_CreateGPUTransferBuffer(render_context.device, &transfer_info);
+
+            // fill the transfer buffer
+            Uint8* transfer_data = (Uint8*)SDL_MapGPUTransferBuffer(render_context.device, buffer_transfer_buffer, false);
+            Uint32 offset = 0;
+            for(int i = 0; i < count; ++i)
+            {
+                Mesh_Asset& mesh = *meshes[i];
+                SDL_memcpy(transfer_data + offset, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+                offset += mesh.vertices.size() * sizeof(Vertex);
+                SDL_memcpy(transfer_data + offset, mesh.indices.data(), mesh.indices.size() * sizeof(Uint16));
+                offset += mesh.indices.size() * sizeof(Uint16);
+            }
+            SDL_UnmapGPUTransferBuffer(render_context.device, buffer_transfer_buffer);
+
+            // start a copy pass
+            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
+            SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(command_buffer);
+
+            offset = 0;
+            for(int i = 0; i < count; ++i)
+            {
+                Mesh_Asset& mesh = *meshes[i];
+
+                // upload the vertex buffer
+                SDL_GPUTransferBufferLocation vertex_buffer_location{};
+                vertex_buffer_location.transfer_buffer = buffer_transfer_buffer;
+                vertex_buffer_location.offset = offset;
+                SDL_GPUBufferRegion vertex_region{};
+                vertex_region.buffer = mesh.vertex_buffer;
+                vertex_region.size = mesh.vertices.size() * sizeof(Vertex);
+                vertex_region.offset = 0;
+                SDL_UploadToGPUBuffer(copy_pass, &vertex_buffer_location, &vertex_region, false);
+                offset += vertex_region.size;
+
+                // upload the index buffer
+                SDL_GPUTransferBufferLocation index_buffer_location{};
+                index_buffer_location.transfer_buffer = buffer_transfer_buffer;
+                index_buffer_location.offset = offset;
+                SDL_GPUBufferRegion index_region{};
+                index_region.buffer = mesh.index_buffer;
+                index_region.size = mesh.indices.size() * sizeof(Uint16);
+                index_region.offset = 0;
+                SDL_UploadToGPUBuffer(copy_pass, &index_buffer_location, &index_region, false);
+                offset += index_region.size;
+            }
+
+            // end the copy pass
+            SDL_EndGPUCopyPass(copy_pass);
+            SDL_SubmitGPUCommandBuffer(command_buffer);
+            SDL_ReleaseGPUTransferBuffer(render_context.device, buffer_transfer_buffer);
+
+            // the cpu copy is not needed anymore
+            for(int i = 0; i < count; ++i)
+            {
+                Mesh_Asset& mesh = *meshes[i];
+                mesh.index_count = mesh.indices.size();
+                mesh.bounding_radius = 0.0f;
+                for(const Vertex& vertex : mesh.vertices)
+                {
+                    glm::vec3 position = glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]);
+                    mesh.bounding_radius = SDL_max(mesh.bounding_radius, glm::length(position));
+                }
+                mesh.state = Asset_Ready;
+                std::vector<Vertex>().swap(mesh.vertices);
+                std::vector<Uint16>().swap(mesh.indices);
+            }
+        }
+
+        // only touches cpu memory, safe to call from a job
+        bool decode_gltf(const char *model_filename, std::vector<Vertex>& vertices, std::vector<Uint16>& indices)
+        {
+            DEEP_PROFILE_SCOPE("decode_gltf");
+            cgltf_options options = {};
+            cgltf_data* data = NULL;
+            cgltf_result result = cgltf_parse_file(&options, model_filename, &data);
+
+            if (result == cgltf_result_success)
+            {
+                result = cgltf_load_buffers(&options, data, model_filename);
+                if (result == cgltf_result_success)
+                {
+                    if(data->meshes_count > 0)
+                    {
+                        cgltf_mesh* mesh = &data->meshes[0];
+
+                        for(int i = 0; i < mesh->primitives_count; i++)
+                        {
+                            cgltf_primitive* primitive = &mesh->primitives[i];
+                            if(primitive->type == cgltf_primitive_type_triangles)
+                            {
+                                Uint16 current_vertex_offset = vertices.size();
+
+                                const cgltf_accessor* pos_accessor = NULL;
+                                const cgltf_accessor* normal_accessor = NULL;
+                                const cgltf_accessor* texcoord_accessor = NULL;
+
+                                for (size_t j = 0; j < primitive->attributes_count; ++j) {
+                                    const cgltf_attribute* attribute = &primitive->attributes[j];
+                                    if (attribute->type == cgltf_attribute_type_position) {
+                                        pos_accessor = attribute->data;
+                                    } else if (attribute->type == cgltf_attribute_type_normal) {
+                                        normal_accessor = attribute->data;
+                                    } else if (attribute->type == cgltf_attribute_type_texcoord) { // TEXCOORD_0
+                                        texcoord_accessor = attribute->data;
+                                    }
+                                    // Add more attribute types (e.g., TANGENT, COLOR_0) as needed
+                                }
+
+                                if (pos_accessor) {
+                                    vertices.reserve(vertices.size() + pos_accessor->count);
+
+                                    for (cgltf_size k = 0; k < pos_accessor->count; ++k) {
+                                        Vertex v = {};
+
+                                        cgltf_accessor_read_float(pos_accessor, k, v.position, 3);
+
+                                        if (normal_accessor) {
+                                            cgltf_accessor_read_float(normal_accessor, k, v.normal, 3);
+                                        } else {
+                                            v.normal[0] = 0.0f; v.normal[1] = 0.0f; v.normal[2] = 0.0f;
+                                        }
+
+                                        if (texcoord_accessor) {
+                                            cgltf_accessor_read_float(texcoord_accessor, k, v.texcoord, 2);
+                                        } else {
+                                            v.texcoord[0] = 0.0f; v.texcoord[1] = 0.0f;
+                                        }
+                                        vertices.push_back(v);
+                                    }
+                                } else {
+                                    SDL_Log("Warning: Primitive found without position data.\n");
+                                    continue;
+                                }
+
+
+                                if (primitive->indices != NULL) {
+                                    const cgltf_accessor* indices_accessor = primitive->indices;
+
+                                    indices.reserve(indices.size() + indices_accessor->count);
+
+                                    for (cgltf_size k = 0; k < indices_accessor->count; ++k) {
+                                        unsigned int index;
+                                        cgltf_accessor_read_uint(indices_accessor, k, &index, 1);
+
+                                        indices.push_back(current_vertex_offset + index);
+                                    }
+                                } else {
+                                    if (pos_accessor->count % 3 != 0) {
+                                        SDL_Log("Warning: Unindexed primitive has vertex count (%zu) not divisible by 3.\n", (size_t)pos_accessor->count);
+                                    }
+
+                                    indices.reserve(indices.size() + pos_accessor->count);
+                                    for (Uint16 k = 0; k < pos_accessor->count; ++k) {
+                                        indices.push_back(current_vertex_offset + k);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                } else {
+                    SDL_Log("Failed to load glTF buffers for %s", model_filename);
+                }
+                cgltf_free(data);
+            } else {
+                SDL_Log("Failed to parse glTF file %s", model_filename);
+            }
+
+            if(indices.empty())
+            {
+                return false;
+            }
+            Mesh_Optimization_Report report = optimize_mesh(vertices, indices);
+            if(deep::log_mesh_optimization)
+            {
+                SDL_Log("Optimized %s: %d triangles, %d clusters, ACMR %.3f -> %.3f", model_filename, report.triangle_count, report.cluster_count, report.acmr_before, report.acmr_after);
+            }
+            return true;
+        }
+
+        // gribb-hartmann planes from the view projection matrix, normals point inwards
+        Frustum extract_frustum(glm::mat4 view_projection)
+        {
+            glm::vec4 rows[4];
+            for(int i = 0; i < 4; ++i)
+            {
+                rows[i] = glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+            }
+            Frustum frustum{};
+            frustum.planes[0] = rows[3] + rows[0];
+            frustum.planes[1] = rows[3] - rows[0];
+            frustum.planes[2] = rows[3] + rows[1];
+            frustum.planes[3] = rows[3] - rows[1];
+            frustum.planes[4] = rows[3] + rows[2];
+            frustum.planes[5] = rows[3] - rows[2];
+            for(int i = 0; i < 6; ++i)
+            {
+                frustum.planes[i] = frustum.planes[i] / glm::length(glm::vec3(frustum.planes[i]));
+            }
+            return frustum;
+        }
+
+        bool is_sphere_visible(const Frustum& frustum, glm::vec3 center, float radius)
+        {
+            for(int i = 0; i < 6; ++i)
+            {
+                if(glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        glm::vec3 get_render_position(const deep::Position_Component& position)
+        {
+            return glm::mix(position.previous_position, position.position, simulation_clock.alpha);
+        }
+
+        // culls entities and map chunks against every viewport, bit n is set when visible in viewport n
+        void compute_visibility(int viewport_count)
+        {
+            DEEP_PROFILE_SCOPE("compute_visibility");
+            Frustum frusta[2];
+            for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+            {
+                frusta[vp_id] = extract_frustum(cameras[vp_id].projection * camera_get_view_matrix(vp_id));
+            }
+
+            Component_Pool<deep::Render_Component>& renders = entity_store.renders;
+            render_context.render_visibility.resize(renders.data.size());
+            parallel_for(renders.data.size(), 256, [&](int begin, int end)
+            {
+                for(int i = begin; i < end; ++i)
+                {
+                    Uint8 visibility = 0;
+                    Uint32 slot = renders.owners[i];
+                    glm::vec3 center{};
+                    // entities stay in the store when their chunk streams out, they are just not drawn
+                    if(has_component(entity_store.positions, slot) && is_chunk_resident(center = get_render_position(entity_store.positions.data[entity_store.positions.sparse[slot]])))
+                    {
+                        for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+                        {
+                            visibility |= is_sphere_visible(frusta[vp_id], center, renders.data[i].bounding_radius) ? (1 << vp_id) : 0;
+                        }
+                    }
+                    render_context.render_visibility[i] = visibility;
+                }
+            });
+
+            render_context.chunk_visibility.assign(chunk_streamer.meshes.size(), 0);
+            for(int chunk : chunk_streamer.resident)
+            {
+                const Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+                Uint8 visibility = 0;
+                for(int vp_id = 0; vp_id < viewport_count && mesh.index_count > 0; ++vp_id)
+                {
+                    visibility |= is_sphere_visible(frusta[vp_id], mesh.center, mesh.radius) ? (1 << vp_id) : 0;
+                }
+                render_context.chunk_visibility[chunk] = visibility;
+            }
+        }
+
+        // the nearest lights in resident chunks, the shader takes 10
+        void gather_lights(Fragment_Uniform_Buffer& fragment_uniform_buffer)
+        {
+            float distances[10];
+            int lights_count = 0;
+            query([&](deep::Entity entity, deep::Light_Component& light, deep::Position_Component& position)
+            {
+                if(!is_chunk_resident(position.position))
+                {
+                    return;
+                }
+                float distance = glm::length(position.position - fragment_uniform_buffer.camera_position);
+                int i = lights_count < 10 ? lights_count++ : 10;
+                for(; i > 0 && distances[i - 1] > distance; --i)
+                {
+                    if(i < 10)
+                    {
+                        distances[i] = distances[i - 1];
+                        fragment_uniform_buffer.lights[i] = fragment_uniform_buffer.lights[i - 1];
+                    }
+                }
+                if(i == 10)
+                {
+                    return;
+                }
+                distances[i] = distance;
+                fragment_uniform_buffer.lights[i].position = position.position;
+                fragment_uniform_buffer.lights[i].ambient = light.ambient;
+                fragment_uniform_buffer.lights[i].diffuse = light.diffuse;
+                fragment_uniform_buffer.lights[i].specular = light.specular;
+                fragment_uniform_buffer.lights[i].constant_linear_quadratic = light.constant_linear_quadratic;
+            }, entity_store.lights, entity_store.positions);
+            fragment_uniform_buffer.number_of_lights = lights_count;
+        }
+
+        void render()
+        {
+            DEEP_PROFILE_SCOPE("render");
+            // uploads go in their own command buffers, before this frame's
+            stream_chunks(deep::use_both_monitors ? 2 : 1);
+
+            // acquire the command buffer
+            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
+
+            // get the swapchain texture
+            SDL_GPUTexture* swapchain_texture;
+            Uint32 width, height;
+            {
+                // vsync and a gpu that is behind both show up here
+                DEEP_PROFILE_SCOPE("render swapchain wait");
+                SDL_WaitAndAcquireGPUSwapchainTexture(command_buffer, render_context.window, &swapchain_texture, &width, &height);
+            }
+
+            // end the frame early if a swapchain texture is not available
+            if (swapchain_texture == NULL)
+            {
+                // you must always submit the command buffer
+                SDL_SubmitGPUCommandBuffer(command_buffer);
+                return;
+            }
+
+            // create the color target
+            SDL_GPUColorTargetInfo color_target_info{};
+            color_target_info.clear_color = {0/255.0f, 0/255.0f, 0/255.0f, 255/255.0f};
+            color_target_info.load_op = SDL_GPU_LOADOP_CLEAR;
+            color_target_info.store_op = SDL_GPU_STOREOP_STORE;
+            color_target_info.texture = swapchain_texture;
+
+            SDL_GPUDepthStencilTargetInfo depth_stencil_target_info = {};
+            depth_stencil_target_info.texture = render_context.scene_depth_texture;
+            depth_stencil_target_info.cycle = true;
+            depth_stencil_target_info.clear_depth = 1;
+            depth_stencil_target_info.clear_stencil = 0;
+            depth_stencil_target_info.load_op = SDL_GPU_LOADOP_CLEAR;
+            depth_stencil_target_info.store_op = SDL_GPU_STOREOP_STORE;
+            depth_stencil_target_info.stencil_load_op = SDL_GPU_LOADOP_CLEAR;
+            depth_stencil_target_info.stencil_store_op = SDL_GPU_STOREOP_STORE;
+
+            {
+                DEEP_PROFILE_SCOPE("render passes");
+
+                // begin a render pass
+                SDL_GPURenderPass* render_pass = SDL_BeginGPURenderPass(command_buffer, &color_target_info, 1, &depth_stencil_target_info);
+
+                // bind the pipeline
+                SDL_BindGPUGraphicsPipeline(render_pass, render_context.graphics_pipeline);
+
+                Fragment_Uniform_Buffer fragment_uniform_buffer{};
+
+                SDL_GPUTextureSamplerBinding texture_sampler_binding[4];
+                texture_sampler_binding[0].texture = render_context.diffuse_map;
+                texture_sampler_binding[0].sampler = render_context.sampler;
+                texture_sampler_binding[1].texture = render_context.specular_map;
+                texture_sampler_binding[1].sampler = render_context.sampler;
+                texture_sampler_binding[2].texture = render_context.shininess_map;
+                texture_sampler_binding[2].sampler = render_context.sampler;
+                texture_sampler_binding[3].texture = render_context.scene_depth_texture;
+                texture_sampler_binding[3].sampler = render_context.sampler;
+                SDL_BindGPUFragmentSamplers(render_pass, 0, texture_sampler_binding, 3);
+
+
+                int viewport_count = 1;
+                float viewport_w = window_size_w;
+                float viewport_h = window_size_h;
+                if(deep::use_both_monitors)
+                {
+                    viewport_count = 2;
+                    viewport_w = viewport_w / 2.0f;
+                }
+
+                SDL_GPUViewport viewports[2];
+                viewports[0].x = 0.0f;
+                viewports[0].y = 0.0f;
+                viewports[0].w = viewport_w;
+                viewports[0].h = viewport_h;
+                viewports[0].min_depth = 0.0f;
+                viewports[0].max_depth = 1.0f;
+                viewports[1].x = viewport_w;
+                viewports[1].y = 0.0f;
+                viewports[1].w = viewport_w;
+                viewports[1].h = viewport_h;
+                viewports[1].min_depth = 0.0f;
+                viewports[1].max_depth = 1.0f;                
+
+                compute_visibility(viewport_count);
+
+                for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+                {
+                    Vertex_Uniform_Buffer vertex_uniform_buffer{};
+                    vertex_uniform_buffer.view = camera_get_view_matrix(vp_id);
+                    vertex_uniform_buffer.projection = cameras[vp_id].projection;
+
+                    fragment_uniform_buffer.camera_position = camera_get_render_position(vp_id);
+                    gather_lights(fragment_uniform_buffer);
+                    SDL_PushGPUFragmentUniformData(command_buffer, 0, &fragment_uniform_buffer, sizeof(Fragment_Uniform_Buffer));
+
+                    SDL_SetGPUViewport(render_pass, &viewports[vp_id]);
+
+                    query([&](deep::Entity entity, deep::Render_Component& render, deep::Position_Component& position)
+                    {
+                        if((render_context.render_visibility[&render - entity_store.renders.data.data()] & (1 << vp_id)) == 0)
+                        {
+                            return;
+                        }
+                        vertex_uniform_buffer.model = glm::translate(glm::mat4(1.0f), get_render_position(position)) * render.rotation;
+                        SDL_PushGPUVertexUniformData(command_buffer, 0, &vertex_uniform_buffer, sizeof(Vertex_Uniform_Buffer));
+
+                        // bind the vertex buffer
+                        SDL_GPUBufferBinding vertex_buffer_binding{};
+                        vertex_buffer_binding.buffer = render.vertex_buffer;
+                        vertex_buffer_binding.offset = 0;
+                        SDL_BindGPUVertexBuffers(render_pass, 0, &vertex_buffer_binding, 1);
+
+                        SDL_GPUBufferBinding index_buffer_binding{};
+                        index_buffer_binding.buffer = render.index_buffer;
+                        index_buffer_binding.offset = 0;
+                        SDL_BindGPUIndexBuffer(render_pass, &index_buffer_binding, SDL_GPU_INDEXELEMENTSIZE_16BIT);
+
+                        // issue a draw call
+                        SDL_DrawGPUIndexedPrimitives(render_pass, render.index_count, 1, 0, 0, 0);
+                    }, entity_store.renders, entity_store.positions);
+
+                    vertex_uniform_buffer.model = glm::mat4(1.0f);
+                    SDL_PushGPUVertexUniformData(command_buffer, 0, &vertex_uniform_buffer, sizeof(Vertex_Uniform_Buffer));
+                    for(int chunk : chunk_streamer.resident)
+                    {
+                        if((render_context.chunk_visibility[chunk] & (1 << vp_id)) == 0)
+                        {
+                            continue;
+                        }
+                        const Chunk_Mesh& mesh = chunk_streamer.meshes[chunk];
+
+                        // bind the vertex buffer
+                        SDL_GPUBufferBinding vertex_buffer_binding{};
+                        vertex_buffer_binding.buffer = mesh.vertex_buffer;
+                        vertex_buffer_binding.offset = 0;
+                        SDL_BindGPUVertexBuffers(render_pass, 0, &vertex_buffer_binding, 1);
+
+                        SDL_GPUBufferBinding index_buffer_binding{};
+                        index_buffer_binding.buffer = mesh.index_buffer;
+                        index_buffer_binding.offset = 0;
+                        SDL_BindGPUIndexBuffer(render_pass, &index_buffer_binding, SDL_GPU_INDEXELEMENTSIZE_32BIT);
+
+                        // issue a draw call
+                        SDL_DrawGPUIndexedPrimitives(render_pass, mesh.index_count, 1, 0, 0, 0);
+                    }
+
+                }
+                
+                // end the render pass
+                SDL_EndGPURenderPass(render_pass);
+
+                // ImGui Rendering Pass (No Depth)
+#if DEEP_PROFILE
+                if(deep::profiling.load(std::memory_order_relaxed))
+                {
+                    draw_profiler();
+                }
+#endif
+                ImGui::Render();
+                ImDrawData* draw_data = ImGui::GetDrawData();
+                const bool is_minimized = (draw_data->DisplaySize.x <= 0.0f || draw_data->DisplaySize.y <= 0.0f);
+                ImGui_ImplSDLGPU3_PrepareDrawData(draw_data, command_buffer);
+                SDL_GPUColorTargetInfo imgui_color_target_info{};
+                imgui_color_target_info.texture = swapchain_texture;
+                imgui_color_target_info.load_op = SDL_GPU_LOADOP_LOAD;
+                imgui_color_target_info.store_op = SDL_GPU_STOREOP_STORE;
+                SDL_GPURenderPass* imgui_render_pass = SDL_BeginGPURenderPass(command_buffer, &imgui_color_target_info, 1, NULL); // NULL for depth_stencil_target_info
+                if (!is_minimized)
+                {
+                    ImGui_ImplSDLGPU3_RenderDrawData(draw_data, command_buffer, imgui_render_pass);
+                }
+                SDL_EndGPURenderPass(imgui_render_pass);
+            }
+
+            // submit the command buffer
+            SDL_SubmitGPUCommandBuffer(command_buffer);
+
+            // Start the Dear ImGui frame
+            ImGui_ImplSDLGPU3_NewFrame();
+            ImGui_ImplSDL3_NewFrame();
+            ImGui::NewFrame();
+        }
+    #pragma endregion Renderer
+
+    #pragma region Streaming
+        // disk io and parsing run on a worker, the gpu upload waits for the next frame boundary
+        void decode_mesh_job(void* data, int begin, int end)
+        {
+            Mesh_Asset& mesh = *static_cast<Mesh_Asset*>(data);
+            decode_gltf(mesh.filename, mesh.vertices, mesh.indices);
+
+            SDL_LockMutex(asset_streamer.mutex);
+            asset_streamer.upload_queue[asset_streamer.upload_count] = &mesh - mesh_assets.data;
+            asset_streamer.upload_count += 1;
+            SDL_UnlockMutex(asset_streamer.mutex);
+        }
+
+        void start_asset_streamer()
+        {
+            asset_streamer.mutex = SDL_CreateMutex();
+        }
+
+        void stop_asset_streamer()
+        {
+            wait_for_counter(&asset_streamer.decode_counter);
+            SDL_DestroyMutex(asset_streamer.mutex);
+
+            for(int i = 0; i < mesh_assets.count; ++i)
+            {
+                if(mesh_assets.data[i].state == Asset_Ready)
+                {
+                    SDL_ReleaseGPUBuffer(render_context.device, mesh_assets.data[i].vertex_buffer);
+                    SDL_ReleaseGPUBuffer(render_context.device, mesh_assets.data[i].index_buffer);
+                }
+            }
+            mesh_assets.count = 0;
+        }
+
+        int find_mesh(const char *filename)
+        {
+            for(int i = 0; i < mesh_assets.count; ++i)
+            {
+                if(SDL_strcmp(mesh_assets.data[i].filename, filename) == 0)
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // returns the mesh id, the mesh is decoded by a job and uploaded by finish_asset_uploads
+        int request_mesh(const char *filename)
+        {
+            int mesh_id = find_mesh(filename);
+            if(mesh_id != -1)
+            {
+                return mesh_id;
+            }
+            if(mesh_assets.count < mesh_assets.max_count)
+            {
+                mesh_id = mesh_assets.count;
+                Mesh_Asset& mesh = mesh_assets.data[mesh_id];
+                SDL_strlcpy(mesh.filename, filename, sizeof(mesh.filename));
+                mesh.state = Asset_Loading;
+                mesh_assets.count += 1;
+
+                submit_background_job(decode_mesh_job, &mesh, 0, 1, &asset_streamer.decode_counter);
+                return mesh_id;
+            }
+            SDL_Log("Too many meshes, could not load %s", filename);
+            return -1;
+        }
+
+        void attach_mesh(deep::Entity entity, int mesh_id, glm::vec3 rotation)
+        {
+            deep::Render_Component render{};
+            render.mesh_id = mesh_id;
+            render.vertex_buffer = mesh_assets.data[mesh_id].vertex_buffer;
+            render.index_buffer = mesh_assets.data[mesh_id].index_buffer;
+            render.index_count = mesh_assets.data[mesh_id].index_count;
+            render.bounding_radius = mesh_assets.data[mesh_id].bounding_radius;
+            render.rotation = glm::mat4(1.0f);
+            render.rotation = glm::rotate(render.rotation, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+            render.rotation = glm::rotate(render.rotation, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+            render.rotation = glm::rotate(render.rotation, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+            add_component(entity_store.renders, entity, render);
+        }
+
+        // called once per frame before rendering, uploads everything the decode jobs finished in one copy pass
+        void finish_asset_uploads()
+        {
+            DEEP_PROFILE_SCOPE("finish_asset_uploads");
+            int uploads[64];
+            int upload_count = 0;
+            SDL_LockMutex(asset_streamer.mutex);
+            upload_count = asset_streamer.upload_count;
+            SDL_memcpy(uploads, asset_streamer.upload_queue, upload_count * sizeof(int));
+            asset_streamer.upload_count = 0;
+            SDL_UnlockMutex(asset_streamer.mutex);
+
+            Mesh_Asset* batch[64];
+            int batch_count = 0;
+            for(int i = 0; i < upload_count; ++i)
+            {
+                Mesh_Asset& mesh = mesh_assets.data[uploads[i]];
+                if(mesh.indices.empty())
+                {
+                    mesh.state = Asset_Failed;
+                    SDL_Log("Failed to load mesh %s", mesh.filename);
+                }
+                else
+                {
+                    batch[batch_count] = &mesh;
+                    batch_count += 1;
+                }
+            }
+            upload_meshes(batch, batch_count);
+
+            int remaining = 0;
+            for(int i = 0; i < (int)asset_streamer.requests.size(); ++i)
+            {
+                Mesh_Request request = asset_streamer.requests[i];
+                Asset_State state = mesh_assets.data[request.mesh_id].state;
+                if(!is_entity_alive(request.entity))
+                {
+                    continue;
+                }
+                if(state == Asset_Ready)
+                {
+                    attach_mesh(request.entity, request.mesh_id, request.rotation);
+                }
+                else if(state != Asset_Failed)
+                {
+                    asset_streamer.requests[remaining] = request;
+                    remaining += 1;
+                }
+            }
+            asset_streamer.requests.resize(remaining);
+        }
+
+        // blocking variant for loading screens, returns the mesh id or -1
+        int load_mesh(const char *filename)
+        {
+            DEEP_PROFILE_SCOPE("load_mesh");
+            if(deep::headless)
+            {
+                return -1;
+            }
+            int mesh_id = find_mesh(filename);
+            if(mesh_id == -1 && mesh_assets.count < mesh_assets.max_count)
+            {
+                mesh_id = mesh_assets.count;
+                Mesh_Asset& mesh = mesh_assets.data[mesh_id];
+                SDL_strlcpy(mesh.filename, filename, sizeof(mesh.filename));
+                mesh_assets.count += 1;
+
+                Mesh_Asset* batch[1] = { &mesh };
+                if(decode_gltf(filename, mesh.vertices, mesh.indices))
+                {
+                    upload_meshes(batch, 1);
+                }
+                else
+                {
+                    mesh.state = Asset_Failed;
+                }
+            }
+            if(mesh_id != -1 && mesh_assets.data[mesh_id].state == Asset_Loading)
+            {
+                // a decode job already has it, help out until it is done
+                wait_for_counter(&asset_streamer.decode_counter);
+                finish_asset_uploads();
+            }
+            if(mesh_id == -1 || mesh_assets.data[mesh_id].state != Asset_Ready)
+            {
+                return -1;
+            }
+            return mesh_id;
+        }
+
+        bool is_mesh_ready(int mesh_id)
+        {
+            return mesh_id > -1 && mesh_id < mesh_assets.count && mesh_assets.data[mesh_id].state == Asset_Ready;
+        }
+    #pragma endregion Streaming
+
+    #pragma region Audio
+        int load_sound(const char *filename)
+        {
+            DEEP_PROFILE_SCOPE("load_sound");
+            if(!deep::headless && sound_system.count < sound_system.max_count)
+            {
+                int i = sound_system.count;
+                SDL_AudioSpec spec;
+                Uint8 *wav_data = NULL;
+                Uint32 wav_data_len = 0;
+                char *wav_path = NULL;
+
+                /* Load the .wav files from wherever the app is being run from. */
+                SDL_asprintf(&wav_path, "ressources/sound/%s", filename);  /* allocate a string of the full file path */
+                if (!SDL_LoadWAV(wav_path, &spec, &wav_data, &wav_data_len)) {
+                    SDL_Log("Couldn't load .wav file: %s", SDL_GetError());
+                }
+                SDL_free(wav_path);  /* done with this string. */
+
+                // converted once to the rate and layout the device plays, the callback only scales and adds samples
+                Mixer& mixer = sound_system.mixer;
+                Uint8 *samples = NULL;
+                int samples_len = 0;
+                if (wav_data && mixer.pool && SDL_ConvertAudioSamples(&spec, wav_data, wav_data_len, &mixer.spec, &samples, &samples_len)) {
+                    const Uint32 line = SOUND_POOL_ALIGNMENT / sizeof(float);
+                    Uint32 offset = (mixer.pool_used + line - 1) & ~(line - 1);
+                    Uint32 frame_count = samples_len / (sizeof(float) * MIXER_CHANNELS);
+                    if (offset + frame_count * MIXER_CHANNELS <= SOUND_POOL_SIZE) {
+                        Sound& sound = sound_system.data[i];
+                        sound.offset = offset;
+                        sound.frame_count = frame_count;
+                        SDL_memcpy(&mixer.pool[offset], samples, frame_count * MIXER_CHANNELS * sizeof(float));
+                        mixer.pool_used = offset + frame_count * MIXER_CHANNELS;
+                    } else {
+                        SDL_Log("Sound pool is full, '%s' is not loaded", filename);
+                    }
+                } else if (wav_data && mixer.pool) {
+                    SDL_Log("Couldn't convert '%s': %s", filename, SDL_GetError());
+                }
+                SDL_free(samples);
+                SDL_free(wav_data);
+                
+                sound_system.count += 1;
+                return sound_system.count-1;
+            }
+            return -1;            
+        }
+
+        // lock free single producer, only the game thread plays sounds
+        void play_sound(int id, float gain, float pan)
+        {
+            Mixer& mixer = sound_system.mixer;
+            if(id < 0 || id >= sound_system.count || mixer.stream == nullptr)
+            {
+                return;
+            }
+            Uint32 tail = mixer.command_tail.load(std::memory_order_relaxed);
+            if(tail - mixer.command_head.load(std::memory_order_acquire) == MIXER_COMMAND_COUNT)
+            {
+                // the callback has not run for a whole queue of sounds, one more would not be heard
+                return;
+            }
+            mixer.commands[tail & (MIXER_COMMAND_COUNT - 1)] = { id, gain, SDL_clamp(pan, -1.0f, 1.0f) };
+            mixer.command_tail.store(tail + 1, std::memory_order_release);
+        }
+
+        void play_sound(int id)
+        {
+            play_sound(id, 1.0f, 0.0f);
+        }
+
+        typedef void (*Mix_Kernel)(float* out, const float* samples, int frames, float gain_left, float gain_right);
+
+        void mix_voice_scalar(float* out, const float* samples, int frames, float gain_left, float gain_right)
+        {
+            for(int i = 0; i < frames; ++i)
+            {
+                out[i * 2] += samples[i * 2] * gain_left;
+                out[i * 2 + 1] += samples[i * 2 + 1] * gain_right;
+            }
+        }
+
+#ifdef SDL_SSE2_INTRINSICS
+        // 2 stereo frames per iteration
+        SDL_TARGETING("sse2") void mix_voice_sse2(float* out, const float* samples, int frames, float gain_left, float gain_right)
+        {
+            __m128 gain = _mm_setr_ps(gain_left, gain_right, gain_left, gain_right);
+            int i = 0;
+            for(; i + 2 <= frames; i += 2)
+            {
+                __m128 mixed = _mm_add_ps(_mm_loadu_ps(&out[i * 2]), _mm_mul_ps(_mm_loadu_ps(&samples[i * 2]), gain));
+                _mm_storeu_ps(&out[i * 2], mixed);
+            }
+            mix_voice_scalar(&out[i * 2], &samples[i * 2], frames - i, gain_left, gain_right);
+        }
+#endif
+
+        Mix_Kernel get_mix_kernel()
+        {
+            static Mix_Kernel kernel = nullptr;
+            if(kernel == nullptr)
+            {
+                kernel = mix_voice_scalar;
+#ifdef SDL_SSE2_INTRINSICS
+                if(SDL_HasSSE2())
+                {
+                    kernel = mix_voice_sse2;
+                }
+#endif
+            }
+            return kernel;
+        }
+
+        void start_voice(Mixer& mixer, const Sound_Command& command)
+        {
+            Voice* voice = &mixer.voices[0];
+            for(Voice& candidate : mixer.voices)
+            {
+                // the same sound twice in one buffer would only play louder
+                if(candidate.sound == command.sound && candidate.frame == 0)
+                {
+                    return;
+                }
+                if(voice->sound != -1 && (candidate.sound == -1 || candidate.started < voice->started))
+                {
+                    voice = &candidate;
+                }
+            }
+            // constant power pan
+            float angle = (command.pan + 1.0f) * SDL_PI_F * 0.25f;
+            voice->sound = command.sound;
+            voice->frame = 0;
+            voice->gain_left = command.gain * SDL_cosf(angle);
+            voice->gain_right = command.gain * SDL_sinf(angle);
+            voice->started = ++mixer.voices_started;
+        }
+
+        // runs on the audio thread whenever the device needs more, so a sound is heard one buffer after play_sound, music comes from its ring
+        void SDLCALL mix_audio(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount)
+        {
+            Mixer& mixer = sound_system.mixer;
+            Uint32 tail = mixer.command_tail.load(std::memory_order_acquire);
+            for(Uint32 head = mixer.command_head.load(std::memory_order_relaxed); head != tail; ++head)
+            {
+                start_voice(mixer, mixer.commands[head & (MIXER_COMMAND_COUNT - 1)]);
+                mixer.command_head.store(head + 1, std::memory_order_release);
+            }
+
+            Mix_Kernel kernel = get_mix_kernel();
+            const int frame_size = sizeof(float) * MIXER_CHANNELS;
+            int frames_left = (additional_amount + frame_size - 1) / frame_size;
+            while(frames_left > 0)
+            {
+                int frames = SDL_min(frames_left, MIXER_BUFFER_FRAMES);
+                SDL_memset(mixer.buffer, 0, frames * frame_size);
+                for(Voice& voice : mixer.voices)
+                {
+                    if(voice.sound == -1)
+                    {
+                        continue;
+                    }
+                    const Sound& sound = sound_system.data[voice.sound];
+                    int count = SDL_min(frames, sound.frame_count - voice.frame);
+                    kernel(mixer.buffer, &mixer.pool[sound.offset + voice.frame * MIXER_CHANNELS], count, voice.gain_left, voice.gain_right);
+                    voice.frame += count;
+                    if(voice.frame >= sound.frame_count)
+                    {
+                        voice.sound = -1;
+                    }
+                }
+
+                // an empty ring is silence until the decode job catches up
+                Music& music = sound_system.music;
+                Uint32 read = music.ring_read.load(std::memory_order_relaxed);
+                int buffered = SDL_min(static_cast<int>(music.ring_write.load(std::memory_order_acquire) - read), frames);
+                int slot = read & (MUSIC_RING_FRAMES - 1);
+                int first = SDL_min(buffered, MUSIC_RING_FRAMES - slot);
+                kernel(mixer.buffer, &music.ring[slot * MIXER_CHANNELS], first, 1.0f, 1.0f);
+                kernel(&mixer.buffer[first * MIXER_CHANNELS], music.ring, buffered - first, 1.0f, 1.0f);
+                music.ring_read.store(read + buffered, std::memory_order_release);
+                SDL_PutAudioStreamData(stream, mixer.buffer, frames * frame_size);
+                frames_left -= frames;
+            }
+        }
+
+        void start_mixer()
+        {
+            if(sound_system.audio_device == 0)
+            {
+                return;
+            }
+            Mixer& mixer = sound_system.mixer;
+            // mixing at the device rate leaves the stream nothing to resample, only float to the device sample format
+            // more than two device channels still get a stereo mix, SDL places it on the front pair
+            SDL_AudioSpec device_spec;
+            int device_frames = 0;
+            if (SDL_GetAudioDeviceFormat(sound_system.audio_device, &device_spec, &device_frames) && device_spec.freq > 0) {
+                mixer.spec.freq = device_spec.freq;
+            }
+            mixer.pool = static_cast<float*>(SDL_aligned_alloc(SOUND_POOL_ALIGNMENT, SOUND_POOL_SIZE * sizeof(float)));
+            mixer.pool_used = 0;
+
+            mixer.stream = SDL_CreateAudioStream(&mixer.spec, NULL);
+            if (!mixer.stream) {
+                SDL_Log("Couldn't create mixer stream: %s", SDL_GetError());
+                return;
+            }
+            SDL_SetAudioStreamGetCallback(mixer.stream, mix_audio, NULL);
+            if (!SDL_BindAudioStream(sound_system.audio_device, mixer.stream)) {
+                SDL_Log("Failed to bind mixer stream to device: %s", SDL_GetError());
+            }
+        }
+
+        void stop_mixer()
+        {
+            // destroying the stream waits for a running callback
+            SDL_DestroyAudioStream(sound_system.mixer.stream);
+            sound_system.mixer.stream = nullptr;
+            SDL_aligned_free(sound_system.mixer.pool);
+            sound_system.mixer.pool = nullptr;
+        }
+
+        const Sint16 IMA_STEP_TABLE[89] = {
+            7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+            50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+            337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+            2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+            15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+        };
+        const Sint8 IMA_INDEX_TABLE[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+        inline Sint16 decode_ima_nibble(int nibble, int& predictor, int& index)
+        {
+            int step = IMA_STEP_TABLE[index];
+            int difference = step >> 3;
+            difference += (nibble & 4) ? step : 0;
+            difference += (nibble & 2) ? step >> 1 : 0;
+            difference += (nibble & 1) ? step >> 2 : 0;
+            predictor += (nibble & 8) ? -difference : difference;
+            predictor = SDL_clamp(predictor, -32768, 32767);
+            index = SDL_clamp(index + IMA_INDEX_TABLE[nibble], 0, 88);
+            return static_cast<Sint16>(predictor);
+        }
+
+        // one wav ima adpcm block to interleaved s16, every channel starts with a 4 byte header then 4 byte groups alternate between channels
+        int decode_ima_adpcm_block(const Uint8* block, int size, int channels, Sint16* out)
+        {
+            int predictor[MIXER_CHANNELS];
+            int index[MIXER_CHANNELS];
+            for(int channel = 0; channel < channels; ++channel)
+            {
+                const Uint8* header = &block[channel * 4];
+                predictor[channel] = static_cast<Sint16>(header[0] | (header[1] << 8));
+                index[channel] = SDL_min(static_cast<int>(header[2]), 88);
+                out[channel] = static_cast<Sint16>(predictor[channel]);
+            }
+            const Uint8* data = &block[channels * 4];
+            int groups = (size / channels - 4) / 4;
+            for(int group = 0; group < groups; ++group)
+            {
+                for(int channel = 0; channel < channels; ++channel)
+                {
+                    for(int i = 0; i < 4; ++i)
+                    {
+                        Uint8 byte = *data++;
+                        int frame = 1 + group * 8 + i * 2;
+                        out[frame * channels + channel] = decode_ima_nibble(byte & 15, predictor[channel], index[channel]);
+                        out[(frame + 1) * channels + channel] = decode_ima_nibble(byte >> 4, predictor[channel], index[channel]);
+                    }
+                }
+            }
+            return 1 + groups * 8;
+        }
+
+        void close_music()
+        {
+            Music& music = sound_system.music;
+            if(music.file)
+            {
+                SDL_CloseIO(music.file);
+                music.file = nullptr;
+            }
+            SDL_DestroyAudioStream(music.converter);
+            music.converter = nullptr;
+        }
+
+        // reads the next block, or the first one again at the end of the track, into the converter
+        bool read_music_block()
+        {
+            Music& music = sound_system.music;
+            if(music.data_read >= music.data_size)
+            {
+                SDL_FlushAudioStream(music.converter);
+                SDL_SeekIO(music.file, music.data_offset, SDL_IO_SEEK_SET);
+                music.data_read = 0;
+                music.frames_read = 0;
+            }
+            int size = static_cast<int>(SDL_min(static_cast<Sint64>(music.block_size), music.data_size - music.data_read));
+            if(SDL_ReadIO(music.file, music.block.data(), size) != static_cast<size_t>(size))
+            {
+                return false;
+            }
+            music.data_read += size;
+            if(music.format == WAVE_FORMAT_PCM)
+            {
+                return SDL_PutAudioStreamData(music.converter, music.block.data(), size);
+            }
+            int frames = decode_ima_adpcm_block(music.block.data(), size, music.channels, music.decoded.data());
+            frames = static_cast<int>(SDL_min(static_cast<Sint64>(frames), music.frame_count - music.frames_read));
+            music.frames_read += frames;
+            return SDL_PutAudioStreamData(music.converter, music.decoded.data(), frames * music.channels * sizeof(Sint16));
+        }
+
+        // fills the free part of the ring, runs as a background job so disk reads and decoding stay off the game and audio threads
+        void decode_music(void* data, int begin, int end)
+        {
+            DEEP_PROFILE_SCOPE("decode_music");
+            Music& music = sound_system.music;
+            const int frame_size = sizeof(float) * MIXER_CHANNELS;
+            Uint32 write = music.ring_write.load(std::memory_order_relaxed);
+            Uint32 free_frames = MUSIC_RING_FRAMES - (write - music.ring_read.load(std::memory_order_acquire));
+            while(free_frames > 0)
+            {
+                int frames = SDL_min(static_cast<int>(free_frames), MUSIC_DECODE_FRAMES);
+                while(SDL_GetAudioStreamAvailable(music.converter) < frames * frame_size)
+                {
+                    if(!read_music_block())
+                    {
+                        SDL_Log("Couldn't read music: %s", SDL_GetError());
+                        music.data_size = 0;
+                        music.decoding.store(false, std::memory_order_release);
+                        return;
+                    }
+                }
+                SDL_GetAudioStreamData(music.converter, music.converted.data(), frames * frame_size);
+                for(int i = 0; i < frames; ++i)
+                {
+                    Uint32 slot = (write + i) & (MUSIC_RING_FRAMES - 1);
+                    music.ring[slot * 2] = music.converted[i * 2];
+                    music.ring[slot * 2 + 1] = music.converted[i * 2 + 1];
+                }
+                write += frames;
+                free_frames -= frames;
+                music.ring_write.store(write, std::memory_order_release);
+            }
+            music.decoding.store(false, std::memory_order_release);
+        }
+
+        // 16 bit pcm or ima adpcm wav, the compressed one is a quarter of the size
+        void load_music(const char *filename)
+        {
+            DEEP_PROFILE_SCOPE("load_music");
+            if(deep::headless)
+            {
+                return;
+            }
+            Music& music = sound_system.music;
+            wait_for_counter(&job_system.background_counter);
+            close_music();
+
+            char *wav_path = NULL;
+            SDL_asprintf(&wav_path, "ressources/music/%s", filename);
+            music.file = SDL_IOFromFile(wav_path, "rb");
+            SDL_free(wav_path);
+            if(music.file == nullptr)
+            {
+                SDL_Log("Couldn't open music %s: %s", filename, SDL_GetError());
+                return;
+            }
+
+            // walk the riff chunks up to the sample data
+            Uint32 riff = 0;
+            Uint32 riff_size = 0;
+            Uint32 wave = 0;
+            Uint32 frequency = 0;
+            Uint16 channels = 0;
+            Uint16 block_align = 0;
+            Uint16 bits = 0;
+            bool read = SDL_ReadU32LE(music.file, &riff) && SDL_ReadU32LE(music.file, &riff_size) && SDL_ReadU32LE(music.file, &wave)
+                && riff == 0x46464952 && wave == 0x45564157; // "RIFF" "WAVE"
+            music.format = 0;
+            music.frame_count = SDL_MAX_SINT64;
+            while(read)
+            {
+                Uint32 chunk = 0;
+                Uint32 chunk_size = 0;
+                read = SDL_ReadU32LE(music.file, &chunk) && SDL_ReadU32LE(music.file, &chunk_size);
+                Sint64 chunk_end = SDL_TellIO(music.file) + chunk_size + (chunk_size & 1);
+                if(read && chunk == 0x20746D66) // "fmt "
+                {
+                    Uint32 byte_rate = 0;
+                    read = SDL_ReadU16LE(music.file, &music.format) && SDL_ReadU16LE(music.file, &channels) && SDL_ReadU32LE(music.file, &frequency)
+                        && SDL_ReadU32LE(music.file, &byte_rate) && SDL_ReadU16LE(music.file, &block_align) && SDL_ReadU16LE(music.file, &bits);
+                }
+                else if(read && chunk == 0x74636166) // "fact"
+                {
+                    Uint32 frame_count = 0;
+                    read = SDL_ReadU32LE(music.file, &frame_count);
+                    music.frame_count = frame_count;
+                }
+                else if(read && chunk == 0x61746164) // "data"
+                {
+                    music.data_offset = SDL_TellIO(music.file);
+                    music.data_size = chunk_size;
+                    break;
+                }
+                read = read && SDL_SeekIO(music.file, chunk_end, SDL_IO_SEEK_SET) == chunk_end;
+            }
+            bool supported = (music.format == WAVE_FORMAT_PCM && bits == 16) || (music.format == WAVE_FORMAT_IMA_ADPCM && bits == 4);
+            if(!read || !supported || channels < 1 || channels > MIXER_CHANNELS || block_align == 0 || block_align > MUSIC_MAX_BLOCK_SIZE)
+            {
+                SDL_Log("%s is not a 16 bit pcm or ima adpcm wav with up to %d channels", filename, MIXER_CHANNELS);
+                close_music();
+                return;
+            }
+
+            music.channels = channels;
+            // pcm is read in blocks of about the same length as adpcm ones
+            music.block_size = music.format == WAVE_FORMAT_PCM ? block_align * 1024 : block_align;
+            music.data_read = 0;
+            music.frames_read = 0;
+            music.block.resize(music.block_size);
+            music.decoded.resize(music.format == WAVE_FORMAT_PCM ? 0 : (block_align / channels - 4) * 2 * channels + channels);
+            music.converted.resize(MUSIC_DECODE_FRAMES * MIXER_CHANNELS);
+
+            SDL_AudioSpec spec = { SDL_AUDIO_S16LE, channels, static_cast<int>(frequency) };
+            music.converter = SDL_CreateAudioStream(&spec, &sound_system.mixer.spec);
+            if(!music.converter)
+            {
+                SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
+                close_music();
+                return;
+            }
+
+            // the callback holds the stream lock while it reads the ring
+            if(sound_system.mixer.stream)
+            {
+                SDL_LockAudioStream(sound_system.mixer.stream);
+            }
+            music.ring_read.store(0, std::memory_order_relaxed);
+            music.ring_write.store(0, std::memory_order_relaxed);
+            if(sound_system.mixer.stream)
+            {
+                SDL_UnlockAudioStream(sound_system.mixer.stream);
+            }
+            decode_music(nullptr, 0, 0);
+        }
+
+        // tops the ring up once half of it has been played
+        void update_music()
+        {
+            Music& music = sound_system.music;
+            if(deep::headless || music.converter == nullptr || music.data_size == 0 || music.decoding.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            Uint32 buffered = music.ring_write.load(std::memory_order_relaxed) - music.ring_read.load(std::memory_order_relaxed);
+            if(buffered <= MUSIC_RING_FRAMES / 2)
+            {
+                music.decoding.store(true, std::memory_order_relaxed);
+                submit_background_job(decode_music, nullptr, 0, 0, &job_system.background_counter);
+            }
+        }
+    #pragma endregion Audio
+
+    #pragma region Map
+        void init_map(int size_x, int size_y)
+        {
+            init_tile_map(map.tiles, size_x, size_y);
+            map.version += 1;
+        }
+        void add_mesh_to_map(int index, const char *filename, int rect)
+        {
+            if(index < map.meshes_max_count)
+            {
+                // collision does not depend on the mesh, headless runs have none but must collide the same
+                map.meshes[index].is_collision_top = rect == 1 || rect == 2 || rect == 3;
+                map.meshes[index].is_collision_right= rect == 3 || rect == 6 || rect == 9;
+                map.meshes[index].is_collision_bottom = rect == 7 || rect == 8 || rect == 9;
+                map.meshes[index].is_collision_left = rect == 1 || rect == 4 || rect == 7;
+                map.meshes[index].has_any_collision = rect != 5;
+                map.version += 1;
 
-                                    indices.reserve(indices.size() + indices_accessor->count);
+                // tile geometry stays on the cpu, the chunk streamer merges and uploads it per chunk
+                Map_Geometry& geometry = chunk_streamer.geometry[index];
+                if(deep::headless || !decode_gltf(filename, geometry.vertices, geometry.indices))
+                {
+                    return;
+                }
+                float bounding_radius = 0.0f;
+                for(const Vertex& vertex : geometry.vertices)
+                {
+                    bounding_radius = SDL_max(bounding_radius, glm::length(glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2])));
+                }
+                map.meshes[index].has_mesh = true;
+                map.meshes[index].bounding_radius = bounding_radius;
+            }
+        }
+        glm::vec3 map_position(int x, int y)
+        {
+            return glm::vec3(x*3.0f+1.5f, 0.0f, y*3.0f+1.5f);
+        }
+        void set_map(int x, int y, int tile)
+        {
+            if(tile < map.meshes_max_count && set_tile(map.tiles, x, y, tile))
+            {
+                map.version += 1;
+            }
+        }
+        void set_room(int x, int y, int room)
+        {
+            if(set_tile_room(map.tiles, x, y, room))
+            {
+                map.version += 1;
+            }
+        }
+    #pragma endregion Map
 
-                                    for (cgltf_size k = 0; k < indices_accessor->count; ++k) {
-                                        unsigned int index;
-                                        cgltf_accessor_read_uint(indices_accessor, k, &index, 1);
+    #pragma region Pathfinding
+        // top, right, bottom, left, same order as the tile collision flags
+        const glm::ivec2 FLOW_DIRECTIONS[4] = { glm::ivec2(0, -1), glm::ivec2(1, 0), glm::ivec2(0, 1), glm::ivec2(-1, 0) };
 
-                                        indices.push_back(current_vertex_offset + index);
-                                    }
-                                } else {
-                                    if (pos_accessor->count % 3 != 0) {
-                                        SDL_Log("Warning: Unindexed primitive has vertex count (%zu) not divisible by 3.\n", (size_t)pos_accessor->count);
-                                    }
+        bool is_tile_walkable(const Map& source, int x, int z)
+        {
+            return get_tile(source.tiles, x, z) != 0;
+        }
 
-                                    indices.reserve(indices.size() + pos_accessor->count);
-                                    for (Uint16 k = 0; k < pos_accessor->count; ++k) {
-                                        indices.push_back(current_vertex_offset + k);
-                                    }
-                                }
+        bool is_tile_walkable(int x, int z)
+        {
+            return is_tile_walkable(map, x, z);
+        }
 
-                                create_render_data(render_data, vertices, indices);
-                            }
-                        }
-                    }
-                } else {
-                    SDL_Log("Failed to load glTF buffers for %s", model_filename);
-                }
-                cgltf_free(data);
-            } else {
-                SDL_Log("Failed to parse glTF file %s", model_filename);
+        bool has_tile_wall(const Map& source, int x, int z, int direction)
+        {
+            const Map_Mesh& mesh = source.meshes[get_tile(source.tiles, x, z) - 1];
+            switch(direction)
+            {
+                case 0: return mesh.is_collision_top;
+                case 1: return mesh.is_collision_right;
+                case 2: return mesh.is_collision_bottom;
+                default: return mesh.is_collision_left;
             }
         }
 
-        void render()
+        // a wall on either side of the shared edge blocks it
+        bool is_tile_edge_open(const Map& source, int x, int z, int direction)
         {
-            // acquire the command buffer
-            SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(render_context.device);
+            glm::ivec2 neighbour = glm::ivec2(x, z) + FLOW_DIRECTIONS[direction];
+            if(!is_tile_walkable(source, x, z) || !is_tile_walkable(source, neighbour.x, neighbour.y))
+            {
+                return false;
+            }
+            return !has_tile_wall(source, x, z, direction) && !has_tile_wall(source, neighbour.x, neighbour.y, (direction + 2) % 4);
+        }
 
-            // get the swapchain texture
-            SDL_GPUTexture* swapchain_texture;
-            Uint32 width, height;
-            SDL_WaitAndAcquireGPUSwapchainTexture(command_buffer, render_context.window, &swapchain_texture, &width, &height);
+        bool is_tile_edge_open(int x, int z, int direction)
+        {
+            return is_tile_edge_open(map, x, z, direction);
+        }
 
-            // end the frame early if a swapchain texture is not available
-            if (swapchain_texture == NULL)
+        void build_flow_field(Flow_Field& field)
+        {
+            int tile_slot_count = static_cast<int>(map.tiles.chunks.size()) * MAP_CHUNK_TILES;
+            field.distance.assign(tile_slot_count, FLOW_UNREACHABLE);
+            field.next.assign(tile_slot_count, -1);
+            field.queue.resize(tile_slot_count);
+            int head = 0;
+            int tail = 0;
+
+            field.map_version = map.version;
+            if(!is_tile_walkable(field.target_tile.x, field.target_tile.y))
             {
-                // you must always submit the command buffer
-                SDL_SubmitGPUCommandBuffer(command_buffer);
                 return;
             }
 
-            // create the color target
-            SDL_GPUColorTargetInfo color_target_info{};
-            color_target_info.clear_color = {0/255.0f, 0/255.0f, 0/255.0f, 255/255.0f};
-            color_target_info.load_op = SDL_GPU_LOADOP_CLEAR;
-            color_target_info.store_op = SDL_GPU_STOREOP_STORE;
-            color_target_info.texture = swapchain_texture;
+            field.distance[get_tile_slot(map.tiles, field.target_tile.x, field.target_tile.y)] = 0;
+            field.queue[tail++] = field.target_tile;
+            while(head < tail)
+            {
+                glm::ivec2 tile = field.queue[head++];
+                Uint16 distance = field.distance[get_tile_slot(map.tiles, tile.x, tile.y)];
+                for(int direction = 0; direction < 4; ++direction)
+                {
+                    glm::ivec2 neighbour = tile + FLOW_DIRECTIONS[direction];
+                    if(!is_tile_edge_open(tile.x, tile.y, direction))
+                    {
+                        continue;
+                    }
+                    int slot = get_tile_slot(map.tiles, neighbour.x, neighbour.y);
+                    if(field.distance[slot] != FLOW_UNREACHABLE)
+                    {
+                        continue;
+                    }
+                    field.distance[slot] = distance + 1;
+                    // the neighbour walks back the way the search came
+                    field.next[slot] = (direction + 2) % 4;
+                    field.queue[tail++] = neighbour;
+                }
+            }
+        }
 
-            SDL_GPUDepthStencilTargetInfo depth_stencil_target_info = {};
-            depth_stencil_target_info.texture = render_context.scene_depth_texture;
-            depth_stencil_target_info.cycle = true;
-            depth_stencil_target_info.clear_depth = 1;
-            depth_stencil_target_info.clear_stencil = 0;
-            depth_stencil_target_info.load_op = SDL_GPU_LOADOP_CLEAR;
-            depth_stencil_target_info.store_op = SDL_GPU_STOREOP_STORE;
-            depth_stencil_target_info.stencil_load_op = SDL_GPU_LOADOP_CLEAR;
-            depth_stencil_target_info.stencil_store_op = SDL_GPU_STOREOP_STORE;
+        // only rebuilds when the player entered another tile or the map changed
+        void update_flow_field(int player_id, glm::vec2 player_position)
+        {
+            Flow_Field& field = flow_fields[player_id];
+            glm::ivec2 tile = glm::ivec2(static_cast<int>(SDL_floorf(player_position.x / 3.0f)), static_cast<int>(SDL_floorf(player_position.y / 3.0f)));
+            field.target_position = player_position;
+            if(tile != field.target_tile || field.map_version != map.version)
+            {
+                field.target_tile = tile;
+                build_flow_field(field);
+            }
+        }
 
-                // begin a render pass
-                SDL_GPURenderPass* render_pass = SDL_BeginGPURenderPass(command_buffer, &color_target_info, 1, &depth_stencil_target_info);
+        // unit direction to follow from position, heads for the center of the next tile and straight
+        // for the player once in the same tile, zero when the player can't be reached
+        glm::vec2 sample_flow_field(int player_id, glm::vec2 position)
+        {
+            const Flow_Field& field = flow_fields[player_id];
+            int x = static_cast<int>(SDL_floorf(position.x / 3.0f));
+            int z = static_cast<int>(SDL_floorf(position.y / 3.0f));
+            int slot = get_tile_slot(map.tiles, x, z);
+            if(slot < 0 || slot >= (int)field.distance.size() || field.distance[slot] == FLOW_UNREACHABLE)
+            {
+                return glm::vec2(0.0f, 0.0f);
+            }
 
-                // bind the pipeline
-                SDL_BindGPUGraphicsPipeline(render_pass, render_context.graphics_pipeline);
+            glm::vec2 goal = field.target_position;
+            if(field.next[slot] != -1)
+            {
+                glm::ivec2 next_tile = glm::ivec2(x, z) + FLOW_DIRECTIONS[field.next[slot]];
+                goal = glm::vec2(next_tile.x * 3.0f + 1.5f, next_tile.y * 3.0f + 1.5f);
+            }
+            glm::vec2 offset = goal - position;
+            float length = glm::length(offset);
+            return length > 0.0f ? offset / length : glm::vec2(0.0f, 0.0f);
+        }
+    #pragma endregion Pathfinding
 
-                Fragment_Uniform_Buffer fragment_uniform_buffer{};
-                int lights_count = 0;
-                for (int i = 0; i < entities.count; ++i) {
-                    if(entities.data[i].light_component)
+    #pragma region Line Of Sight
+        // walks the tiles between the two tile centers, the crossings are compared in integers so
+        // the walk is exact and a to b crosses the same edges as b to a
+        bool trace_tiles(const Map& source, int from_x, int from_z, int to_x, int to_z)
+        {
+            int step_x = to_x > from_x ? 1 : -1;
+            int step_z = to_z > from_z ? 1 : -1;
+            int direction_x = step_x > 0 ? 1 : 3;
+            int direction_z = step_z > 0 ? 2 : 0;
+            int count_x = SDL_abs(to_x - from_x);
+            int count_z = SDL_abs(to_z - from_z);
+
+            int x = from_x;
+            int z = from_z;
+            int i_x = 0;
+            int i_z = 0;
+            while(i_x < count_x || i_z < count_z)
+            {
+                // next vertical line is crossed at (0.5 + i_x) / count_x, the next horizontal one at (0.5 + i_z) / count_z
+                int cross_x = (1 + 2 * i_x) * count_z;
+                int cross_z = (1 + 2 * i_z) * count_x;
+                if(i_x < count_x && (i_z >= count_z || cross_x < cross_z))
+                {
+                    if(!is_tile_edge_open(source, x, z, direction_x))
                     {
-                        fragment_uniform_buffer.lights[lights_count].position = entities.data[i].light_position;
-                        fragment_uniform_buffer.lights[lights_count].ambient = glm::vec3(0.2f, 0.2f, 0.2f);
-                        fragment_uniform_buffer.lights[lights_count].diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
-                        fragment_uniform_buffer.lights[lights_count].specular = glm::vec3(1.0f, 1.0f, 1.0f);
-                        fragment_uniform_buffer.lights[lights_count].constant_linear_quadratic = glm::vec3(1.0f, 0.09f, 0.032f);
-                        lights_count++;
+                        return false;
                     }
+                    x += step_x;
+                    i_x += 1;
                 }
-                fragment_uniform_buffer.number_of_lights = lights_count;                
-
-                SDL_GPUTextureSamplerBinding texture_sampler_binding[4];
-                texture_sampler_binding[0].texture = render_context.diffuse_map;
-                texture_sampler_binding[0].sampler = render_context.sampler;
-                texture_sampler_binding[1].texture = render_context.specular_map;
-                texture_sampler_binding[1].sampler = render_context.sampler;
-                texture_sampler_binding[2].texture = render_context.shininess_map;
-                texture_sampler_binding[2].sampler = render_context.sampler;
-                texture_sampler_binding[3].texture = render_context.scene_depth_texture;
-                texture_sampler_binding[3].sampler = render_context.sampler;
-                SDL_BindGPUFragmentSamplers(render_pass, 0, texture_sampler_binding, 3);
-
-
-                int viewport_count = 1;
-                float viewport_w = window_size_w;
-                float viewport_h = window_size_h;
-                if(deep::use_both_monitors)
+                else if(i_z < count_z && (i_x >= count_x || cross_z < cross_x))
                 {
-                    viewport_count = 2;
-                    viewport_w = viewport_w / 2.0f;
+                    if(!is_tile_edge_open(source, x, z, direction_z))
+                    {
+                        return false;
+                    }
+                    z += step_z;
+                    i_z += 1;
                 }
-
-                SDL_GPUViewport viewports[2];
-                viewports[0].x = 0.0f;
-                viewports[0].y = 0.0f;
-                viewports[0].w = viewport_w;
-                viewports[0].h = viewport_h;
-                viewports[0].min_depth = 0.0f;
-                viewports[0].max_depth = 1.0f;
-                viewports[1].x = viewport_w;
-                viewports[1].y = 0.0f;
-                viewports[1].w = viewport_w;
-                viewports[1].h = viewport_h;
-                viewports[1].min_depth = 0.0f;
-                viewports[1].max_depth = 1.0f;                
-
-                for(int vp_id = 0; vp_id < viewport_count; ++vp_id)
+                else
                 {
-                    Vertex_Uniform_Buffer vertex_uniform_buffer{};
-                    vertex_uniform_buffer.view = camera_get_view_matrix(vp_id);
-                    vertex_uniform_buffer.projection = cameras[vp_id].projection;
-
-                    fragment_uniform_buffer.camera_position = cameras[vp_id].position;
-                    SDL_PushGPUFragmentUniformData(command_buffer, 0, &fragment_uniform_buffer, sizeof(Fragment_Uniform_Buffer));
-
-                    SDL_SetGPUViewport(render_pass, &viewports[vp_id]);
+                    // exactly through a corner, either way around it will do
+                    bool around_x = is_tile_edge_open(source, x, z, direction_x) && is_tile_edge_open(source, x + step_x, z, direction_z);
+                    bool around_z = is_tile_edge_open(source, x, z, direction_z) && is_tile_edge_open(source, x, z + step_z, direction_x);
+                    if(!around_x && !around_z)
+                    {
+                        return false;
+                    }
+                    x += step_x;
+                    z += step_z;
+                    i_x += 1;
+                    i_z += 1;
+                }
+            }
+            return true;
+        }
 
-                    for (int i = 0; i < entities.count; ++i) {
-                        if(entities.data[i].is_active && entities.data[i].mesh_component)
+        // one row per tile of the occupied chunks so the rows build in parallel, the cost grows with the
+        // number of tiles and not with the map area squared
+        void build_line_of_sight(const Map& source, Line_Of_Sight& sight)
+        {
+            int tile_slot_count = static_cast<int>(source.tiles.chunks.size()) * MAP_CHUNK_TILES;
+            sight.visible.assign(tile_slot_count * LOS_WORD_COUNT, 0);
+            parallel_for(tile_slot_count, 16, [&](int begin, int end)
+            {
+                for(int from = begin; from < end; ++from)
+                {
+                    glm::ivec2 from_position;
+                    if(get_slot_tile(source.tiles, from, from_position) == 0)
+                    {
+                        continue;
+                    }
+                    Uint64* row = &sight.visible[from * LOS_WORD_COUNT];
+                    int from_x = from_position.x;
+                    int from_z = from_position.y;
+                    for(int dz = -LOS_RADIUS; dz <= LOS_RADIUS; ++dz)
+                    {
+                        for(int dx = -LOS_RADIUS; dx <= LOS_RADIUS; ++dx)
                         {
-                            vertex_uniform_buffer.model = entities.data[i].transform;
-                            SDL_PushGPUVertexUniformData(command_buffer, 0, &vertex_uniform_buffer, sizeof(Vertex_Uniform_Buffer));
-
-                            // bind the vertex buffer
-                            SDL_GPUBufferBinding vertex_buffer_binding{};
-                            vertex_buffer_binding.buffer = entities.data[i].vertex_buffer;
-                            vertex_buffer_binding.offset = 0;
-                            SDL_BindGPUVertexBuffers(render_pass, 0, &vertex_buffer_binding, 1);
-
-                            SDL_GPUBufferBinding index_buffer_binding{};
-                            index_buffer_binding.buffer = entities.data[i].index_buffer;
-                            index_buffer_binding.offset = 0;
-                            SDL_BindGPUIndexBuffer(render_pass, &index_buffer_binding, SDL_GPU_INDEXELEMENTSIZE_16BIT);
-
-                            // issue a draw call
-                            SDL_DrawGPUIndexedPrimitives(render_pass, entities.data[i].index_count, 1, 0, 0, 0);
+                            int to_x = from_x + dx;
+                            int to_z = from_z + dz;
+                            if(is_tile_walkable(source, to_x, to_z) && trace_tiles(source, from_x, from_z, to_x, to_z))
+                            {
+                                int bit = (dz + LOS_RADIUS) * LOS_WINDOW + dx + LOS_RADIUS;
+                                row[bit / 64] |= Uint64(1) << (bit % 64);
+                            }
                         }
                     }
+                }
+            });
+            sight.map_version = source.version;
+        }
 
-                    for (int row = 0; row < deep::MAP_SIZE_Y; ++row) {
-                        for (int col = 0; col < deep::MAP_SIZE_X; ++col) {
-                            if (map.map[row][col] != 0) 
-                            {
-                                int mesh_index = map.map[row][col] - 1;
+        // rebuilds after map changes, call from the main thread before querying from jobs
+        void ensure_line_of_sight()
+        {
+            if(line_of_sight.map_version != map.version)
+            {
+                build_line_of_sight(map, line_of_sight);
+            }
+        }
+
+        bool has_line_of_sight(glm::vec2 from, glm::vec2 to)
+        {
+            int from_x = static_cast<int>(SDL_floorf(from.x / 3.0f));
+            int from_z = static_cast<int>(SDL_floorf(from.y / 3.0f));
+            int to_x = static_cast<int>(SDL_floorf(to.x / 3.0f));
+            int to_z = static_cast<int>(SDL_floorf(to.y / 3.0f));
+            if(!is_tile_walkable(from_x, from_z) || !is_tile_walkable(to_x, to_z))
+            {
+                return false;
+            }
+            int dx = to_x - from_x;
+            int dz = to_z - from_z;
+            if(SDL_abs(dx) > LOS_RADIUS || SDL_abs(dz) > LOS_RADIUS)
+            {
+                return trace_tiles(map, from_x, from_z, to_x, to_z);
+            }
+            int bit = (dz + LOS_RADIUS) * LOS_WINDOW + dx + LOS_RADIUS;
+            return (line_of_sight.visible[get_tile_slot(map.tiles, from_x, from_z) * LOS_WORD_COUNT + bit / 64] >> (bit % 64)) & 1;
+        }
+    #pragma endregion Line Of Sight
 
-                                glm::mat4 transform = glm::mat4(1.0f);
-                                transform = glm::translate(transform, glm::vec3(col*3.0f+1.5f, 0.0f, row*3.0f+1.5f));
+    #pragma region Level Bake
+        // safe on any thread while the game runs, the mesh collision flags it reads only change while loading
+        void bake_level_map(const deep::Tile_Map& level)
+        {
+            SDL_memcpy(map_bake.map.meshes, map.meshes, sizeof(map.meshes));
+            map_bake.map.tiles = level;
+            bake_collision_grid(map_bake.map, map_bake.collision_grid);
+            build_line_of_sight(map_bake.map, map_bake.line_of_sight);
+        }
 
-                                vertex_uniform_buffer.model = transform;
-                                SDL_PushGPUVertexUniformData(command_buffer, 0, &vertex_uniform_buffer, sizeof(Vertex_Uniform_Buffer));
+        // swaps the baked level in between two steps, the derived data is marked current so nothing rebuilds
+        void apply_level_map()
+        {
+            std::swap(map.tiles, map_bake.map.tiles);
+            map.version += 1;
+            std::swap(collision_grid.masks, map_bake.collision_grid.masks);
+            collision_grid.map_version = map.version;
+            std::swap(line_of_sight.visible, map_bake.line_of_sight.visible);
+            line_of_sight.map_version = map.version;
+        }
+    #pragma endregion Level Bake
 
-                                // bind the vertex buffer
-                                SDL_GPUBufferBinding vertex_buffer_binding{};
-                                vertex_buffer_binding.buffer = map.meshes[mesh_index].vertex_buffer;
-                                vertex_buffer_binding.offset = 0;
-                                SDL_BindGPUVertexBuffers(render_pass, 0, &vertex_buffer_binding, 1);
+    #pragma region Raycast
+        const int RAY_MAX_CELLS = 128;
+        const float RAY_NO_HIT = 3.402823466e+38f;
 
-                                SDL_GPUBufferBinding index_buffer_binding{};
-                                index_buffer_binding.buffer = map.meshes[mesh_index].index_buffer;
-                                index_buffer_binding.offset = 0;
-                                SDL_BindGPUIndexBuffer(render_pass, &index_buffer_binding, SDL_GPU_INDEXELEMENTSIZE_16BIT);
+        // walks the tiles the ray passes with a dda and stops at the first closed edge, the visited tiles are the
+        // broadphase for the entity test, returns the wall distance or max_distance
+        float trace_ray_walls(const deep::Ray& ray, glm::ivec2* cells, int& cell_count)
+        {
+            cell_count = 0;
+            int x = static_cast<int>(SDL_floorf(ray.origin.x / 3.0f));
+            int z = static_cast<int>(SDL_floorf(ray.origin.y / 3.0f));
+            if(!is_tile_walkable(x, z))
+            {
+                return 0.0f;
+            }
 
-                                // issue a draw call
-                                SDL_DrawGPUIndexedPrimitives(render_pass, map.meshes[mesh_index].index_count, 1, 0, 0, 0);
-                            }
-                        }
-                    }
+            int step_x = ray.direction.x > 0.0f ? 1 : -1;
+            int step_z = ray.direction.y > 0.0f ? 1 : -1;
+            int direction_x = step_x > 0 ? 1 : 3;
+            int direction_z = step_z > 0 ? 2 : 0;
+            float delta_x = ray.direction.x != 0.0f ? 3.0f / SDL_fabsf(ray.direction.x) : RAY_NO_HIT;
+            float delta_z = ray.direction.y != 0.0f ? 3.0f / SDL_fabsf(ray.direction.y) : RAY_NO_HIT;
+            float next_x = ray.direction.x != 0.0f ? ((x + (step_x > 0 ? 1 : 0)) * 3.0f - ray.origin.x) / ray.direction.x : RAY_NO_HIT;
+            float next_z = ray.direction.y != 0.0f ? ((z + (step_z > 0 ? 1 : 0)) * 3.0f - ray.origin.y) / ray.direction.y : RAY_NO_HIT;
 
+            while(true)
+            {
+                if(cell_count < RAY_MAX_CELLS)
+                {
+                    cells[cell_count++] = glm::ivec2(x, z);
                 }
-                
-                // end the render pass
-                SDL_EndGPURenderPass(render_pass);
-
-                // ImGui Rendering Pass (No Depth)
-                ImGui::Render();
-                ImDrawData* draw_data = ImGui::GetDrawData();
-                const bool is_minimized = (draw_data->DisplaySize.x <= 0.0f || draw_data->DisplaySize.y <= 0.0f);
-                ImGui_ImplSDLGPU3_PrepareDrawData(draw_data, command_buffer);
-                SDL_GPUColorTargetInfo imgui_color_target_info{};
-                imgui_color_target_info.texture = swapchain_texture;
-                imgui_color_target_info.load_op = SDL_GPU_LOADOP_LOAD;
-                imgui_color_target_info.store_op = SDL_GPU_STOREOP_STORE;
-                SDL_GPURenderPass* imgui_render_pass = SDL_BeginGPURenderPass(command_buffer, &imgui_color_target_info, 1, NULL); // NULL for depth_stencil_target_info
-                if (!is_minimized)
+                bool along_x = next_x < next_z;
+                float distance = along_x ? next_x : next_z;
+                if(distance > ray.max_distance)
                 {
-                    ImGui_ImplSDLGPU3_RenderDrawData(draw_data, command_buffer, imgui_render_pass);
+                    return ray.max_distance;
                 }
-                SDL_EndGPURenderPass(imgui_render_pass);
+                if(!is_tile_edge_open(x, z, along_x ? direction_x : direction_z))
+                {
+                    return distance;
+                }
+                if(along_x)
+                {
+                    x += step_x;
+                    next_x += delta_x;
+                }
+                else
+                {
+                    z += step_z;
+                    next_z += delta_z;
+                }
+            }
+        }
 
-            // submit the command buffer
-            SDL_SubmitGPUCommandBuffer(command_buffer);
+        // distance along the ray to the first contact with the circle, RAY_NO_HIT when it misses
+        float intersect_ray_circle(const deep::Ray& ray, glm::vec2 center, float radius)
+        {
+            glm::vec2 offset = ray.origin - center;
+            float b = glm::dot(offset, ray.direction);
+            float c = glm::dot(offset, offset) - radius * radius;
+            if(c > 0.0f && b > 0.0f)
+            {
+                return RAY_NO_HIT;
+            }
+            float discriminant = b * b - c;
+            if(discriminant < 0.0f)
+            {
+                return RAY_NO_HIT;
+            }
+            return SDL_max(-b - SDL_sqrtf(discriminant), 0.0f);
+        }
 
-            // Start the Dear ImGui frame
-            ImGui_ImplSDLGPU3_NewFrame();
-            ImGui_ImplSDL3_NewFrame();
-            ImGui::NewFrame();
+        // first wall or entity with a collision component along the ray, read only so it can run from jobs
+        deep::Ray_Hit cast_ray(const deep::Ray& ray)
+        {
+            glm::ivec2 cells[RAY_MAX_CELLS];
+            int cell_count = 0;
+            float wall_distance = trace_ray_walls(ray, cells, cell_count);
+
+            deep::Ray_Hit result{};
+            result.distance = wall_distance;
+            result.hit = wall_distance < ray.max_distance;
+
+            // entities overlap into the neighbouring cells, test every visited tile with its 8 neighbours once.
+            // the walk only ever steps forward, so a neighbour can only be shared with one of the last 4 visited tiles
+            const Spatial_Grid& grid = entity_store.grid;
+            Uint32 ignore_slot = is_entity_alive(ray.ignore) ? ray.ignore.index : NO_COMPONENT;
+            for(int i = 0; i < cell_count && !grid.heads.empty(); ++i)
+            {
+                int cell_x = cells[i].x;
+                int cell_z = cells[i].y;
+                for(int z = SDL_max(cell_z - 1, 0); z <= SDL_min(cell_z + 1, grid.size_y - 1); ++z)
+                {
+                    for(int x = SDL_max(cell_x - 1, 0); x <= SDL_min(cell_x + 1, grid.size_x - 1); ++x)
+                    {
+                        bool tested = false;
+                        for(int k = SDL_max(i - 4, 0); k < i; ++k)
+                        {
+                            tested |= SDL_abs(cells[k].x - x) <= 1 && SDL_abs(cells[k].y - z) <= 1;
+                        }
+                        if(tested)
+                        {
+                            continue;
+                        }
+                        int cell = z * grid.size_x + x;
+
+                        for(Uint32 slot = grid.heads[cell]; slot != NO_COMPONENT; slot = grid.next[slot])
+                        {
+                            if(slot == ignore_slot || !has_component(entity_store.collisions, slot))
+                            {
+                                continue;
+                            }
+                            glm::vec3 position = entity_store.positions.data[entity_store.positions.sparse[slot]].position;
+                            float radius = entity_store.collisions.data[entity_store.collisions.sparse[slot]].radius + ray.radius;
+                            float distance = intersect_ray_circle(ray, glm::vec2(position.x, position.z), radius);
+                            if(distance <= result.distance && distance <= ray.max_distance)
+                            {
+                                result.hit = true;
+                                result.distance = distance;
+                                result.entity = entity_from_slot(slot);
+                            }
+                        }
+                    }
+                }
+            }
+            result.point = ray.origin + ray.direction * result.distance;
+            return result;
         }
-    #pragma endregion Renderer
 
-    #pragma region Audio
-        void load_music(const char *filename)
-        {            
-            SDL_AudioSpec spec;
-            char *wav_path = NULL;
+        void cast_rays(const deep::Ray* rays, deep::Ray_Hit* hits, int count)
+        {
+            parallel_for(count, 64, [&](int begin, int end)
+            {
+                for(int i = begin; i < end; ++i)
+                {
+                    hits[i] = cast_ray(rays[i]);
+                }
+            });
+        }
+    #pragma endregion Raycast
 
-            /* Load the .wav files from wherever the app is being run from. */
-            SDL_asprintf(&wav_path, "ressources/music/%s", filename);  /* allocate a string of the full file path */
-            if (!SDL_LoadWAV(wav_path, &spec, &sound_system.music.wav_data, &sound_system.music.wav_data_len)) {
-                SDL_Log("Couldn't load .wav file: %s", SDL_GetError());
-            }
+    #pragma region Replay
+        bool write_replay_float(float value)
+        {
+            Uint32 bits;
+            SDL_memcpy(&bits, &value, sizeof(bits));
+            return SDL_WriteU32LE(replay.stream, bits);
+        }
 
-            /* Create an audio stream. Set the source format to the wav's format (what
-            we'll input), leave the dest format NULL here (it'll change to what the
-            device wants once we bind it). */
-            sound_system.music.stream = SDL_CreateAudioStream(&spec, NULL);
-            if (!sound_system.music.stream) {
-                SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
-            } else if (!SDL_BindAudioStream(sound_system.audio_device, sound_system.music.stream)) {  /* once bound, it'll start playing when there is data available! */
-                SDL_Log("Failed to bind '%s' stream to device: %s", filename, SDL_GetError());
+        bool read_replay_float(float* value)
+        {
+            Uint32 bits;
+            if(!SDL_ReadU32LE(replay.stream, &bits))
+            {
+                return false;
             }
-
-            SDL_free(wav_path);  /* done with this string. */            
+            SDL_memcpy(value, &bits, sizeof(bits));
+            return true;
         }
 
-        int load_sound(const char *filename)
+        bool is_same_input(const deep::Input_Frame& a, const deep::Input_Frame& b)
         {
-            if(sound_system.count < sound_system.max_count)
+            if(a.buttons != b.buttons)
             {
-                int i = sound_system.count;
-                SDL_AudioSpec spec;
-                char *wav_path = NULL;
-
-                /* Load the .wav files from wherever the app is being run from. */
-                SDL_asprintf(&wav_path, "ressources/sound/%s", filename);  /* allocate a string of the full file path */
-                if (!SDL_LoadWAV(wav_path, &spec, &sound_system.data[i].wav_data, &sound_system.data[i].wav_data_len)) {
-                    SDL_Log("Couldn't load .wav file: %s", SDL_GetError());
+                return false;
+            }
+            for(int player_id = 0; player_id < deep::INPUT_MAX_PLAYERS; player_id++)
+            {
+                if(a.look[player_id] != b.look[player_id])
+                {
+                    return false;
                 }
+            }
+            return true;
+        }
 
-                /* Create an audio stream. Set the source format to the wav's format (what
-                we'll input), leave the dest format NULL here (it'll change to what the
-                device wants once we bind it). */
-                sound_system.data[i].stream = SDL_CreateAudioStream(&spec, NULL);
-                if (!sound_system.data[i].stream) {
-                    SDL_Log("Couldn't create audio stream: %s", SDL_GetError());
-                } else if (!SDL_BindAudioStream(sound_system.audio_device, sound_system.data[i].stream)) {  /* once bound, it'll start playing when there is data available! */
-                    SDL_Log("Failed to bind '%s' stream to device: %s", filename, SDL_GetError());
-                }
+        void write_input_run()
+        {
+            if(replay.run_length == 0)
+            {
+                return;
+            }
+            SDL_WriteU16LE(replay.stream, replay.run_length);
+            SDL_WriteU32LE(replay.stream, replay.frame.buttons);
+            for(int player_id = 0; player_id < deep::INPUT_MAX_PLAYERS; player_id++)
+            {
+                write_replay_float(replay.frame.look[player_id].x);
+                write_replay_float(replay.frame.look[player_id].y);
+            }
+            replay.run_length = 0;
+        }
 
-                SDL_free(wav_path);  /* done with this string. */
-                
-                sound_system.count += 1;
-                return sound_system.count-1;
+        bool start_recording(const char* filename, Uint64 seed)
+        {
+            replay.stream = SDL_IOFromFile(filename, "wb");
+            if(replay.stream == nullptr)
+            {
+                SDL_Log("Couldn't create replay %s: %s", filename, SDL_GetError());
+                return false;
             }
-            return -1;            
+            SDL_WriteU32LE(replay.stream, REPLAY_MAGIC);
+            SDL_WriteU32LE(replay.stream, REPLAY_VERSION);
+            SDL_WriteU64LE(replay.stream, seed);
+            SDL_WriteU64LE(replay.stream, SIMULATION_STEP_NS);
+            replay.recording = true;
+            replay.run_length = 0;
+            replay.step_count = 0;
+            return true;
         }
 
-        void play_sound(int id)
+        // once per simulation step, identical steps collapse into one run
+        void record_input(const deep::Input_Frame& frame)
         {
-            if (SDL_GetAudioStreamQueued(sound_system.data[id].stream) < (int)sound_system.data[id].wav_data_len) {
-                /* feed more data to the stream. It will queue at the end, and trickle out as the hardware needs more data. */
-                SDL_PutAudioStreamData(sound_system.data[id].stream, sound_system.data[id].wav_data, sound_system.data[id].wav_data_len);
+            if(!replay.recording)
+            {
+                return;
+            }
+            if(replay.run_length == 0xFFFF || (replay.run_length > 0 && !is_same_input(replay.frame, frame)))
+            {
+                write_input_run();
             }
+            if(replay.run_length == 0)
+            {
+                replay.frame = frame;
+            }
+            replay.run_length += 1;
+            replay.step_count += 1;
         }
 
-        void update_music()
+        void stop_replay()
         {
-            if (SDL_GetAudioStreamQueued(sound_system.music.stream) < (int)sound_system.music.wav_data_len) {
-                /* feed more data to the stream. It will queue at the end, and trickle out as the hardware needs more data. */
-                SDL_PutAudioStreamData(sound_system.music.stream, sound_system.music.wav_data, sound_system.music.wav_data_len);
+            if(replay.recording)
+            {
+                write_input_run();
             }
+            if(replay.stream)
+            {
+                SDL_CloseIO(replay.stream);
+                replay.stream = nullptr;
+            }
+            replay.recording = false;
+            replay.replaying = false;
         }
-    #pragma endregion Audio
 
-    #pragma region Map
-        void init_map()
+        bool start_replay(const char* filename, Uint64* seed)
         {
-            for (int x = 0; x < deep::MAP_SIZE_X; ++x) { // Rows
-                for (int y = 0; y < deep::MAP_SIZE_Y; ++y) { // Columns
-                    map.map[x][y] = 0;
-                }
+            replay.stream = SDL_IOFromFile(filename, "rb");
+            if(replay.stream == nullptr)
+            {
+                SDL_Log("Couldn't open replay %s: %s", filename, SDL_GetError());
+                return false;
+            }
+            Uint32 magic = 0;
+            Uint32 version = 0;
+            Uint64 step_ns = 0;
+            if(!SDL_ReadU32LE(replay.stream, &magic) || !SDL_ReadU32LE(replay.stream, &version) || !SDL_ReadU64LE(replay.stream, seed) || !SDL_ReadU64LE(replay.stream, &step_ns)
+                || magic != REPLAY_MAGIC || version != REPLAY_VERSION)
+            {
+                SDL_Log("%s is not a replay of this version", filename);
+                stop_replay();
+                return false;
+            }
+            // a different step length would not reproduce the same simulation
+            if(step_ns != SIMULATION_STEP_NS)
+            {
+                SDL_Log("Replay %s was recorded with a %llu ns step, this build steps %llu ns", filename, (unsigned long long)step_ns, (unsigned long long)SIMULATION_STEP_NS);
+                stop_replay();
+                return false;
             }
+            replay.replaying = true;
+            replay.run_length = 0;
+            replay.step_count = 0;
+            return true;
         }
-        void add_mesh_to_map(int index, const char *filename, int rect)
+
+        // false once the recording is exhausted
+        bool read_replay_input(deep::Input_Frame& frame)
         {
-            if(index < map.meshes_max_count)
+            if(!replay.replaying)
             {
-                if(map.meshes[index].has_mesh)
+                return false;
+            }
+            if(replay.run_length == 0)
+            {
+                Uint16 run_length = 0;
+                bool read = SDL_ReadU16LE(replay.stream, &run_length) && SDL_ReadU32LE(replay.stream, &replay.frame.buttons);
+                for(int player_id = 0; player_id < deep::INPUT_MAX_PLAYERS; player_id++)
                 {
-                    SDL_ReleaseGPUBuffer(render_context.device, map.meshes[index].vertex_buffer);
-                    SDL_ReleaseGPUBuffer(render_context.device, map.meshes[index].index_buffer);
+                    read = read && read_replay_float(&replay.frame.look[player_id].x) && read_replay_float(&replay.frame.look[player_id].y);
                 }
-                deep::Entity helper = {};
-                load_gltf(filename, helper);
-                map.meshes[index].has_mesh = true;
-                map.meshes[index].vertex_buffer = helper.vertex_buffer;
-                map.meshes[index].index_buffer = helper.index_buffer;                
-                map.meshes[index].index_count = helper.index_count;
-
-                map.meshes[index].is_collision_top = rect == 1 || rect == 2 || rect == 3;
-                map.meshes[index].is_collision_right= rect == 3 || rect == 6 || rect == 9;
-                map.meshes[index].is_collision_bottom = rect == 7 || rect == 8 || rect == 9;
-                map.meshes[index].is_collision_left = rect == 1 || rect == 4 || rect == 7;
-                map.meshes[index].has_any_collision = rect != 5;
+                if(!read || run_length == 0)
+                {
+                    stop_replay();
+                    return false;
+                }
+                replay.run_length = run_length;
             }
+            replay.run_length -= 1;
+            replay.step_count += 1;
+            frame = replay.frame;
+            return true;
         }
-        glm::vec3 map_position(int x, int y)
+    #pragma endregion Replay
+
+    #pragma region Snapshot
+        template<typename T>
+        void snapshot_write_value(deep::Snapshot& snapshot, const T& value)
         {
-            return glm::vec3(x*3.0f+1.5f, 0.0f, y*3.0f+1.5f);
+            static_assert(std::is_trivially_copyable_v<T>, "snapshots only hold plain data");
+            const Uint8* bytes = reinterpret_cast<const Uint8*>(&value);
+            snapshot.data.insert(snapshot.data.end(), bytes, bytes + sizeof(T));
         }
-        void set_map(int x, int y, int tile)
+
+        template<typename T>
+        void snapshot_write_vector(deep::Snapshot& snapshot, const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "snapshots only hold plain data");
+            snapshot_write_value(snapshot, (Uint64)values.size());
+            const Uint8* bytes = reinterpret_cast<const Uint8*>(values.data());
+            snapshot.data.insert(snapshot.data.end(), bytes, bytes + values.size() * sizeof(T));
+        }
+
+        template<typename T>
+        bool snapshot_read_value(deep::Snapshot& snapshot, T& value)
         {
-            if(x > -1 && y > -1 && x < deep::MAP_SIZE_X && y < deep::MAP_SIZE_Y && tile > -1 && tile < map.meshes_max_count)
+            static_assert(std::is_trivially_copyable_v<T>, "snapshots only hold plain data");
+            if(snapshot.read_offset + sizeof(T) > snapshot.data.size())
             {
-                map.map[y][x] = tile;
+                return false;
             }
+            SDL_memcpy(&value, snapshot.data.data() + snapshot.read_offset, sizeof(T));
+            snapshot.read_offset += sizeof(T);
+            return true;
         }
 
-        Map_Mesh* get_map_mesh(int x , int z)
+        template<typename T>
+        bool snapshot_read_vector(deep::Snapshot& snapshot, std::vector<T>& values)
         {
-            if (x < 0 || x >= deep::MAP_SIZE_X || z < 0 || z >= deep::MAP_SIZE_Y)
+            Uint64 count = 0;
+            if(!snapshot_read_value(snapshot, count) || count > (snapshot.data.size() - snapshot.read_offset) / sizeof(T))
             {
-                return nullptr;
+                return false;
+            }
+            values.resize(count);
+            SDL_memcpy(values.data(), snapshot.data.data() + snapshot.read_offset, count * sizeof(T));
+            snapshot.read_offset += count * sizeof(T);
+            return true;
+        }
+
+        // skips over the vector at the read offset when it holds the same bytes, leaves the offset alone otherwise
+        template<typename T>
+        bool snapshot_skip_matching_vector(deep::Snapshot& snapshot, const std::vector<T>& values)
+        {
+            size_t offset = snapshot.read_offset;
+            Uint64 count = 0;
+            if(snapshot_read_value(snapshot, count) && count == values.size()
+                && count * sizeof(T) <= snapshot.data.size() - snapshot.read_offset
+                && SDL_memcmp(snapshot.data.data() + snapshot.read_offset, values.data(), count * sizeof(T)) == 0)
+            {
+                snapshot.read_offset += count * sizeof(T);
+                return true;
             }
-            return &map.meshes[map.map[z][x]-1];
+            snapshot.read_offset = offset;
+            return false;
         }
-        bool is_position_blocked(glm::vec3 current_position, glm::vec3 next_position, float radius)
+
+        template<typename T>
+        void snapshot_write_pool(deep::Snapshot& snapshot, const Component_Pool<T>& pool)
         {
-            //return false;
+            snapshot_write_vector(snapshot, pool.data);
+            snapshot_write_vector(snapshot, pool.owners);
+            snapshot_write_vector(snapshot, pool.sparse);
+        }
 
-            next_position = next_position/3.0f; // Grid is 3 Units
-            radius = radius/3.0f;
+        template<typename T>
+        bool snapshot_read_pool(deep::Snapshot& snapshot, Component_Pool<T>& pool)
+        {
+            return snapshot_read_vector(snapshot, pool.data) && snapshot_read_vector(snapshot, pool.owners) && snapshot_read_vector(snapshot, pool.sparse);
+        }
 
-            int min_gx = static_cast<int>(floor(next_position.x - radius));
-            int max_gx = static_cast<int>(ceil(next_position.x + radius));
-            int min_gz = static_cast<int>(floor(next_position.z - radius));
-            int max_gz = static_cast<int>(ceil(next_position.z + radius));
+        // tiles, entities, cameras and ai schedule, assets are only referenced by id, the game appends its own state after this
+        void save_snapshot(deep::Snapshot& snapshot)
+        {
+            snapshot.data.clear();
+            snapshot.read_offset = 0;
+            snapshot_write_value(snapshot, SNAPSHOT_MAGIC);
+            snapshot_write_value(snapshot, SNAPSHOT_VERSION);
+
+            snapshot_write_value(snapshot, map.tiles.size_x);
+            snapshot_write_value(snapshot, map.tiles.size_y);
+            snapshot_write_vector(snapshot, map.tiles.chunk_index);
+            snapshot_write_vector(snapshot, map.tiles.chunks);
+            snapshot_write_value(snapshot, cameras);
+
+            snapshot_write_vector(snapshot, entity_store.generations);
+            snapshot_write_vector(snapshot, entity_store.free_slots);
+            snapshot_write_value(snapshot, entity_store.count);
+            snapshot_write_pool(snapshot, entity_store.positions);
+            snapshot_write_pool(snapshot, entity_store.velocities);
+            snapshot_write_pool(snapshot, entity_store.collisions);
+            snapshot_write_pool(snapshot, entity_store.lights);
+            snapshot_write_pool(snapshot, entity_store.renders);
+            snapshot_write_pool(snapshot, entity_store.enemies);
+            snapshot_write_pool(snapshot, entity_store.exits);
+            snapshot_write_value(snapshot, entity_store.grid.size_x);
+            snapshot_write_value(snapshot, entity_store.grid.size_y);
+            snapshot_write_vector(snapshot, entity_store.grid.heads);
+            snapshot_write_vector(snapshot, entity_store.grid.cells);
+            snapshot_write_vector(snapshot, entity_store.grid.next);
+            snapshot_write_vector(snapshot, entity_store.grid.previous);
+
+            snapshot_write_vector(snapshot, asset_streamer.requests);
+
+            snapshot_write_value(snapshot, ai_scheduler.frame);
+            snapshot_write_vector(snapshot, ai_scheduler.awake);
+        }
 
-            int current_x = static_cast<int>(floor(current_position.x/3.0f));
-            int current_z = static_cast<int>(floor(current_position.z/3.0f));
-            Map_Mesh* current_tile = get_map_mesh(current_x , current_z);
-            if (current_tile == nullptr)
+        // behaviors are coroutines and can't be copied, they are cleared and the game starts them again
+        bool restore_snapshot(deep::Snapshot& snapshot)
+        {
+            snapshot.read_offset = 0;
+            Uint32 magic = 0;
+            Uint32 version = 0;
+            if(!snapshot_read_value(snapshot, magic) || !snapshot_read_value(snapshot, version) || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
             {
+                SDL_Log("Snapshot is not of this version");
                 return false;
             }
+            clear_all_behaviors();
+
+            // rollbacks restore the same level over and over, only a different map rebuilds the derived grids and chunk meshes
+            int size_x = 0;
+            int size_y = 0;
+            bool read = snapshot_read_value(snapshot, size_x)
+                && snapshot_read_value(snapshot, size_y);
+            bool tiles_changed = false;
+            if(read && (size_x != map.tiles.size_x || size_y != map.tiles.size_y))
+            {
+                init_tile_map(map.tiles, size_x, size_y);
+                tiles_changed = true;
+            }
+            if(read && !snapshot_skip_matching_vector(snapshot, map.tiles.chunk_index))
+            {
+                read = snapshot_read_vector(snapshot, map.tiles.chunk_index);
+                tiles_changed = true;
+            }
+            if(read && !snapshot_skip_matching_vector(snapshot, map.tiles.chunks))
+            {
+                read = snapshot_read_vector(snapshot, map.tiles.chunks);
+                tiles_changed = true;
+            }
+            read = read
+                && snapshot_read_value(snapshot, cameras)
+                && snapshot_read_vector(snapshot, entity_store.generations)
+                && snapshot_read_vector(snapshot, entity_store.free_slots)
+                && snapshot_read_value(snapshot, entity_store.count)
+                && snapshot_read_pool(snapshot, entity_store.positions)
+                && snapshot_read_pool(snapshot, entity_store.velocities)
+                && snapshot_read_pool(snapshot, entity_store.collisions)
+                && snapshot_read_pool(snapshot, entity_store.lights)
+                && snapshot_read_pool(snapshot, entity_store.renders)
+                && snapshot_read_pool(snapshot, entity_store.enemies)
+                && snapshot_read_pool(snapshot, entity_store.exits)
+                && snapshot_read_value(snapshot, entity_store.grid.size_x)
+                && snapshot_read_value(snapshot, entity_store.grid.size_y)
+                && snapshot_read_vector(snapshot, entity_store.grid.heads)
+                && snapshot_read_vector(snapshot, entity_store.grid.cells)
+                && snapshot_read_vector(snapshot, entity_store.grid.next)
+                && snapshot_read_vector(snapshot, entity_store.grid.previous)
+                && snapshot_read_vector(snapshot, asset_streamer.requests)
+                && snapshot_read_value(snapshot, ai_scheduler.frame)
+                && snapshot_read_vector(snapshot, ai_scheduler.awake);
+            if(tiles_changed || !read)
+            {
+                map.version += 1;
+            }
+            if(!read)
+            {
+                SDL_Log("Snapshot is truncated, clearing the scene");
+                destroy_all_entities();
+                asset_streamer.requests.clear();
+                return false;
+            }
+            ai_scheduler.previous_awake.clear();
 
-            for (int gx = min_gx; gx <= max_gx; ++gx)
+            // gpu buffers belong to the mesh assets, resolve them again in case the snapshot came from a file,
+            // a mesh this run hasn't loaded drops the render component instead of drawing garbage buffers
+            for(int i = (int)entity_store.renders.data.size() - 1; i >= 0; --i)
             {
-                for (int gz = min_gz; gz <= max_gz; ++gz)
+                deep::Render_Component& render = entity_store.renders.data[i];
+                if(!is_mesh_ready(render.mesh_id))
                 {
-                    if (gx >= 0 && gx < deep::MAP_SIZE_X && gz >= 0 && gz < deep::MAP_SIZE_Y)
-                    {
-                        float block_min_x = (float)gx;
-                        float block_max_x = (float)gx + 1.0f;
-                        float block_min_z = (float)gz;
-                        float block_max_z = (float)gz + 1.0f;
-
-                        float closest_x = glm::clamp(next_position.x, block_min_x, block_max_x);
-                        float closest_z = glm::clamp(next_position.z, block_min_z, block_max_z);
-
-                        float dist_x = next_position.x - closest_x;
-                        float dist_z = next_position.z - closest_z;
-                        float distance_squared = (dist_x * dist_x) + (dist_z * dist_z);
-
-                        if (distance_squared < (radius * radius))
-                        {
-                            bool collision = false;
-                            if(current_x+1 == gx && current_z == gz)
-                            {
-                                collision = current_tile->is_collision_right;
-                            }
-                            if(current_x-1 == gx && current_z == gz)
-                            {
-                                collision = current_tile->is_collision_left;
-                            }
-                            if(current_z+1 == gz && current_x == gx)
-                            {
-                                collision = current_tile->is_collision_bottom;
-                            }
-                            if(current_z-1 == gz && current_x == gx)
-                            {
-                                collision = current_tile->is_collision_top;
-                            }
+                    remove_component(entity_store.renders, entity_store.renders.owners[i]);
+                    continue;
+                }
+                Mesh_Asset& mesh = mesh_assets.data[render.mesh_id];
+                render.vertex_buffer = mesh.vertex_buffer;
+                render.index_buffer = mesh.index_buffer;
+                render.index_count = mesh.index_count;
+            }
+            int remaining = 0;
+            for(int i = 0; i < (int)asset_streamer.requests.size(); ++i)
+            {
+                int mesh_id = asset_streamer.requests[i].mesh_id;
+                if(mesh_id > -1 && mesh_id < mesh_assets.count)
+                {
+                    asset_streamer.requests[remaining] = asset_streamer.requests[i];
+                    remaining += 1;
+                }
+            }
+            asset_streamer.requests.resize(remaining);
+            return true;
+        }
 
-                            if(!current_tile->has_any_collision)
-                            {
-                                if (current_x + 1 == gx && current_z - 1 == gz)
-                                {
-                                    Map_Mesh* corner_tile = get_map_mesh(gx , gz);
-                                    if (corner_tile != nullptr)
-                                    {
-                                        collision = corner_tile->is_collision_bottom || corner_tile->is_collision_left;
-                                    }
-                                }
-                                else if (current_x - 1 == gx && current_z - 1 == gz)
-                                {
-                                    Map_Mesh* corner_tile = get_map_mesh(gx , gz);
-                                    if (corner_tile != nullptr)
-                                    {
-                                        collision = corner_tile->is_collision_right || corner_tile->is_collision_bottom;
-                                    }
-                                }
-                                else if (current_x + 1 == gx && current_z + 1 == gz)
-                                {
-                                    Map_Mesh* corner_tile = get_map_mesh(gx , gz);
-                                    if (corner_tile != nullptr)
-                                    {
-                                        collision = corner_tile->is_collision_top || corner_tile->is_collision_left;
-                                    }
-                                }
-                                else if (current_x - 1 == gx && current_z + 1 == gz)
-                                {
-                                    Map_Mesh* corner_tile = get_map_mesh(gx , gz);
-                                    if (corner_tile != nullptr)
-                                    {
-                                        collision = corner_tile->is_collision_top || corner_tile->is_collision_right;
-                                    }
-                                }                                   
-                            }
+        bool save_snapshot_file(const char* filename, const deep::Snapshot& snapshot)
+        {
+            if(!SDL_SaveFile(filename, snapshot.data.data(), snapshot.data.size()))
+            {
+                SDL_Log("Couldn't save snapshot %s: %s", filename, SDL_GetError());
+                return false;
+            }
+            return true;
+        }
 
-                            if(collision){
-                                return collision;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        return true; // Out of Bounce
-                    }
-                }
+        bool load_snapshot_file(const char* filename, deep::Snapshot& snapshot)
+        {
+            size_t size = 0;
+            void* data = SDL_LoadFile(filename, &size);
+            if(data == nullptr)
+            {
+                SDL_Log("Couldn't load snapshot %s: %s", filename, SDL_GetError());
+                return false;
             }
-            return false;
+            snapshot.data.assign(static_cast<Uint8*>(data), static_cast<Uint8*>(data) + size);
+            snapshot.read_offset = 0;
+            SDL_free(data);
+            return true;
         }
-    #pragma endregion Map
+    #pragma endregion Snapshot
 
     #pragma region Game
         void init()
         {
+            if(deep::headless)
+            {
+                // the simulation only needs the jobs, cameras still want a projection
+                SDL_Init(0);
+                window_size_w = 640.0f;
+                window_size_h = 480.0f;
+                start_job_system();
+                start_asset_streamer();
+                camera_init(0, glm::vec3(0.0f, 0.0f, 0.0f));
+                camera_init(1, glm::vec3(0.0f, 0.0f, 0.0f));
+                init_map(0, 0);
+                return;
+            }
+
             steam_init = SteamAPI_Init();
             if (steam_init) {
                 SDL_Log("Steamworks API initialized successfully!");
@@ -1215,28 +6004,28 @@ namespace deepcore
             create_render_pipeline();
             create_depth_buffer();
             init_sound();
+            start_mixer();
+            start_job_system();
+            start_asset_streamer();
             setup_imgui();
             load_textures();
             camera_init(0, glm::vec3(0.0f, 0.0f, 0.0f));
             camera_init(1, glm::vec3(0.0f, 0.0f, 0.0f));
-            init_map();
+            init_map(0, 0);
         }
         void cleanup()
         {
-            for (int i = 0; i < entities.count; ++i) {
-                if(entities.data[i].mesh_component)
-                {
-                    SDL_ReleaseGPUBuffer(render_context.device, entities.data[i].vertex_buffer);
-                    SDL_ReleaseGPUBuffer(render_context.device, entities.data[i].index_buffer);
-                }
-            }       
-            for (int i = 0; i < map.meshes_count; ++i) {
-                if(map.meshes[i].has_mesh)
-                {
-                    SDL_ReleaseGPUBuffer(render_context.device, map.meshes[i].vertex_buffer);
-                    SDL_ReleaseGPUBuffer(render_context.device, map.meshes[i].index_buffer);
-                }
-            }         
+            // entities only borrow the buffers of the mesh assets, map chunks own theirs
+            stop_replay();
+            stop_asset_streamer();
+            stop_job_system();
+            if(deep::headless)
+            {
+                return;
+            }
+            stop_mixer();
+            close_music();
+            release_all_chunk_meshes();
 
             SDL_ReleaseGPUTexture(render_context.device, render_context.diffuse_map);
             SDL_ReleaseGPUTexture(render_context.device, render_context.specular_map);
@@ -1263,77 +6052,180 @@ namespace deepcore
         double last_frame_time = 0;
         double get_delta_time() 
         { 
-            double current_time = SDL_GetTicks() / 1000.0f;
+            double current_time = SDL_GetTicksNS() / (double)SDL_NS_PER_SECOND;
             double delta_time = current_time - last_frame_time;
             last_frame_time = current_time;
             return delta_time;
         }
 
-        void mouse_lock(bool lock) { SDL_SetWindowRelativeMouseMode(render_context.window, lock); }
+        // number of fixed steps to simulate this frame, the remainder carries over and sets the render blend
+        int begin_simulation_frame()
+        {
+            Uint64 now = SDL_GetTicksNS();
+            if(simulation_clock.last_ticks == 0)
+            {
+                simulation_clock.last_ticks = now;
+            }
+            Uint64 elapsed = SDL_min(now - simulation_clock.last_ticks, SIMULATION_MAX_FRAME_NS);
+            simulation_clock.last_ticks = now;
+
+            simulation_clock.accumulator += (Uint64)(elapsed * simulation_clock.time_scale);
+            int step_count = simulation_clock.accumulator / SIMULATION_STEP_NS;
+            simulation_clock.accumulator -= step_count * SIMULATION_STEP_NS;
+            simulation_clock.alpha = simulation_clock.accumulator / (float)SIMULATION_STEP_NS;
+            return step_count;
+        }
+
+        float get_simulation_step_time()
+        {
+            return SIMULATION_STEP_NS / (float)SDL_NS_PER_SECOND;
+        }
+
+        // remembers where everything was so rendering can blend between this step and the next
+        void begin_simulation_step()
+        {
+            for(deep::Position_Component& position : entity_store.positions.data)
+            {
+                position.previous_position = position.position;
+            }
+            for(Camera& camera : cameras)
+            {
+                camera.previous_position = camera.position;
+            }
+            simulation_clock.step_count += 1;
+        }
+
+        void set_time_scale(double time_scale)
+        {
+            simulation_clock.time_scale = SDL_max(time_scale, 0.0);
+        }
+
+        void mouse_lock(bool lock) { if(!deep::headless) { SDL_SetWindowRelativeMouseMode(render_context.window, lock); } }
 
         void clear_scene() {
             camera_init(0, glm::vec3(0.0f, 0.0f, 0.0f));
             camera_init(1, glm::vec3(0.0f, 0.0f, 0.0f));
 
-            for (int i = 0; i < entities.count; ++i) {
-                if(entities.data[i].mesh_component)
-                {
-                    destroy_render_data(entities.data[i]);
-                }
-                entities.data[i].is_active = false;
-                entities.data[i].transform = glm::mat4(1.0f);
-
-                entities.data[i].light_component = false;
-                entities.data[i].light_position = glm::vec3(0.0f, 0.0f, 0.0f);
+            destroy_all_entities();
+            asset_streamer.requests.clear();
+        }
 
-                entities.data[i].mesh_component = false;
+        int get_entity_count()
+        {
+            return entity_store.count;
+        }
 
-                entities.data[i].hurt_component = false;
-            }
-            entities.count = 0;
+        void add_light(deep::Entity entity, glm::vec3 position)
+        {
+            set_entity_position(entity, position);
+            add_component(entity_store.lights, entity, deep::Light_Component{});
         }
 
-        int create_entity()
+        // moves on the xz plane, entities with a collision component slide along the map walls
+        void set_entity_position_2d(deep::Entity entity, glm::vec2 new_entity_position)
         {
-            if(entities.count < entities.max_count)
+            deep::Position_Component* position = get_component(entity_store.positions, entity);
+            if(position == nullptr)
+            {
+                return;
+            }
+            deep::Collision_Component* collision = get_component(entity_store.collisions, entity);
+            if(collision == nullptr)
             {
-                entities.data[entities.count].id = entities.count;
-                entities.data[entities.count].is_active = true;
-                entities.count += 1;
-                return entities.count-1;
+                position->position.x = new_entity_position.x;
+                position->position.z = new_entity_position.y;
+                update_spatial_cell(entity.index, position->position);
+                return;
             }
-            return -1;
-        }
 
-        int get_entity_count()
-        {
-            return entities.count;
+            glm::vec2 current = glm::vec2(position->position.x, position->position.z);
+            glm::vec2 resolved = resolve_circle_move(current, new_entity_position, collision->radius);
+            position->position.x = resolved.x;
+            position->position.z = resolved.y;
+            update_spatial_cell(entity.index, position->position);
         }
 
-        deep::Entity* get_entity(int entity_id)
+        void integrate_velocities(float delta_time)
         {
-            return &entities.data[entity_id];
+            static std::vector<deep::Entity> entities;
+            static std::vector<glm::vec2> current;
+            static std::vector<glm::vec2> desired;
+            static std::vector<float> radii;
+            static std::vector<glm::vec2> resolved;
+            entities.clear();
+            current.clear();
+            desired.clear();
+            radii.clear();
+
+            query([&](deep::Entity entity, deep::Velocity_Component& velocity, deep::Position_Component& position)
+            {
+                if(velocity.velocity.x == 0.0f && velocity.velocity.y == 0.0f)
+                {
+                    return;
+                }
+                glm::vec2 from = glm::vec2(position.position.x, position.position.z);
+                deep::Collision_Component* collision = get_component(entity_store.collisions, entity);
+                if(collision == nullptr)
+                {
+                    set_entity_position_2d(entity, from + velocity.velocity * delta_time);
+                    return;
+                }
+                entities.push_back(entity);
+                current.push_back(from);
+                desired.push_back(from + velocity.velocity * delta_time);
+                radii.push_back(collision->radius);
+            }, entity_store.velocities, entity_store.positions);
+
+            // every move only reads the baked grid, so the batch splits across the workers
+            resolved.resize(entities.size());
+            ensure_collision_grid();
+            parallel_for(entities.size(), 256, [&](int begin, int end)
+            {
+                resolve_circle_moves(&current[begin], &desired[begin], &radii[begin], &resolved[begin], end - begin);
+            });
+
+            for(size_t i = 0; i < entities.size(); ++i)
+            {
+                deep::Position_Component* position = get_component(entity_store.positions, entities[i]);
+                position->position.x = resolved[i].x;
+                position->position.z = resolved[i].y;
+                update_spatial_cell(entities[i].index, position->position);
+            }
         }
 
-        void add_light(int entity_id, glm::vec3 position)
+        void add_mesh(deep::Entity entity, const char *filename, glm::vec3 position, glm::vec3 rotation)
         {
-            entities.data[entity_id].light_component = true;
-            entities.data[entity_id].light_position = position;
+            set_entity_position(entity, position);
+            int mesh_id = load_mesh(filename);
+            if(mesh_id != -1)
+            {
+                attach_mesh(entity, mesh_id, rotation);
+            }
         }
 
-        void add_mesh(int entity_id, const char *filename, glm::vec3 position, glm::vec3 rotation)
+        // the entity is positioned right away but has no mesh until the loader finished, returns the mesh id
+        int add_mesh_async(deep::Entity entity, const char *filename, glm::vec3 position, glm::vec3 rotation)
         {
-            deep::Entity &mesh = entities.data[entity_id];
-            entities.data[entity_id].mesh_component = true;
-
-            load_gltf(filename, mesh);
-            
-            mesh.transform = glm::mat4(1.0f);
-            mesh.transform = glm::translate(mesh.transform, position);
-            mesh.transform = glm::rotate(mesh.transform, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-            mesh.transform = glm::rotate(mesh.transform, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-            mesh.transform = glm::rotate(mesh.transform, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-        } 
+            set_entity_position(entity, position);
+            if(deep::headless)
+            {
+                return -1;
+            }
+            int mesh_id = request_mesh(filename);
+            if(mesh_id == -1)
+            {
+                return -1;
+            }
+            if(mesh_assets.data[mesh_id].state == Asset_Ready)
+            {
+                attach_mesh(entity, mesh_id, rotation);
+            }
+            else
+            {
+                asset_streamer.requests.push_back({ entity, mesh_id, rotation });
+            }
+            return mesh_id;
+        }
     #pragma endregion Game
     }
 
@@ -1342,61 +6234,138 @@ namespace deep
     #pragma region Interface
     void init() { deepcore::init(); }
     void cleanup(){ deepcore::cleanup(); }
-    void update(){ deepcore::update_music(); deepcore::render(); }
+    void update()
+    {
+        deepcore::wait_for_counter(&deepcore::job_system.frame_counter);
+        deepcore::finish_asset_uploads();
+        deepcore::update_music();
+        deepcore::render();
+#if DEEP_PROFILE
+        deepcore::end_profile_frame();
+#endif
+    }
+    // fn(begin, end) over [0, count) split across the workers, returns when all chunks are done
+    template<typename F> void parallel_for(int count, int grain, F fn) { deepcore::parallel_for(count, grain, fn); }
+    // runs on a worker and is waited for before the frame renders
+    void run_frame_job(void (*function)(void* data, int begin, int end), void* data, int begin, int end) { deepcore::submit_job(function, data, begin, end, &deepcore::job_system.frame_counter); }
+    // runs on a worker across as many frames as it needs, check or wait before touching what it writes
+    void run_background_job(void (*function)(void* data, int begin, int end), void* data, int begin, int end) { deepcore::submit_background_job(function, data, begin, end, &deepcore::job_system.background_counter); }
+    bool is_background_work_done() { return SDL_GetAtomicInt(&deepcore::job_system.background_counter.pending) == 0; }
+    void wait_background_jobs() { deepcore::wait_for_counter(&deepcore::job_system.background_counter); }
     
     double get_delta_time() { return deepcore::get_delta_time(); }
+    // fixed step simulation, run begin_simulation_step and one update of get_simulation_step_time seconds per step
+    int begin_simulation_frame() { return deepcore::begin_simulation_frame(); }
+    float get_simulation_step_time() { return deepcore::get_simulation_step_time(); }
+    void begin_simulation_step() { deepcore::begin_simulation_step(); }
+    void set_time_scale(double time_scale) { deepcore::set_time_scale(time_scale); }
+
+    // record one input frame per simulation step, replays read them back in the same order
+    bool start_recording(const char* filename, Uint64 seed) { return deepcore::start_recording(filename, seed); }
+    void record_input(const Input_Frame& frame) { deepcore::record_input(frame); }
+    bool start_replay(const char* filename, Uint64* seed) { return deepcore::start_replay(filename, seed); }
+    bool read_replay_input(Input_Frame& frame) { return deepcore::read_replay_input(frame); }
+    bool is_replaying() { return deepcore::replay.replaying; }
+
+    // engine state first, then whatever the game writes with write_snapshot_value, read it back in the same order after restore_snapshot
+    void save_snapshot(Snapshot& snapshot) { deepcore::save_snapshot(snapshot); }
+    bool restore_snapshot(Snapshot& snapshot) { return deepcore::restore_snapshot(snapshot); }
+    template<typename T> void write_snapshot_value(Snapshot& snapshot, const T& value) { deepcore::snapshot_write_value(snapshot, value); }
+    template<typename T> bool read_snapshot_value(Snapshot& snapshot, T& value) { return deepcore::snapshot_read_value(snapshot, value); }
+    template<typename T> void write_snapshot_vector(Snapshot& snapshot, const std::vector<T>& values) { deepcore::snapshot_write_vector(snapshot, values); }
+    template<typename T> bool read_snapshot_vector(Snapshot& snapshot, std::vector<T>& values) { return deepcore::snapshot_read_vector(snapshot, values); }
+    bool save_snapshot_file(const char* filename, const Snapshot& snapshot) { return deepcore::save_snapshot_file(filename, snapshot); }
+    bool load_snapshot_file(const char* filename, Snapshot& snapshot) { return deepcore::load_snapshot_file(filename, snapshot); }
+    void stop_replay() { deepcore::stop_replay(); }
+
+    // the behavior starts right away and runs until its first co_await, it must not destroy its own entity
+    void start_behavior(Entity entity, Behavior behavior) { deepcore::start_behavior(entity, std::move(behavior)); }
+    // resumes timers, movers and player range waits, once per simulation step before steering
+    void update_behaviors(const Steering_Players& players, float delta_time) { deepcore::update_behaviors(players, delta_time); }
+    // where the behavior wants the entity to go, zero while it waits
+    glm::vec2 get_behavior_velocity(Entity entity) { return deepcore::get_behavior_velocity(entity); }
+    Behavior_Wait wait_seconds(float seconds) { return Behavior_Wait{ Behavior_Timer, seconds }; }
+    Behavior_Wait wait_until_player_in_range(float range) { return Behavior_Wait{ Behavior_Player_Range, range }; }
+    Behavior_Wait move_to_tile(glm::ivec2 tile) { return Behavior_Wait{ Behavior_Move, 0.0f, tile }; }
+    bool Behavior_Wait::await_suspend(std::coroutine_handle<Behavior::promise_type> handle) { return deepcore::suspend_behavior(handle.promise().entity, *this); }
     void mouse_lock(bool lock) { deepcore::mouse_lock(lock); }
 
     glm::vec2 get_camera_position_2d(int id) { return deepcore::camera_get_position_2d(id); }
+    glm::vec2 get_camera_direction_2d(int id) { return deepcore::camera_get_direction_2d(id); }
     void set_camera_position(int id, glm::vec3 position) { deepcore::camera_set_position(id, position); }
     void camera_process_keyboard(int id, bool forward, bool back, bool left, bool right, bool up, bool down, float delta_time) { deepcore::camera_process_keyboard(id, forward, back, left, right, up, down, delta_time); }
     void camera_process_mouse_movement(int id, float x_offset, float y_offset, bool constrain_pitch) { deepcore::camera_process_mouse_movement(id, x_offset, y_offset, constrain_pitch); }
 
     void clear_scene() { deepcore::clear_scene(); }
-    int create_entity() { return deepcore::create_entity(); }
+    Entity create_entity() { return deepcore::create_entity(); }
+    void destroy_entity(Entity entity) { deepcore::destroy_entity(entity); }
+    bool is_entity_alive(Entity entity) { return deepcore::is_entity_alive(entity); }
     int get_entity_count() { return deepcore::get_entity_count(); }
-    Entity* get_entity(int entity_id) { return deepcore::get_entity(entity_id); }
-    glm::vec2 get_entity_position_2d(Entity* entity) { glm::vec3 p = glm::vec3(entity->transform[3]); return glm::vec2(p.x, p.z); }
-    void set_entity_position_2d(deep::Entity* entity, glm::vec2 new_entity_position)
+    glm::vec2 get_entity_position_2d(Entity entity) { glm::vec3 p = deepcore::get_entity_position(entity); return glm::vec2(p.x, p.z); }
+    void set_entity_position_2d(Entity entity, glm::vec2 new_entity_position) { deepcore::set_entity_position_2d(entity, new_entity_position); }
+    void integrate_velocities(float delta_time) { deepcore::integrate_velocities(delta_time); }
+    // fn(Entity, Position_Component&), must not move, create or destroy entities
+    template<typename F> void for_each_entity_in_radius(glm::vec2 center, float radius, F fn) { deepcore::for_each_entity_in_radius(center, radius, fn); }
+    template<typename F> void for_each_entity_in_rect(glm::vec2 min, glm::vec2 max, F fn) { deepcore::for_each_entity_in_rect(min, max, fn); }
+    int query_entities_in_radius(glm::vec2 center, float radius, Entity* entities, int max_count)
     {
-        glm::vec3 current_position_3d = glm::vec3(entity->transform[3]);
-        glm::vec3 desired_target_position_3d = glm::vec3(new_entity_position.x, current_position_3d.y, new_entity_position.y);
-
-        glm::vec3 desired_position_change = desired_target_position_3d - current_position_3d;
-
-        glm::vec3 original_entity_position = current_position_3d;
-        glm::vec3 temp_entity_position = current_position_3d;
-
-        temp_entity_position.x = original_entity_position.x + desired_position_change.x;
-        if (!deepcore::is_position_blocked(current_position_3d, temp_entity_position, entity->collision_radius))
-        {
-            entity->transform[3].x = temp_entity_position.x;
-        }
-        else
-        {
-            temp_entity_position.x = original_entity_position.x;
-        }
-
-        temp_entity_position.z = original_entity_position.z + desired_position_change.z;
-        if (!deepcore::is_position_blocked(current_position_3d, glm::vec3(entity->transform[3].x, temp_entity_position.y, temp_entity_position.z), entity->collision_radius))
-        {
-            entity->transform[3].z = temp_entity_position.z;
-        }
-        else
-        {
-            temp_entity_position.z = original_entity_position.z;
-        }
+        int count = 0;
+        deepcore::for_each_entity_in_radius(center, radius, [&](Entity entity, Position_Component& position) { if(count < max_count) entities[count++] = entity; });
+        return count;
+    }
+    int query_entities_in_rect(glm::vec2 min, glm::vec2 max, Entity* entities, int max_count)
+    {
+        int count = 0;
+        deepcore::for_each_entity_in_rect(min, max, [&](Entity entity, Position_Component& position) { if(count < max_count) entities[count++] = entity; });
+        return count;
     }
-    void add_light(int entity_id, glm::vec3 position) { deepcore::add_light(entity_id, position); }
-    void add_mesh(int entity_id, const char *filename, glm::vec3 position, glm::vec3 rotation) { deepcore::add_mesh(entity_id, filename, position, rotation); }
+    void add_light(Entity entity, glm::vec3 position) { deepcore::add_light(entity, position); }
+    void add_mesh(Entity entity, const char *filename, glm::vec3 position, glm::vec3 rotation) { deepcore::add_mesh(entity, filename, position, rotation); }
+    int add_mesh_async(Entity entity, const char *filename, glm::vec3 position, glm::vec3 rotation) { return deepcore::add_mesh_async(entity, filename, position, rotation); }
+    void add_velocity(Entity entity, float speed) { deepcore::add_component(deepcore::entity_store.velocities, entity, Velocity_Component{ glm::vec2(0.0f, 0.0f), speed }); }
+    void add_collision(Entity entity, float radius) { deepcore::add_component(deepcore::entity_store.collisions, entity, Collision_Component{ radius }); }
+    void add_enemy(Entity entity, float sight) { deepcore::add_component(deepcore::entity_store.enemies, entity, Enemy_Component{ sight }); }
+    void add_exit(Entity entity) { deepcore::add_component(deepcore::entity_store.exits, entity, Exit_Component{}); }
+    Velocity_Component* get_velocity(Entity entity) { return deepcore::get_component(deepcore::entity_store.velocities, entity); }
+    Collision_Component* get_collision(Entity entity) { return deepcore::get_component(deepcore::entity_store.collisions, entity); }
+    Enemy_Component* get_enemy(Entity entity) { return deepcore::get_component(deepcore::entity_store.enemies, entity); }
+    bool is_exit(Entity entity) { return deepcore::get_component(deepcore::entity_store.exits, entity) != nullptr; }
+    int get_enemy_count() { return deepcore::entity_store.enemies.data.size(); }
+    // only enemies the ai scheduler picked this frame are in the batch, far enemies sleep until a player comes close or enters their room
+    const Steering_Batch& steer_enemies(const Steering_Players& players) { return deepcore::steer_enemies(players); }
+    // fn(Entity, Enemy_Component&, Position_Component&, Velocity_Component&, Collision_Component&), move entities through set_entity_position_2d so the spatial grid stays in sync
+    template<typename F> void for_each_enemy(F fn) { deepcore::query(fn, deepcore::entity_store.enemies, deepcore::entity_store.positions, deepcore::entity_store.velocities, deepcore::entity_store.collisions); }
+    // fn(Entity, Exit_Component&, Position_Component&, Collision_Component&)
+    template<typename F> void for_each_exit(F fn) { deepcore::query(fn, deepcore::entity_store.exits, deepcore::entity_store.positions, deepcore::entity_store.collisions); }
+    bool is_mesh_ready(int mesh_id) { return deepcore::is_mesh_ready(mesh_id); }
     
     void load_music(const char *filename) { deepcore::load_music(filename); }
     int load_sound(const char *filename) { return deepcore::load_sound(filename); }
     void play_sound(int id) { deepcore::play_sound(id); }
+    // gain is linear, pan goes from -1 (left) to 1 (right), the oldest voice is stolen once all are playing
+    void play_sound(int id, float gain, float pan) { deepcore::play_sound(id, gain, pan); }
 
-    void init_map() { return deepcore::init_map(); }
+    void init_map(int size_x, int size_y) { return deepcore::init_map(size_x, size_y); }
     void add_mesh_to_map(int index, const char *filename, int rect) { return deepcore::add_mesh_to_map(index, filename, rect); }
     glm::vec3 map_position(int x, int y) { return deepcore::map_position(x, y); }
+    void update_flow_field(int player_id, glm::vec2 player_position) { deepcore::update_flow_field(player_id, player_position); }
+    glm::vec2 sample_flow_field(int player_id, glm::vec2 position) { return deepcore::sample_flow_field(player_id, position); }
+    // tile to tile visibility through doors and open floor, rebuilt by steer_enemies after map changes
+    bool has_line_of_sight(glm::vec2 from, glm::vec2 to) { return deepcore::has_line_of_sight(from, to); }
+    Ray_Hit cast_ray(const Ray& ray) { return deepcore::cast_ray(ray); }
+    void cast_rays(const Ray* rays, Ray_Hit* hits, int count) { deepcore::cast_rays(rays, hits, count); }
     void set_map(int x, int y, int tile) { return deepcore::set_map(x, y, tile); }
+    void set_room(int x, int y, int room) { return deepcore::set_room(x, y, room); }
+    // tile maps for bake_level_map, set_tile and set_tile_room return false outside of the map
+    void init_tile_map(Tile_Map& tiles, int size_x, int size_y) { deepcore::init_tile_map(tiles, size_x, size_y); }
+    bool set_tile(Tile_Map& tiles, int x, int y, int tile) { return deepcore::set_tile(tiles, x, y, tile); }
+    bool set_tile_room(Tile_Map& tiles, int x, int y, int room) { return deepcore::set_tile_room(tiles, x, y, room); }
+    int get_tile(const Tile_Map& tiles, int x, int y) { return deepcore::get_tile(tiles, x, y); }
+    // bake one level at a time, apply_level_map replaces the whole map and its size with the last bake
+    void bake_level_map(const Tile_Map& level) { deepcore::bake_level_map(level); }
+    void apply_level_map() { deepcore::apply_level_map(); }
+    // map chunks stream in around the cameras, the least recently wanted are released once their gpu memory passes the budget
+    void set_chunk_budget(Uint64 bytes) { deepcore::chunk_streamer.budget = bytes; }
+    Uint64 get_chunk_resident_bytes() { return deepcore::chunk_streamer.resident_bytes; }
     #pragma endregion Interface
-}
\ No newline at end of file
+}
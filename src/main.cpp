@@ -4,14 +4,72 @@
 #include "engine.h"
 
 const float PLAYER_ATTACK_DISTANCE = 4.0f;
+const float PLAYER_ATTACK_RADIUS = 0.5f;
+const float ENEMY_SIGHT = 14.0f;
+const float ENEMY_RADIUS = 0.5f;
+const float ENEMY_PATROL_RANGE = 24.0f;
+const float EXIT_RADIUS = 0.5f;
 
 static SDL_Joystick* joystick = nullptr;
 SDL_JoystickID joystick_id = 0;
 
-std::mt19937 rng(std::random_device{}());
-int randi_range(int min, int max) {
-    std::uniform_int_distribution<int> dist(min, max);
-    return dist(rng);
+// movement bits are shifted by INPUT_PLAYER_SHIFT per player
+enum Input_Buttons
+{
+    Input_Forward = 1 << 0,
+    Input_Back = 1 << 1,
+    Input_Left = 1 << 2,
+    Input_Right = 1 << 3,
+    Input_Attack = 1 << 8, // shifted by the player id
+    Input_Restart = 1 << 10,
+    Input_Retry = 1 << 11
+};
+const int INPUT_PLAYER_SHIFT = 4;
+
+// events between two simulation steps, the next step consumes them
+deep::Input_Frame pending_input{};
+
+struct Step_Stats
+{
+    Uint64 count = 0;
+    Uint64 total_ticks = 0;
+    Uint64 slowest_ticks = 0;
+    Uint64 slowest_step = 0;
+};
+Step_Stats step_stats{};
+const int HEADLESS_STEPS_PER_ITERATE = 600;
+
+// counter based stream, value n is a pure function of key and n, so any number of streams can run side by side
+struct Procgen_Random
+{
+    Uint64 key = 0;
+    Uint64 counter = 0;
+};
+
+// splitmix64 finalizer
+Uint64 procgen_mix(Uint64 value)
+{
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+Uint64 procgen_next(Procgen_Random& random)
+{
+    random.counter += 1;
+    return procgen_mix(random.key + random.counter * 0x9E3779B97F4A7C15ULL);
+}
+
+// draws the seed of every level, snapshots keep it so a retry generates what follows the same way
+Procgen_Random level_random{};
+
+// multiply and shift instead of a distribution per call, the bias is far below anything procgen can notice
+int randi_range(Procgen_Random& random, int min, int max) {
+    Uint32 range = static_cast<Uint32>(max - min + 1);
+    return min + static_cast<int>(((procgen_next(random) >> 32) * range) >> 32);
 }
 
 struct Room {
@@ -77,69 +135,59 @@ struct Procedural_Map {
     }
 };
 
-void add_doors(glm::ivec2 pos, glm::bvec4 doors)
+const int PROCGEN_MAX_CELLS = Procedural_Map::SIZE_X * Procedural_Map::SIZE_Y;
+const int PROCGEN_MAIN_PATH_LENGTH = 13;
+const int PROCGEN_STEP_BUDGET = 4096; // direction tries for a whole level, past it the fallback layout is used
+
+// rooms a branch may grow from, every path cell except the last one
+struct Procgen_Candidates
+{
+    glm::ivec2 cells[PROCGEN_MAX_CELLS];
+    int count = 0;
+};
+
+struct Procgen_Step
+{
+    glm::ivec2 cell;
+    glm::ivec2 directions[4];
+    int next_direction;
+};
+
+// set_tile skips anything outside of the map
+void add_doors(deep::Tile_Map& level, glm::ivec2 pos, glm::bvec4 doors)
 {
     if(doors.x) // top
     {
-        int map_x = pos.x + 2;
-        int map_y = pos.y;
-        if (map_x >= 0 && map_x < deep::MAP_SIZE_X &&
-            map_y >= 0 && map_y < deep::MAP_SIZE_Y) 
-        {
-            deep::set_map(map_x, map_y, 10);
-        }
+        deep::set_tile(level, pos.x + 2, pos.y, 10);
     }
     if(doors.y) // right
     {
-        int map_x = pos.x + Room::SIZE_X - 1;
-        int map_y = pos.y + 1;
-        if (map_x >= 0 && map_x < deep::MAP_SIZE_X &&
-            map_y >= 0 && map_y < deep::MAP_SIZE_Y) 
-        {
-            deep::set_map(map_x, map_y, 12);
-        }
+        deep::set_tile(level, pos.x + Room::SIZE_X - 1, pos.y + 1, 12);
     }
     if(doors.z) // bottom
     {
-        int map_x = pos.x + 2;
-        int map_y = pos.y + Room::SIZE_Y - 1;
-        if (map_x >= 0 && map_x < deep::MAP_SIZE_X &&
-            map_y >= 0 && map_y < deep::MAP_SIZE_Y) 
-        {
-            deep::set_map(map_x, map_y, 13);
-        }
+        deep::set_tile(level, pos.x + 2, pos.y + Room::SIZE_Y - 1, 13);
     }
     if(doors.w) // left
     {
-        int map_x = pos.x;
-        int map_y = pos.y + 1;
-        if (map_x >= 0 && map_x < deep::MAP_SIZE_X &&
-            map_y >= 0 && map_y < deep::MAP_SIZE_Y) 
-        {
-            deep::set_map(map_x, map_y, 11);
-        }
+        deep::set_tile(level, pos.x, pos.y + 1, 11);
     }
 }
 
-void add_room(Room& room, glm::ivec2 pos, glm::bvec4 doors)
+void add_room(deep::Tile_Map& level, const Room& room, glm::ivec2 pos, glm::bvec4 doors, int room_id)
 {
     for (int y = 0; y < Room::SIZE_Y; ++y) 
     {
         for (int x = 0; x < Room::SIZE_X; ++x) 
         {
-            int map_x = pos.x + x;
-            int map_y = pos.y + y;
-
-            if (map_x >= 0 && map_x < deep::MAP_SIZE_X &&
-                map_y >= 0 && map_y < deep::MAP_SIZE_Y) {
-                deep::set_map(map_x, map_y, room.data[y][x]);
-            }
+            deep::set_tile(level, pos.x + x, pos.y + y, room.data[y][x]);
+            deep::set_tile_room(level, pos.x + x, pos.y + y, room_id);
         }
     }
-    add_doors(pos, doors);
+    add_doors(level, pos, doors);
 }
 
-void add_rooms(Procedural_Map generative_map, Room& room)
+void add_rooms(deep::Tile_Map& level, const Procedural_Map& generative_map, const Room& room)
 {
     for (int y = 0; y < Procedural_Map::SIZE_Y; ++y) 
     {
@@ -148,16 +196,16 @@ void add_rooms(Procedural_Map generative_map, Room& room)
             int current = generative_map.data[y][x];
             if(current > 0)
             {                
-                add_room(room, glm::ivec2(x*Room::SIZE_X, y*Room::SIZE_Y), generative_map.doors[y][x]);
+                add_room(level, room, glm::ivec2(x*Room::SIZE_X, y*Room::SIZE_Y), generative_map.doors[y][x], y*Procedural_Map::SIZE_X + x + 1);
             }
         }
     }
 }
 
-void procgen_place_entrance(Procedural_Map& map, glm::ivec2& start_position)
+void procgen_place_entrance(Procedural_Map& map, glm::ivec2& start_position, Procgen_Random& random)
 {
-    start_position.x = randi_range(0, Procedural_Map::SIZE_X-1);
-    start_position.y = randi_range(0, Procedural_Map::SIZE_Y-1);
+    start_position.x = randi_range(random, 0, Procedural_Map::SIZE_X-1);
+    start_position.y = randi_range(random, 0, Procedural_Map::SIZE_Y-1);
     map.data[start_position.y][start_position.x] = 1;
     map.recalculate_doors[start_position.y][start_position.x] = true;
 }
@@ -227,76 +275,152 @@ void procgen_calculate_doors(Procedural_Map& map)
     }
 }
 
-bool procgen_generate_path(Procedural_Map& map, glm::ivec2 from, int length, const int marker, std::vector<glm::ivec2>& branch_candidates) {
-        if (length == 0) {
+void procgen_shuffle_directions(glm::ivec2 (&directions)[4], Procgen_Random& random)
+{
+    directions[0] = glm::ivec2(0, 1);  // UP
+    directions[1] = glm::ivec2(1, 0);  // RIGHT
+    directions[2] = glm::ivec2(0, -1); // DOWN
+    directions[3] = glm::ivec2(-1, 0); // LEFT
+    for (int i = 3; i > 0; --i)
+    {
+        int j = randi_range(random, 0, i);
+        glm::ivec2 swap = directions[i];
+        directions[i] = directions[j];
+        directions[j] = swap;
+    }
+}
+
+bool procgen_is_free(const Procedural_Map& map, glm::ivec2 cell)
+{
+    return cell.x >= 0 && cell.x < Procedural_Map::SIZE_X &&
+        cell.y >= 0 && cell.y < Procedural_Map::SIZE_Y &&
+        map.data[cell.y][cell.x] == 0;
+}
+
+// flood fill over free cells, stops as soon as enough were found to fit the rest of the path
+bool procgen_has_room_for(const Procedural_Map& map, glm::ivec2 from, int needed)
+{
+    bool visited[Procedural_Map::SIZE_Y][Procedural_Map::SIZE_X] = {};
+    glm::ivec2 queue[PROCGEN_MAX_CELLS];
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = from;
+    visited[from.y][from.x] = true;
+    const glm::ivec2 DIRECTIONS[4] = { glm::ivec2(0, 1), glm::ivec2(1, 0), glm::ivec2(0, -1), glm::ivec2(-1, 0) };
+    while (head < tail && tail < needed)
+    {
+        glm::ivec2 cell = queue[head++];
+        for (int i = 0; i < 4; ++i)
+        {
+            glm::ivec2 next = cell + DIRECTIONS[i];
+            if (procgen_is_free(map, next) && !visited[next.y][next.x])
+            {
+                visited[next.y][next.x] = true;
+                queue[tail++] = next;
+            }
+        }
+    }
+    return tail >= needed;
+}
+
+// depth first search for a self avoiding path of length rooms numbered from marker, iterative with a fixed stack,
+// every direction tried costs one step of the budget and the path is rolled back once the budget runs out
+bool procgen_generate_path(Procedural_Map& map, glm::ivec2 from, int length, const int marker, Procgen_Candidates& branch_candidates, int& step_budget, Procgen_Random& random)
+{
+    Procgen_Step stack[PROCGEN_MAX_CELLS + 1];
+    int depth = 0;
+    stack[0].cell = from;
+    stack[0].next_direction = 0;
+    procgen_shuffle_directions(stack[0].directions, random);
+    map.recalculate_doors[from.y][from.x] = true;
+
+    while (depth >= 0)
+    {
+        if (depth == length)
+        {
             procgen_calculate_doors(map);
             return true;
         }
 
-        map.recalculate_doors[from.y][from.x] = true;
-        glm::ivec2 current = from;
-        glm::ivec2 direction;
+        Procgen_Step& top = stack[depth];
+        if (top.next_direction == 4 || step_budget <= 0)
+        {
+            // backtrack, cells are pushed as candidates in path order so the newest one is always last
+            if (depth > 0)
+            {
+                map.data[top.cell.y][top.cell.x] = 0;
+                map.recalculate_doors[top.cell.y][top.cell.x] = false;
+                branch_candidates.count -= 1;
+            }
+            depth -= 1;
+            continue;
+        }
 
-        // Representing directions: UP, RIGHT, DOWN, LEFT
-        std::vector<glm::ivec2> directions = {
-            glm::ivec2(0, 1),  // UP
-            glm::ivec2(1, 0),  // RIGHT
-            glm::ivec2(0, -1), // DOWN
-            glm::ivec2(-1, 0)  // LEFT
-        };
+        glm::ivec2 next = top.cell + top.directions[top.next_direction];
+        top.next_direction += 1;
+        step_budget -= 1;
 
-        // Shuffle directions to randomize path generation
-        std::shuffle(directions.begin(), directions.end(), rng);
+        // skip cells that lead into a pocket too small for the rest of the path
+        if (!procgen_is_free(map, next) || !procgen_has_room_for(map, next, length - depth))
+        {
+            continue;
+        }
 
-        for (int i = 0; i < 4; ++i) {
-            direction = directions[i];
-            glm::ivec2 next_pos = current + direction;
+        map.data[next.y][next.x] = marker + depth;
+        map.recalculate_doors[next.y][next.x] = true;
+        if (length - depth > 1)
+        {
+            branch_candidates.cells[branch_candidates.count++] = next;
+        }
 
-            if (next_pos.x >= 0 && next_pos.x < Procedural_Map::SIZE_X &&
-                next_pos.y >= 0 && next_pos.y < Procedural_Map::SIZE_Y &&
-                map.data[next_pos.y][next_pos.x] == 0) { // Check if unoccupied
-                
-                current = next_pos;
-                map.data[current.y][current.x] = marker;
-                map.recalculate_doors[current.y][current.x] = true;
+        depth += 1;
+        stack[depth].cell = next;
+        stack[depth].next_direction = 0;
+        procgen_shuffle_directions(stack[depth].directions, random);
+    }
 
-                if (length > 1) {
-                    branch_candidates.push_back(current);
-                }
+    map.recalculate_doors[from.y][from.x] = false;
+    return false;
+}
 
-                if (procgen_generate_path(map, current, length - 1, marker+1, branch_candidates)) {
-                    return true;
-                } else {
-                    // Backtrack: Remove from candidates and clear dungeon cell
-                    auto it = std::find(branch_candidates.begin(), branch_candidates.end(), current);
-                    if (it != branch_candidates.end()) {
-                        branch_candidates.erase(it);
-                    }
-                    map.data[current.y][current.x] = 0; // Set back to unoccupied
-                    map.recalculate_doors[current.y][current.x] = false;
-                    current = from; // Revert current to 'from' for the next iteration of the loop
-                }
-            }
+// the same snake through the grid every time, used when the search runs out of budget
+void procgen_generate_fallback(Procedural_Map& map, glm::ivec2& start_position, Procgen_Candidates& branch_candidates)
+{
+    map = Procedural_Map();
+    branch_candidates.count = 0;
+    int length = SDL_min(PROCGEN_MAIN_PATH_LENGTH, PROCGEN_MAX_CELLS - 1);
+    for (int i = 0; i <= length; ++i)
+    {
+        int y = i / Procedural_Map::SIZE_X;
+        int x = (y % 2 == 0) ? i % Procedural_Map::SIZE_X : Procedural_Map::SIZE_X - 1 - i % Procedural_Map::SIZE_X;
+        map.data[y][x] = i + 1;
+        map.recalculate_doors[y][x] = true;
+        if (i > 0 && i < length)
+        {
+            branch_candidates.cells[branch_candidates.count++] = glm::ivec2(x, y);
+        }
+        if (i == 0)
+        {
+            start_position = glm::ivec2(x, y);
         }
-        return false;
     }
+    procgen_calculate_doors(map);
+}
 
-void procgen_generate_branches(Procedural_Map& map, std::vector<glm::ivec2>& branch_candidates) 
+void procgen_generate_branches(Procedural_Map& map, Procgen_Candidates& branch_candidates, int& step_budget, Procgen_Random& random) 
 {
     int branches_created = 0;
     glm::ivec2 candidate;
-    while (branches_created < 3 && !branch_candidates.empty()) {
-        int random_index = randi_range(0, branch_candidates.size() - 1);
-        candidate = branch_candidates[random_index];
+    while (branches_created < 3 && branch_candidates.count > 0 && step_budget > 0) {
+        int random_index = randi_range(random, 0, branch_candidates.count - 1);
+        candidate = branch_candidates.cells[random_index];
 
-        if (procgen_generate_path(map, candidate, randi_range(1, 4), map.data[candidate.y][candidate.x]+1, branch_candidates)) {
+        if (procgen_generate_path(map, candidate, randi_range(random, 1, 4), map.data[candidate.y][candidate.x]+1, branch_candidates, step_budget, random)) {
             branches_created++;
         } else {
-            // Remove the candidate if it didn't lead to a successful branch
-            auto it = std::find(branch_candidates.begin(), branch_candidates.end(), candidate);
-            if (it != branch_candidates.end()) {
-                branch_candidates.erase(it);
-            }
+            // Remove the candidate if it didn't lead to a successful branch, order does not matter so the last one takes its place
+            branch_candidates.count -= 1;
+            branch_candidates.cells[random_index] = branch_candidates.cells[branch_candidates.count];
         }
     }
 }
@@ -319,11 +443,240 @@ void procgen_find_exit(Procedural_Map& map, glm::ivec2& exit_position)
     }
 }
 
-glm::vec3 position_inside_room(glm::ivec2& room_position, int x, int y)
+const int PROCGEN_BATCH_SIZE = 64;
+
+struct Procgen_Layout
+{
+    Uint64 seed;
+    Procedural_Map map;
+    glm::ivec2 start_position;
+    glm::ivec2 goal_position;
+    Procgen_Candidates branch_candidates;
+    float score;
+};
+
+Procgen_Layout procgen_layouts[PROCGEN_BATCH_SIZE];
+
+int procgen_cell_distance(glm::ivec2 a, glm::ivec2 b)
+{
+    return SDL_abs(a.x - b.x) + SDL_abs(a.y - b.y);
+}
+
+// rooms along the doors from the entrance to the exit
+int procgen_exit_distance(const Procgen_Layout& layout)
+{
+    int distance[Procedural_Map::SIZE_Y][Procedural_Map::SIZE_X];
+    for (int y = 0; y < Procedural_Map::SIZE_Y; ++y)
+    {
+        for (int x = 0; x < Procedural_Map::SIZE_X; ++x)
+        {
+            distance[y][x] = -1;
+        }
+    }
+    glm::ivec2 queue[PROCGEN_MAX_CELLS];
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = layout.start_position;
+    distance[layout.start_position.y][layout.start_position.x] = 0;
+    // door order is top, right, bottom, left
+    const glm::ivec2 DOOR_DIRECTIONS[4] = { glm::ivec2(0, -1), glm::ivec2(1, 0), glm::ivec2(0, 1), glm::ivec2(-1, 0) };
+    while (head < tail)
+    {
+        glm::ivec2 cell = queue[head++];
+        glm::bvec4 doors = layout.map.doors[cell.y][cell.x];
+        for (int i = 0; i < 4; ++i)
+        {
+            glm::ivec2 next = cell + DOOR_DIRECTIONS[i];
+            if (doors[i] && next.x >= 0 && next.x < Procedural_Map::SIZE_X && next.y >= 0 && next.y < Procedural_Map::SIZE_Y && distance[next.y][next.x] == -1)
+            {
+                distance[next.y][next.x] = distance[cell.y][cell.x] + 1;
+                queue[tail++] = next;
+            }
+        }
+    }
+    return distance[layout.goal_position.y][layout.goal_position.x];
+}
+
+// longer walks to a far exit, more side rooms and enemies spread out and away from the entrance score higher
+float procgen_score_layout(const Procgen_Layout& layout)
+{
+    int room_count = 0;
+    for (int y = 0; y < Procedural_Map::SIZE_Y; ++y)
+    {
+        for (int x = 0; x < Procedural_Map::SIZE_X; ++x)
+        {
+            room_count += layout.map.data[y][x] > 0 ? 1 : 0;
+        }
+    }
+    int exit_distance = procgen_exit_distance(layout);
+    if (exit_distance < 0 || layout.branch_candidates.count < 5)
+    {
+        return 0.0f;
+    }
+
+    // the same rooms load_scene puts the enemies in
+    int parts = layout.branch_candidates.count / 5;
+    int spread = PROCGEN_MAX_CELLS;
+    for (int part = 1; part <= 4; part++)
+    {
+        glm::ivec2 room = layout.branch_candidates.cells[parts*part-1];
+        spread = SDL_min(spread, procgen_cell_distance(room, layout.start_position));
+        for (int other = part + 1; other <= 4; other++)
+        {
+            spread = SDL_min(spread, procgen_cell_distance(room, layout.branch_candidates.cells[parts*other-1]));
+        }
+    }
+
+    int branch_rooms = room_count - (PROCGEN_MAIN_PATH_LENGTH + 1);
+    return exit_distance + 2.0f * procgen_cell_distance(layout.start_position, layout.goal_position) + branch_rooms + 3.0f * spread;
+}
+
+void procgen_generate_layout(Procgen_Layout& layout, Uint64 seed)
+{
+    Procgen_Random random = { seed, 0 };
+    layout.seed = seed;
+    layout.map = Procedural_Map();
+    layout.branch_candidates.count = 0;
+    procgen_place_entrance(layout.map, layout.start_position, random);
+
+    int step_budget = PROCGEN_STEP_BUDGET;
+    if (!procgen_generate_path(layout.map, layout.start_position, PROCGEN_MAIN_PATH_LENGTH, 2, layout.branch_candidates, step_budget, random))
+    {
+        procgen_generate_fallback(layout.map, layout.start_position, layout.branch_candidates);
+    }
+    procgen_find_exit(layout.map, layout.goal_position);
+    procgen_generate_branches(layout.map, layout.branch_candidates, step_budget, random);
+    layout.score = procgen_score_layout(layout);
+}
+
+// every candidate has its own stream, so the pick only depends on batch_seed and not on how the jobs were split
+const Procgen_Layout& procgen_generate_best_layout(Uint64 batch_seed)
+{
+    DEEP_PROFILE_SCOPE("procgen_generate_best_layout");
+    deep::parallel_for(PROCGEN_BATCH_SIZE, 4, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            procgen_generate_layout(procgen_layouts[i], procgen_mix(batch_seed + i * 0x9E3779B97F4A7C15ULL));
+        }
+    });
+    int best = 0;
+    for (int i = 1; i < PROCGEN_BATCH_SIZE; i++)
+    {
+        if (procgen_layouts[i].score > procgen_layouts[best].score)
+        {
+            best = i;
+        }
+    }
+    return procgen_layouts[best];
+}
+
+void benchmark_procgen(double seconds)
+{
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 end = start + static_cast<Uint64>(seconds * frequency);
+    Procgen_Random random = { 0x5EED, 0 };
+    int batch_count = 0;
+    float score = 0.0f;
+    while (SDL_GetPerformanceCounter() < end)
+    {
+        score += procgen_generate_best_layout(procgen_next(random)).score;
+        batch_count += 1;
+    }
+    double elapsed = static_cast<double>(SDL_GetPerformanceCounter() - start) / frequency;
+    SDL_Log("Generated %d layouts in %.2f s, %.0f layouts per second, average best score %.1f",
+        batch_count * PROCGEN_BATCH_SIZE, elapsed, batch_count * PROCGEN_BATCH_SIZE / elapsed, batch_count ? score / batch_count : 0.0f);
+}
+
+glm::vec3 position_inside_room(const glm::ivec2& room_position, int x, int y)
 {
     return glm::vec3((room_position.x*Room::SIZE_X*3)+x*3.0f+1.5f, 0.0f, (room_position.y*Room::SIZE_Y*3)+y*3.0f+1.5f);
 }
 
+glm::ivec2 tile_inside_room(const glm::ivec2& room_position, int x, int y)
+{
+    return glm::ivec2(room_position.x*Room::SIZE_X+x, room_position.y*Room::SIZE_Y+y);
+}
+
+const int LEVEL_ENEMY_COUNT = 4;
+
+// everything about a level that doesn't touch the entity store, built on a worker while the previous level is played
+struct Level_Plan
+{
+    Uint64 seed;
+    Uint64 layout_seed;
+    float score;
+    deep::Tile_Map map;
+    glm::vec3 spawn_position;
+    glm::vec3 exit_position;
+    int enemy_count;
+    glm::vec3 light_positions[LEVEL_ENEMY_COUNT];
+    glm::vec3 enemy_positions[LEVEL_ENEMY_COUNT];
+    glm::ivec2 patrol_from[LEVEL_ENEMY_COUNT];
+    glm::ivec2 patrol_to[LEVEL_ENEMY_COUNT];
+};
+
+Level_Plan next_level_plan;
+bool is_next_level_planned = false;
+
+void plan_level(Level_Plan& plan, Uint64 seed)
+{
+    DEEP_PROFILE_SCOPE("plan_level");
+    const Procgen_Layout& layout = procgen_generate_best_layout(seed);
+    const Procgen_Candidates& branch_candidates = layout.branch_candidates;
+    plan.seed = seed;
+    plan.layout_seed = layout.seed;
+    plan.score = layout.score;
+    deep::init_tile_map(plan.map, Procedural_Map::SIZE_X*Room::SIZE_X, Procedural_Map::SIZE_Y*Room::SIZE_Y);
+    add_rooms(plan.map, layout.map, Room());
+    plan.spawn_position = position_inside_room(layout.start_position, 1, 1);
+    plan.exit_position = position_inside_room(layout.goal_position, 2, 1);
+
+    plan.enemy_count = 0;
+    if (branch_candidates.count >= 5)
+    {
+        int parts = branch_candidates.count / 5;
+        for(int part = 1; part <= LEVEL_ENEMY_COUNT; part++)
+        {
+            glm::ivec2 room_position = branch_candidates.cells[parts*part-1];
+            plan.light_positions[plan.enemy_count] = position_inside_room(room_position, 1, 1)+glm::vec3(0.0f, 2.5f, 0.0f);
+            plan.enemy_positions[plan.enemy_count] = position_inside_room(room_position, 1, 1)+glm::vec3(0.0f, 0.5f, 0.0f);
+            plan.patrol_from[plan.enemy_count] = tile_inside_room(room_position, 1, 1);
+            plan.patrol_to[plan.enemy_count] = tile_inside_room(room_position, 3, 1);
+            plan.enemy_count += 1;
+        }
+    }
+    deep::bake_level_map(plan.map);
+}
+
+void plan_level_job(void* data, int begin, int end)
+{
+    plan_level(next_level_plan, *static_cast<Uint64*>(data));
+}
+
+// the seed is drawn here and not in the job so the order of draws never depends on timing
+void start_planning_next_level()
+{
+    static Uint64 seed;
+    seed = procgen_next(level_random);
+    is_next_level_planned = true;
+    deep::run_background_job(plan_level_job, &seed, 0, 1);
+}
+
+// idle until a player comes close, then pace between two tiles, chasing in update() takes over once the enemy sees someone
+deep::Behavior enemy_patrol(glm::ivec2 from, glm::ivec2 to)
+{
+    co_await deep::wait_until_player_in_range(ENEMY_PATROL_RANGE);
+    while(true)
+    {
+        co_await deep::move_to_tile(to);
+        co_await deep::wait_seconds(1.5f);
+        co_await deep::move_to_tile(from);
+        co_await deep::wait_seconds(1.5f);
+    }
+}
+
 enum UI_State 
 {
     Running,
@@ -340,6 +693,7 @@ enum Audio
 };
 
 struct Player {
+    deep::Entity entity;
     bool is_player_attacking = false;
 };
 Player players[2];
@@ -348,144 +702,218 @@ int player_count = 1;
 int enemies_left = 0;
 UI_State ui_state = UI_State::Running;
 
-void load_scene()
+// behaviors can't be snapshotted, the routes are kept so retries can start them again
+struct Enemy_Patrol
 {
-    Room room = {};
-    Procedural_Map map = {};
-    
-    glm::ivec2 start_position;
-    procgen_place_entrance(map, start_position);
+    deep::Entity entity;
+    glm::ivec2 from;
+    glm::ivec2 to;
+};
+std::vector<Enemy_Patrol> enemy_patrols;
 
-    std::vector<glm::ivec2> branch_candidates;    
-    procgen_generate_path(map, start_position, 13, 2, branch_candidates);
-    glm::ivec2 goal_position;
-    procgen_find_exit(map, goal_position);
-    procgen_generate_branches(map, branch_candidates);
+// taken once the level is built, retrying restores it instead of generating and loading again
+deep::Snapshot level_start_snapshot;
 
-    add_rooms(map, room);
+void save_game_snapshot(deep::Snapshot& snapshot)
+{
+    deep::save_snapshot(snapshot);
+    deep::write_snapshot_value(snapshot, ui_state);
+    deep::write_snapshot_value(snapshot, level_random);
+    deep::write_snapshot_value(snapshot, players);
+    deep::write_snapshot_value(snapshot, enemies_left);
+    deep::write_snapshot_vector(snapshot, enemy_patrols);
+}
 
-    glm::vec3 spawn_position = position_inside_room(start_position, 1, 1);
-    deep::set_camera_position(0, spawn_position+glm::vec3(0.0f, 1.8f, 0.0f));
-    deep::add_mesh(deep::create_entity(), "ressources/models/player.glb", spawn_position, glm::vec3(0.0f, 0.0f, 0.0f));
-    if(player_count > 1)
+bool restore_game_snapshot(deep::Snapshot& snapshot)
+{
+    if(!deep::restore_snapshot(snapshot)
+        || !deep::read_snapshot_value(snapshot, ui_state)
+        || !deep::read_snapshot_value(snapshot, level_random)
+        || !deep::read_snapshot_value(snapshot, players)
+        || !deep::read_snapshot_value(snapshot, enemies_left)
+        || !deep::read_snapshot_vector(snapshot, enemy_patrols))
     {
-        deep::set_camera_position(1, position_inside_room(start_position, 1, 1)+glm::vec3(0.0f, 1.8f, 0.0f));
-        deep::add_mesh(deep::create_entity(), "ressources/models/player.glb", spawn_position, glm::vec3(0.0f, 0.0f, 0.0f));
+        return false;
     }
+    for(const Enemy_Patrol& patrol : enemy_patrols)
+    {
+        deep::start_behavior(patrol.entity, enemy_patrol(patrol.from, patrol.to));
+    }
+    return true;
+}
 
-    int exit_id = deep::create_entity();
-    deep::add_mesh(exit_id, "ressources/models/center.glb", position_inside_room(goal_position, 2, 1), glm::vec3(0.0f, 0.0f, 0.0f));
-    deep::get_entity(exit_id)->exit_component = true;
+void load_scene()
+{
+    enemy_patrols.clear();
 
-    if (!branch_candidates.empty())
+    // only the first level is planned here, every later one was built while the previous was played
+    if(!is_next_level_planned)
     {
-        int parts = branch_candidates.size() / 5;
+        start_planning_next_level();
+    }
+    deep::wait_background_jobs();
+    const Level_Plan& plan = next_level_plan;
+    SDL_Log("Level layout seed %016llx, score %.1f", static_cast<unsigned long long>(plan.layout_seed), plan.score);
+    deep::apply_level_map();
+
+    deep::set_camera_position(0, plan.spawn_position+glm::vec3(0.0f, 1.8f, 0.0f));
+    players[0].entity = deep::create_entity();
+    deep::add_mesh_async(players[0].entity, "ressources/models/player.glb", plan.spawn_position, glm::vec3(0.0f, 0.0f, 0.0f));
+    deep::add_collision(players[0].entity, 0.5f);
+    if(player_count > 1)
+    {
+        deep::set_camera_position(1, plan.spawn_position+glm::vec3(0.0f, 1.8f, 0.0f));
+        players[1].entity = deep::create_entity();
+        deep::add_mesh_async(players[1].entity, "ressources/models/player.glb", plan.spawn_position, glm::vec3(0.0f, 0.0f, 0.0f));
+        deep::add_collision(players[1].entity, 0.5f);
+    }
 
-        deep::add_light(deep::create_entity(), position_inside_room(branch_candidates[parts*1-1], 1, 1)+glm::vec3(0.0f, 2.5f, 0.0f));
-        deep::add_light(deep::create_entity(), position_inside_room(branch_candidates[parts*2-1], 1, 1)+glm::vec3(0.0f, 2.5f, 0.0f));
-        deep::add_light(deep::create_entity(), position_inside_room(branch_candidates[parts*3-1], 1, 1)+glm::vec3(0.0f, 2.5f, 0.0f));
-        deep::add_light(deep::create_entity(), position_inside_room(branch_candidates[parts*4-1], 1, 1)+glm::vec3(0.0f, 2.5f, 0.0f));
+    deep::Entity exit = deep::create_entity();
+    deep::add_mesh_async(exit, "ressources/models/center.glb", plan.exit_position, glm::vec3(0.0f, 0.0f, 0.0f));
+    deep::add_collision(exit, EXIT_RADIUS);
+    deep::add_exit(exit);
 
-        int enemy_id = deep::create_entity();
-        deep::add_mesh(enemy_id, "ressources/models/cube.glb", position_inside_room(branch_candidates[parts*1-1], 1, 1)+glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        deep::get_entity(enemy_id)->hurt_component = true;
-        enemy_id = deep::create_entity();
-        deep::add_mesh(enemy_id, "ressources/models/cube.glb", position_inside_room(branch_candidates[parts*2-1], 1, 1)+glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        deep::get_entity(enemy_id)->hurt_component = true;
-        enemy_id = deep::create_entity();
-        deep::add_mesh(enemy_id, "ressources/models/cube.glb", position_inside_room(branch_candidates[parts*3-1], 1, 1)+glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        deep::get_entity(enemy_id)->hurt_component = true;
-        enemy_id = deep::create_entity();
-        deep::add_mesh(enemy_id, "ressources/models/cube.glb", position_inside_room(branch_candidates[parts*4-1], 1, 1)+glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-        deep::get_entity(enemy_id)->hurt_component = true;
-    }    
+    for(int i = 0; i < plan.enemy_count; i++)
+    {
+        deep::add_light(deep::create_entity(), plan.light_positions[i]);
+    }
+    for(int i = 0; i < plan.enemy_count; i++)
+    {
+        deep::Entity enemy = deep::create_entity();
+        deep::add_mesh_async(enemy, "ressources/models/cube.glb", plan.enemy_positions[i], glm::vec3(0.0f, 0.0f, 0.0f));
+        deep::add_collision(enemy, ENEMY_RADIUS);
+        deep::add_velocity(enemy, 3.0f);
+        deep::add_enemy(enemy, ENEMY_SIGHT);
+        Enemy_Patrol patrol = { enemy, plan.patrol_from[i], plan.patrol_to[i] };
+        enemy_patrols.push_back(patrol);
+        deep::start_behavior(enemy, enemy_patrol(patrol.from, patrol.to));
+    }
+
+    ui_state = UI_State::Running;
+    enemies_left = deep::get_enemy_count();
+    start_planning_next_level();
+    save_game_snapshot(level_start_snapshot);
 }
 
 void update(float delta_time)
 {
+    DEEP_PROFILE_SCOPE("update");
     if(ui_state == UI_State::Running)
-    {        
-        int living_enemies = 0;
-        for(int i = 0; i < deep::get_entity_count(); i++)
+    {
+        static std::vector<deep::Entity> killed_enemies;
+        killed_enemies.clear();
+
+        deep::Steering_Players steering_players{};
+        steering_players.count = player_count;
+        for(int player_id = 0; player_id < player_count; player_id++)
         {
-            deep::Entity* entity = deep::get_entity(i);
+            steering_players.positions[player_id] = deep::get_camera_position_2d(player_id);
+            deep::update_flow_field(player_id, steering_players.positions[player_id]);
+        }
+        deep::update_behaviors(steering_players, delta_time);
+
+        // sight and contact for the enemies near the players in one batched pass, enemies chase the nearest player they see
+        const deep::Steering_Batch& steering = deep::steer_enemies(steering_players);
 
-            int nearest_player = 0;
-            float nearest_player_distance = 9999;
-            for(int player_id = 0; player_id < player_count; player_id++)
+        // every enemy only writes its own velocity, so the batch splits across the workers
+        deep::parallel_for(steering.count, 128, [&](int begin, int end)
+        {
+            for(int i = begin; i < end; i++)
             {
-                glm::vec2 player_position = deep::get_camera_position_2d(player_id);
+                deep::Entity entity = steering.entities[i];
+                deep::Velocity_Component* velocity = deep::get_velocity(entity);
+                float radius = deep::get_collision(entity)->radius;
+                glm::vec2 entity_position = glm::vec2(steering.x[i], steering.z[i]);
+
+                // follow the flow field around walls instead of walking straight at the player, but only once they can see them, otherwise keep patrolling
+                velocity->velocity = deep::get_behavior_velocity(entity);
+                glm::vec2 player_position = steering_players.positions[steering.nearest_player[i]];
+                if((steering.flags[i] & deep::Steering_In_Sight) && deep::has_line_of_sight(entity_position, player_position))
+                {
+                    velocity->velocity = deep::sample_flow_field(steering.nearest_player[i], entity_position) * velocity->speed;
+                }
 
-                if(entity->is_active)
+                // push overlapping enemies apart so they don't stack up on the same spot
+                deep::for_each_entity_in_radius(entity_position, radius * 2.0f, [&](deep::Entity other, deep::Position_Component& other_position)
                 {
-                    if(entity->hurt_component)
+                    if(other.index == entity.index || deep::get_enemy(other) == nullptr)
                     {
-                        glm::vec2 entity_position = deep::get_entity_position_2d(entity);
-
-                        float player_distance = glm::distance(player_position, entity_position);
-                        if(player_distance < nearest_player_distance)
-                        {
-                            nearest_player = player_id;
-                            nearest_player_distance = player_distance;
-                        }
-
-                        if(glm::distance(player_position, entity_position) < entity->sight)
-                        {
-                            glm::vec2 direction = glm::normalize(player_position - entity_position);
-                            glm::vec2 new_entity_position = entity_position + direction * entity->speed * delta_time;
-                            deep::set_entity_position_2d(entity, new_entity_position);
-                        }
-                        if(glm::distance(player_position, entity_position) < entity->collision_radius)
-                        {
-                            ui_state = UI_State::Lose;
-                            deep::play_sound(Audio::Hurt);
-                        }
-                        if(players[player_id].is_player_attacking)
-                        {
-                            if(players[player_id].is_player_attacking && glm::distance(player_position, entity_position) < PLAYER_ATTACK_DISTANCE)
-                            {
-                                entity->is_active = false;
-                                deep::play_sound(Audio::Hit);
-                            }
-                        }
+                        return;
                     }
-
-                    if(entity->exit_component)
+                    glm::vec2 away = entity_position - glm::vec2(other_position.position.x, other_position.position.z);
+                    float distance = glm::length(away);
+                    if(distance > 0.0f)
                     {
-                        glm::vec2 entity_position = deep::get_entity_position_2d(entity);
-                        if(glm::distance(player_position, entity_position) < entity->collision_radius)
-                        {
-                            ui_state = UI_State::Win;
-                            deep::play_sound(Audio::Success);
-                        }
+                        velocity->velocity += away / distance * velocity->speed * (1.0f - distance / (radius * 2.0f));
                     }
-                }
-                
+                });
             }
-            if(nearest_player_distance < entity->sight)
+        });
+
+        for(int i = 0; i < steering.count; i++)
+        {
+            if(steering.flags[i] & deep::Steering_Contact)
             {
-                glm::vec2 player_position = deep::get_camera_position_2d(nearest_player);
-                glm::vec2 entity_position = deep::get_entity_position_2d(entity);
-                glm::vec2 direction = glm::normalize(player_position - entity_position);
-                glm::vec2 new_entity_position = entity_position + direction * entity->speed * delta_time;
-                deep::set_entity_position_2d(entity, new_entity_position);
+                ui_state = UI_State::Lose;
+                deep::play_sound(Audio::Hurt);
             }
+        }
 
-            if(entity->is_active && entity->hurt_component)
+        // attacks are hitscan along the view direction, only the first enemy in line is hit and walls stop them
+        deep::Ray attack_rays[2];
+        int attack_count = 0;
+        for(int player_id = 0; player_id < player_count; player_id++)
+        {
+            if(players[player_id].is_player_attacking)
+            {
+                deep::Ray& ray = attack_rays[attack_count++];
+                ray.origin = steering_players.positions[player_id];
+                ray.direction = deep::get_camera_direction_2d(player_id);
+                ray.max_distance = PLAYER_ATTACK_DISTANCE;
+                ray.radius = PLAYER_ATTACK_RADIUS;
+                ray.ignore = players[player_id].entity;
+            }
+        }
+        deep::Ray_Hit attack_hits[2];
+        deep::cast_rays(attack_rays, attack_hits, attack_count);
+        for(int i = 0; i < attack_count; i++)
+        {
+            if(attack_hits[i].hit && deep::get_enemy(attack_hits[i].entity))
             {
-                living_enemies++;
+                killed_enemies.push_back(attack_hits[i].entity);
+                deep::play_sound(Audio::Hit);
             }
         }
 
         for(int player_id = 0; player_id < player_count; player_id++)
         {
             glm::vec2 player_position = deep::get_camera_position_2d(player_id);
-            deep::Entity* entity = deep::get_entity(player_id);
-            deep::set_entity_position_2d(entity, player_position);
+            deep::for_each_entity_in_radius(player_position, EXIT_RADIUS, [&](deep::Entity entity, deep::Position_Component& position)
+            {
+                if(deep::is_exit(entity))
+                {
+                    ui_state = UI_State::Win;
+                    deep::play_sound(Audio::Success);
+                }
+            });
+        }
+
+        // destroying while iterating would swap-remove under the query
+        for(deep::Entity entity : killed_enemies)
+        {
+            deep::destroy_entity(entity);
+        }
+
+        deep::integrate_velocities(delta_time);
+
+        for(int player_id = 0; player_id < player_count; player_id++)
+        {
+            glm::vec2 player_position = deep::get_camera_position_2d(player_id);
+            deep::set_entity_position_2d(players[player_id].entity, player_position);
             players[player_id].is_player_attacking = false;
         }
         
-        enemies_left = living_enemies;
+        enemies_left = deep::get_enemy_count();
     }
 }
 
@@ -493,7 +921,15 @@ void restart()
 {
     deep::clear_scene();
     load_scene();
-    ui_state = UI_State::Running;
+}
+
+// same level from the start, nothing is generated or loaded
+void retry()
+{
+    if(!restore_game_snapshot(level_start_snapshot))
+    {
+        restart();
+    }
 }
 
 void update_ui(float delta_time)
@@ -513,14 +949,16 @@ void update_ui(float delta_time)
             ImGui::Begin("HUD");
             ImGui::Text("You Win");
             if (ImGui::Button("Restart"))
-                restart();
+                pending_input.buttons |= Input_Restart;
             ImGui::End();
             break;
         case Lose:
             ImGui::Begin("HUD");
             ImGui::Text("Game Over");
-            if (ImGui::Button("Restart"))
-                restart();
+            if (ImGui::Button("Retry"))
+                pending_input.buttons |= Input_Retry;
+            if (ImGui::Button("New Level"))
+                pending_input.buttons |= Input_Restart;
             ImGui::End();
             break;
     }
@@ -528,12 +966,71 @@ void update_ui(float delta_time)
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
 {
+    // --record <file> writes the seed and every step's input, --replay <file> plays one back, --headless replays without a window as fast as possible
+    // --benchmark-procgen generates layout batches for a few seconds without a window and reports layouts per second
+    // --log-mesh-optimization logs the vertex cache miss ratio of every mesh before and after it is reordered
+    const char* record_filename = nullptr;
+    const char* replay_filename = nullptr;
+    double time_scale = 1.0;
+    bool benchmark = false;
+    for(int i = 1; i < argc; i++)
+    {
+        if(SDL_strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            record_filename = argv[++i];
+        }
+        else if(SDL_strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replay_filename = argv[++i];
+        }
+        else if(SDL_strcmp(argv[i], "--headless") == 0)
+        {
+            deep::headless = true;
+        }
+        else if(SDL_strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+        {
+            time_scale = SDL_atof(argv[++i]);
+        }
+        else if(SDL_strcmp(argv[i], "--benchmark-procgen") == 0)
+        {
+            benchmark = true;
+        }
+        else if(SDL_strcmp(argv[i], "--log-mesh-optimization") == 0)
+        {
+            deep::log_mesh_optimization = true;
+        }
+    }
+    if(benchmark)
+    {
+        deep::headless = true;
+        deep::init();
+        benchmark_procgen(3.0);
+        return SDL_APP_SUCCESS;
+    }
+    if(deep::headless && replay_filename == nullptr)
+    {
+        SDL_Log("--headless needs a --replay to play, opening a window instead");
+        deep::headless = false;
+    }
+
     deep::use_both_monitors = true;
     if(deep::use_both_monitors)
     {
         player_count = 2;
     }
     deep::init();
+    deep::set_time_scale(time_scale);
+
+    Uint64 seed = std::random_device{}();
+    if(replay_filename && !deep::start_replay(replay_filename, &seed))
+    {
+        return SDL_APP_FAILURE;
+    }
+    if(record_filename && !deep::start_recording(record_filename, seed))
+    {
+        return SDL_APP_FAILURE;
+    }
+    level_random = { seed, 0 };
 
     deep::load_sound("attack.wav");
     deep::load_sound("hit.wav");
@@ -560,76 +1057,170 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
     return SDL_APP_CONTINUE;
 }
 
-SDL_AppResult SDL_AppIterate(void *appstate)
+Uint32 get_movement_buttons(bool forward, bool back, bool left, bool right)
 {
-    double delta_time = deep::get_delta_time();
+    return (forward ? Input_Forward : 0) | (back ? Input_Back : 0) | (left ? Input_Left : 0) | (right ? Input_Right : 0);
+}
 
-    if(ui_state == UI_State::Running)
+// device state for one simulation step plus the events since the last one
+deep::Input_Frame capture_input(float delta_time)
+{
+    deep::Input_Frame input = pending_input;
+    pending_input = {};
+
+    const bool* KEYBOARD_STATE = SDL_GetKeyboardState(NULL);
+    input.buttons |= get_movement_buttons(KEYBOARD_STATE[SDL_SCANCODE_W], KEYBOARD_STATE[SDL_SCANCODE_S], KEYBOARD_STATE[SDL_SCANCODE_A], KEYBOARD_STATE[SDL_SCANCODE_D]);
+
+    if (joystick)
+    {
+        const int JOYSTICK_DEAD_ZONE = 8000;
+        Uint8 hat_state = SDL_GetJoystickHat(joystick, 0);
+        Sint16 x_axis = SDL_GetJoystickAxis(joystick, 0);
+        Sint16 y_axis = SDL_GetJoystickAxis(joystick, 1);
+        bool forward = (hat_state & SDL_HAT_UP) || y_axis < -JOYSTICK_DEAD_ZONE;
+        bool back = (hat_state & SDL_HAT_DOWN) || y_axis > JOYSTICK_DEAD_ZONE;
+        bool left = (hat_state & SDL_HAT_LEFT) || x_axis < -JOYSTICK_DEAD_ZONE;
+        bool right = (hat_state & SDL_HAT_RIGHT) || x_axis > JOYSTICK_DEAD_ZONE;
+        input.buttons |= get_movement_buttons(forward, back, left, right) << INPUT_PLAYER_SHIFT;
+
+        Sint16 axis_right_x_value = SDL_GetJoystickAxis(joystick, 2);
+        Sint16 axis_right_y_value = SDL_GetJoystickAxis(joystick, 3);
+        float x_offset = 0.0f;
+        float y_offset = 0.0f;
+        if (axis_right_x_value > JOYSTICK_DEAD_ZONE || axis_right_x_value < -JOYSTICK_DEAD_ZONE)
+        {
+            x_offset = static_cast<float>(axis_right_x_value) / SDL_JOYSTICK_AXIS_MAX;
+        }
+        if (axis_right_y_value > JOYSTICK_DEAD_ZONE || axis_right_y_value < -JOYSTICK_DEAD_ZONE)
+        {
+            y_offset = static_cast<float>(axis_right_y_value) / SDL_JOYSTICK_AXIS_MAX * -1.0f;
+        }
+        const float CAMERA_SENSITIVITY = 1000.0f * delta_time;
+        input.look[1] += glm::vec2(x_offset, y_offset) * CAMERA_SENSITIVITY;
+    }
+    return input;
+}
+
+void apply_input(const deep::Input_Frame& input, float delta_time)
+{
+    if(input.buttons & Input_Restart)
+    {
+        restart();
+    }
+    else if(input.buttons & Input_Retry)
+    {
+        retry();
+    }
+    if(ui_state != UI_State::Running)
+    {
+        return;
+    }
+    for(int player_id = 0; player_id < player_count; player_id++)
     {
-        const bool* KEYBOARD_STATE = SDL_GetKeyboardState(NULL);
-        bool forward = KEYBOARD_STATE[SDL_SCANCODE_W];
-        bool back = KEYBOARD_STATE[SDL_SCANCODE_S];
-        bool left = KEYBOARD_STATE[SDL_SCANCODE_A];
-        bool right = KEYBOARD_STATE[SDL_SCANCODE_D];
+        if(input.look[player_id] != glm::vec2(0.0f, 0.0f))
+        {
+            deep::camera_process_mouse_movement(player_id, input.look[player_id].x, input.look[player_id].y, true);
+        }
 
+        Uint32 movement = input.buttons >> (player_id * INPUT_PLAYER_SHIFT);
         deep::camera_process_keyboard(
-            0,
-            forward,
-            back,
-            left,
-            right,
+            player_id,
+            movement & Input_Forward,
+            movement & Input_Back,
+            movement & Input_Left,
+            movement & Input_Right,
             false, //KEYBOARD_STATE[SDL_SCANCODE_SPACE],
             false, //KEYBOARD_STATE[SDL_SCANCODE_LSHIFT],
             delta_time
         );
 
-        if (joystick)
+        if(input.buttons & (Input_Attack << player_id))
         {
-            Uint8 hat_state = SDL_GetJoystickHat(joystick, 0);
-            forward = hat_state & SDL_HAT_UP;
-            back = hat_state & SDL_HAT_DOWN;
-            left = hat_state & SDL_HAT_LEFT;
-            right = hat_state & SDL_HAT_RIGHT;
+            players[player_id].is_player_attacking = true;
+            deep::play_sound(Audio::Attack);
+        }
+    }
+}
 
-            const int JOYSTICK_DEAD_ZONE = 8000;
-            Sint16 x_axis = SDL_GetJoystickAxis(joystick, 0);
-            Sint16 y_axis = SDL_GetJoystickAxis(joystick, 1);
-            forward = forward || y_axis < -JOYSTICK_DEAD_ZONE;
-            back = back || y_axis > JOYSTICK_DEAD_ZONE;
-            left = left || x_axis < -JOYSTICK_DEAD_ZONE;
-            right = right || x_axis > JOYSTICK_DEAD_ZONE;
+// one fixed step, input comes from the devices or the replay, returns false once the replay is exhausted
+bool simulate_step(float step_time)
+{
+    deep::Input_Frame input{};
+    if(deep::is_replaying())
+    {
+        // live input is dropped so it can't pile up until the replay ends
+        pending_input = {};
+        if(!deep::read_replay_input(input))
+        {
+            return false;
         }
+    }
+    else
+    {
+        input = capture_input(step_time);
+    }
+    deep::record_input(input);
 
-        deep::camera_process_keyboard(
-            1,
-            forward,
-            back,
-            left,
-            right,
-            false, //KEYBOARD_STATE[SDL_SCANCODE_SPACE],
-            false, //KEYBOARD_STATE[SDL_SCANCODE_LSHIFT],
-            delta_time
-        );
+    Uint64 start = SDL_GetPerformanceCounter();
+    deep::begin_simulation_step();
+    apply_input(input, step_time);
+    update(step_time);
+    Uint64 ticks = SDL_GetPerformanceCounter() - start;
 
-        Sint16 axis_right_x_value = SDL_GetJoystickAxis(joystick, 2);
-        Sint16 axis_right_y_value = SDL_GetJoystickAxis(joystick, 3);
-        const Sint16 JOYSTICK_DEAD_ZONE = 8000;
-        float x_offset = 0.0f;
-        float y_offset = 0.0f;
-        if (axis_right_x_value > JOYSTICK_DEAD_ZONE || axis_right_x_value < -JOYSTICK_DEAD_ZONE)
+    step_stats.count += 1;
+    step_stats.total_ticks += ticks;
+    if(ticks > step_stats.slowest_ticks)
+    {
+        step_stats.slowest_ticks = ticks;
+        step_stats.slowest_step = step_stats.count;
+    }
+    return true;
+}
+
+void log_step_stats()
+{
+    double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+    SDL_Log("Replayed %llu steps in %.1f ms, %.3f ms per step, slowest step %llu took %.3f ms",
+        (unsigned long long)step_stats.count,
+        step_stats.total_ticks * ms_per_tick,
+        step_stats.count ? step_stats.total_ticks * ms_per_tick / step_stats.count : 0.0,
+        (unsigned long long)step_stats.slowest_step,
+        step_stats.slowest_ticks * ms_per_tick);
+}
+
+SDL_AppResult SDL_AppIterate(void *appstate)
+{
+    // no clock and no rendering, the replay runs as fast as the steps do
+    if(deep::headless)
+    {
+        for(int step = 0; step < HEADLESS_STEPS_PER_ITERATE; step++)
         {
-            x_offset = static_cast<float>(axis_right_x_value) / SDL_JOYSTICK_AXIS_MAX;
+            if(!simulate_step(deep::get_simulation_step_time()))
+            {
+                log_step_stats();
+                return SDL_APP_SUCCESS;
+            }
         }
-        if (axis_right_y_value > JOYSTICK_DEAD_ZONE || axis_right_y_value < -JOYSTICK_DEAD_ZONE)
+        return SDL_APP_CONTINUE;
+    }
+
+    double delta_time = deep::get_delta_time();
+
+    // the simulation advances in fixed steps so movement and enemies behave the same at any frame rate, rendering blends between the last two steps
+    int step_count = deep::begin_simulation_frame();
+    float step_time = deep::get_simulation_step_time();
+    for(int step = 0; step < step_count; step++)
+    {
+        bool was_replaying = deep::is_replaying();
+        if(!simulate_step(step_time) && was_replaying)
         {
-            y_offset = static_cast<float>(axis_right_y_value) / SDL_JOYSTICK_AXIS_MAX * -1.0f;
+            log_step_stats();
+            SDL_Log("Replay finished, input is live again");
+            simulate_step(step_time);
         }
-        const float CAMERA_SENSITIVITY = 1000.0f * delta_time;
-        deep::camera_process_mouse_movement(1, x_offset * CAMERA_SENSITIVITY, y_offset * CAMERA_SENSITIVITY, true);
     }
 
     deep::mouse_lock(ui_state == UI_State::Running);
-    update(delta_time);
     update_ui(delta_time);
     deep::update();
 
@@ -654,6 +1245,11 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
         {
             case SDLK_ESCAPE:
                 return SDL_APP_SUCCESS;
+#if DEEP_PROFILE
+            case SDLK_F3:
+                deep::profiling.store(!deep::profiling.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                break;
+#endif
             default:
                 break;
         }
@@ -666,8 +1262,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
             case SDL_BUTTON_LEFT:
                 if(ui_state == UI_State::Running)
                 {
-                    players[0].is_player_attacking = true;
-                    deep::play_sound(Audio::Attack);
+                    pending_input.buttons |= Input_Attack;
                 }
                 break;
             default:
@@ -682,8 +1277,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
             switch (event->jbutton.button)
             {
                 case 10:
-                    players[1].is_player_attacking = true;
-                    deep::play_sound(Audio::Attack);
+                    pending_input.buttons |= Input_Attack << 1;
                     break;
                 default:
                     break;
@@ -697,7 +1291,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
         {
             float x_offset = static_cast<float>(event->motion.xrel);
             float y_offset = static_cast<float>(event->motion.yrel*-1);
-            deep::camera_process_mouse_movement(0, x_offset, y_offset, true);
+            pending_input.look[0] += glm::vec2(x_offset, y_offset);
         } 
     }    
 
@@ -731,4 +1325,4 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
 void SDL_AppQuit(void *appstate, SDL_AppResult result)
 {
     deep::cleanup();
-}
\ No newline at end of file
+}
\ No newline at end of file